@@ -1,31 +1,239 @@
+#define _GNU_SOURCE // copy_file_range, fallocate
 #include "fs_util.h"
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
-// ~~~ Global State Definitions (Shared with minls and minget)
+// ~~~ Private State (one instance per minix_fs_t)
 
-FILE *image_fp = NULL;
-// Byte offset from the start of the image to the filesystem
-long fs_offset = 0; 
-minix_superblock_t curr_sb;
-uint32_t zone_size = 0;
-uint32_t blocks_per_zone = 0; // Calculated from log_zone_size
-int verbose = 0; // Set by init_filesystem
+// Counter updates for --stats: a relaxed atomic add when stats are on,
+// a single branch when they are off
+#define STAT_ADD(fs, field, n) do { \
+    if ((fs)->stats) __atomic_fetch_add(&(fs)->stats->field, \
+        (uint64_t)(n), __ATOMIC_RELAXED); \
+} while (0)
+
+// read_inodes_bulk reads the inode table in runs of at most this many
+// bytes, reading through gaps of up to BULK_INODE_GAP unneeded blocks
+#define BULK_INODE_IO (1024 * 1024)
+#define BULK_INODE_GAP 4
+
+// scan_inode_table reads the inode table this many bytes at a time
+#define SCAN_INODE_IO (1024 * 1024)
+
+// Largest single read issued by copy_file_data while copying a
+// contiguous extent on the buffered (non zero-copy) path
+#define MAX_COPY_IO (4 * 1024 * 1024)
+
+// Read-ahead pipeline for copy_file_data (fs_options_t.read_ahead):
+// data extents are cut into chunks of at most PIPELINE_CHUNK bytes and
+// up to read_ahead of them are read into a ring of buffers ahead of the
+// one being written out. Reads go through io_uring when the kernel
+// allows it, else through up to PIPELINE_THREADS reader threads.
+#define PIPELINE_CHUNK (256 * 1024)
+#define PIPELINE_MAX_DEPTH 256
+#define PIPELINE_THREADS 4
+
+// Indirect block cache: the last few pointer blocks read by get_file_block,
+// keyed by zone number, so each one is read once per file instead of
+// once per logical block. Zones are spread over independently locked
+// shards so threads working on different files rarely wait on each other;
+// pointer blocks are read with no shard lock held.
+#define PTR_CACHE_SLOTS 8
+#define PTR_CACHE_SHARDS 4
+typedef struct {
+    uint32_t zone;              // zone holding the pointers (0 = empty)
+    uint64_t last_used;         // clock value at last access
+    uint32_t *ptrs;             // blocksize bytes of zone pointers
+} ptr_cache_slot_t;
+
+typedef struct {
+    ptr_cache_slot_t slots[PTR_CACHE_SLOTS];
+    uint64_t clock;
+    pthread_mutex_t lock;
+} ptr_cache_shard_t;
+
+struct ptr_cache {
+    ptr_cache_shard_t shards[PTR_CACHE_SHARDS];
+    uint32_t *mem;
+};
+
+// Block cache under read_fs_bytes: fs-relative blocks kept in an LRU
+// list and found through a chained hash table. Reads larger than
+// BLOCK_CACHE_BYPASS go straight to the backend so bulk file data
+// doesn't flush the metadata blocks out of the cache.
+// The cache is split into up to BLOCK_CACHE_SHARDS shards by block
+// number, each with its own LRU list and lock, so concurrent readers
+// mostly take different locks. Small budgets use fewer shards (at least
+// BLOCK_CACHE_MIN_SHARD entries each) to keep the LRU useful. Misses
+// are read outside the shard lock and inserted afterwards.
+#define BLOCK_CACHE_DEFAULT_BUDGET (4 * 1024 * 1024)
+#define BLOCK_CACHE_BYPASS (64 * 1024)
+#define BLOCK_CACHE_SHARDS 16
+#define BLOCK_CACHE_MIN_SHARD 64
+#define CACHE_NONE (-1)
+
+typedef struct {
+    uint64_t block;             // fs-relative block number
+    int32_t lru_prev;           // towards most recently used
+    int32_t lru_next;           // towards least recently used
+    int32_t hash_next;          // next entry in the same bucket
+    uint8_t *data;              // blocksize bytes
+} cache_entry_t;
+
+typedef struct {
+    cache_entry_t *entries;
+    int32_t *buckets;           // hash bucket heads (CACHE_NONE if empty)
+    uint32_t bucket_mask;       // bucket count - 1 (power of two)
+    uint32_t capacity;          // number of entries the budget allows
+    uint32_t used;              // entries handed out so far
+    int32_t lru_head;           // most recently used
+    int32_t lru_tail;           // least recently used (next victim)
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    pthread_mutex_t lock;
+} cache_shard_t;
+
+struct block_cache {
+    cache_shard_t shards[BLOCK_CACHE_SHARDS];
+    uint32_t nshards;           // shards in use, 0 if the cache is disabled
+    uint8_t *data_mem;
+};
+
+// Directory indexes: a name -> inode hash table per directory, built the
+// first time the directory is searched and kept until the filesystem is
+// cleaned up. Images are read-only, so an index never goes stale, and
+// an index is never modified once it is in the table, so it can be
+// searched without holding the table lock.
+#define DIR_TABLE_BUCKETS 256
+#define DIR_NAME_MAX 60
+
+typedef struct dir_index {
+    uint32_t dir_inode;         // inode number of the indexed directory
+    uint32_t slot_mask;         // slot count - 1 (power of two)
+    uint32_t *slots;            // entry number + 1, 0 if empty
+    minix_dir_entry_t *entries; // live entries, first occurrence of a name
+    uint32_t count;
+    struct dir_index *next;     // next index in the same table bucket
+} dir_index_t;
+
+struct dir_table {
+    dir_index_t *buckets[DIR_TABLE_BUCKETS];
+    pthread_rwlock_t lock;      // guards the bucket chains
+};
+
+// Dentry cache: (parent inode, name) -> inode and mode, including misses
+// (inode 0). Whole resolved paths are cached in the same table under the
+// pseudo-parent 0, which no real directory uses. It holds at most
+// DCACHE_MAX_ENTRIES dentries; past that, each insert evicts one chosen
+// by CLOCK, so a long-running minsrv asked for endless distinct names
+// stays bounded.
+#define DCACHE_INITIAL_BUCKETS 1024
+#define DCACHE_MAX_ENTRIES (64 * 1024)
+#define DCACHE_PATH_PARENT 0
+
+typedef struct dentry {
+    uint32_t parent;            // parent directory, or DCACHE_PATH_PARENT
+    uint32_t inode;             // 0 for a cached miss
+    uint16_t mode;              // mode of inode (unset for misses)
+    uint8_t referenced;         // CLOCK bit, set by every hit
+    uint32_t hash;
+    struct dentry *next;
+    size_t len;
+    char name[];                // component, or full canonical path
+} dentry_t;
+
+struct dcache {
+    dentry_t **buckets;
+    uint32_t mask;              // bucket count - 1
+    uint32_t count;
+    uint32_t hand;              // CLOCK hand: bucket to evict from next
+    pthread_rwlock_t lock;      // readers look up, writers insert/grow
+};
+
+// Path index: a sidecar file (by default "<image>.midx", written by
+// build_path_index) mapping every canonical path in the filesystem to
+// its inode, mode and size, and every regular file inode to its extent
+// list. It is mapped read-only and only used if it was built from this
+// very image: same size and mtime, same filesystem offset and
+// superblock. All sections start on 8-byte boundaries; offsets are from
+// the file start.
+#define PATH_INDEX_MAGIC "MINIDX02"
+#define PATH_INDEX_SUFFIX ".midx"
+#define PATH_INDEX_MAX_PATH 1023 // get_inode_by_path's limit
+
+typedef struct PACKED {
+    char magic[8];              // PATH_INDEX_MAGIC
+    uint64_t image_size;        // image st_size when the index was built
+    int64_t image_mtime_sec;    // image st_mtim when the index was built
+    int64_t image_mtime_nsec;
+    int64_t fs_offset;          // which filesystem of the image
+    minix_superblock_t sb;      // must match the image's byte for byte
+    uint32_t nslots;            // hash slots (power of two)
+    uint32_t npaths;
+    uint32_t ninodes;
+    uint32_t pad;
+    uint64_t nextents;
+    uint64_t slots_off;         // nslots x uint32_t: path number + 1, or 0
+    uint64_t paths_off;         // npaths x path_index_path_t
+    uint64_t inodes_off;        // ninodes x path_index_inode_t, by inode
+    uint64_t extents_off;       // nextents x path_index_extent_t
+    uint64_t strings_off;       // path bytes, not NUL-terminated
+    uint64_t strings_len;
+    uint64_t file_size;
+} path_index_header_t;
+
+typedef struct PACKED {
+    uint32_t hash;              // hash_name of the path
+    uint32_t inode;
+    uint64_t path_off;          // into the strings section
+    uint16_t path_len;          // at most PATH_INDEX_MAX_PATH
+    uint16_t mode;              // the inode's mode and size, so type
+    uint32_t size;              // and size checks need no inode read
+} path_index_path_t;
+
+typedef struct PACKED {
+    uint32_t inode;
+    uint32_t extent_count;
+    uint64_t extent_first;      // into the extents section
+} path_index_inode_t;
+
+typedef struct PACKED {
+    uint32_t logical;
+    uint32_t physical;
+    uint32_t length;
+    uint32_t hole;
+} path_index_extent_t;
+
+struct path_index {
+    const uint8_t *map;
+    size_t map_len;
+    const path_index_header_t *hdr;
+    const uint32_t *slots;
+    const path_index_path_t *paths;
+    const path_index_inode_t *inodes;
+    const path_index_extent_t *extents;
+    const char *strings;
+};
+
+static void free_dir_indexes(minix_fs_t *fs);
+static void free_dcache(minix_fs_t *fs);
+static void attach_path_index(minix_fs_t *fs, const char *image_file, \
+    const char *index_file);
+static const path_index_path_t *path_index_lookup(minix_fs_t *fs, \
+    const char *path, size_t len);
+static void free_path_index(minix_fs_t *fs);
 
 // ~~~ Reads and validates the Master Boot Record
 // Returns 0 on success (buffer filled, magic good), -1 on failure.
-static int read_mbr_and_check_magic(off_t table_addr, uint8_t mbr_buffer[512]) {
+static int read_mbr_and_check_magic(minix_fs_t *fs, off_t table_addr, \
+    uint8_t mbr_buffer[512]) {
     // The MBR is 512 bytes long (1 sector)
-    if (fseek(image_fp, table_addr - PARTITION_TABLE_OFFSET, SEEK_SET) != 0) {
+    off_t mbr_addr = table_addr - PARTITION_TABLE_OFFSET;
+    if (read_image_bytes(fs, mbr_addr, mbr_buffer, SECTOR_SIZE) != 0) {
         fprintf(stderr, 
-        "Error: fseek to MBR offset %ld failed.\n", 
-        table_addr - PARTITION_TABLE_OFFSET);
-        return -1;
-    }
-    
-    // Read the entire 512-byte MBR block
-    if (fread(mbr_buffer, 1, SECTOR_SIZE, image_fp) != SECTOR_SIZE) {
-        fprintf(stderr, 
-        "Error: Failed to read MBR at offset %ld.\n", 
-        table_addr - PARTITION_TABLE_OFFSET);
+        "Error: Failed to read MBR at offset %ld.\n", (long)mbr_addr);
         return -1;
     }
     
@@ -43,11 +251,12 @@ static int read_mbr_and_check_magic(off_t table_addr, uint8_t mbr_buffer[512]) {
 
 // ~~~ Reads Partition Entry from absolute disk offset
 // table_addr is the offset to the partition table entries (0x1BE)
-static uint32_t get_partition_start(int part_num, off_t table_addr) {
+static uint32_t get_partition_start(minix_fs_t *fs, int part_num, \
+    off_t table_addr) {
     uint8_t mbr_buffer[SECTOR_SIZE]; // 512 bytes for MBR
 
     // Read MBR and validate magic
-    if (read_mbr_and_check_magic(table_addr, mbr_buffer) != 0) {
+    if (read_mbr_and_check_magic(fs, table_addr, mbr_buffer) != 0) {
         return 0; // Failure handled inside read_mbr_and_check_magic
     }
 
@@ -78,110 +287,699 @@ static uint32_t get_partition_start(int part_num, off_t table_addr) {
 
 // ~~~ 1. Low-Level I/O
 
-/** * Reads bytes from the disk image relative to the 
-* filesystem start (fs_offset).
-* Returns 0 on success, -1 on failure.
+/**
+* Fills in the default options for init_filesystem.
 */
-int read_fs_bytes(off_t offset_from_fs_start, void *buffer, size_t nbytes) {
-    off_t abs_offset = fs_offset + offset_from_fs_start;
-    
-    if (fseek(image_fp, abs_offset, SEEK_SET) != 0) {
-        if (verbose) fprintf(stderr, "read_fs_bytes: \
-        fseek to offset %ld failed (errno: %d).\n", abs_offset, errno);
+void fs_default_options(fs_options_t *opts) {
+    opts->io_backend = IO_BACKEND_PREAD;
+    opts->block_cache_budget = BLOCK_CACHE_DEFAULT_BUDGET;
+    opts->verbose = 0;
+    opts->path_index = NULL;
+    opts->stats = FS_STATS_OFF;
+    opts->read_ahead = 0;
+    opts->read_ahead_threads = 0;
+}
+
+/**
+* Parses an I/O backend name ("pread" or "mmap").
+* Returns 0 on success, -1 if the name is not a known backend.
+*/
+int parse_io_backend(const char *name, io_backend_t *backend_out) {
+    if (strcmp(name, "pread") == 0) {
+        *backend_out = IO_BACKEND_PREAD;
+    } else if (strcmp(name, "mmap") == 0) {
+        *backend_out = IO_BACKEND_MMAP;
+    } else {
+        fprintf(stderr, "Unknown I/O backend: %s (use pread or mmap)\n", \
+            name);
         return -1;
     }
-    
-    if (fread(buffer, 1, nbytes, image_fp) != nbytes) {
-        if (verbose) fprintf(stderr, "read_fs_bytes: \
-        fread %zu bytes at offset %ld failed.\n", nbytes, abs_offset);
+    return 0;
+}
+
+/**
+* Parses a --stats format name ("text" or "json").
+* Returns 0 on success, -1 if the name is not a known format.
+*/
+int parse_stats_format(const char *name, fs_stats_format_t *format_out) {
+    if (strcmp(name, "text") == 0) {
+        *format_out = FS_STATS_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        *format_out = FS_STATS_JSON;
+    } else {
+        fprintf(stderr, "Unknown stats format: %s (use text or json)\n", \
+            name);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Parses a block cache size given in KiB (-c) into bytes. Only plain
+* decimal numbers are accepted; 0 disables the cache.
+* Returns 0 on success, -1 if the size is not a valid number.
+*/
+int parse_cache_size(const char *kib, size_t *budget_out) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(kib, &end, 10);
+    if (kib[0] < '0' || kib[0] > '9' || *end != '\0' || errno != 0 || \
+        n > SIZE_MAX / 1024) {
+        fprintf(stderr, "Invalid cache size: %s (use a number of KiB)\n", \
+            kib);
         return -1;
     }
+    *budget_out = (size_t)n * 1024;
     return 0;
 }
 
+/**
+* Returns a monotonic timestamp in nanoseconds if stats are being kept,
+* else 0 (so timing costs nothing when they are off).
+*/
+static uint64_t stats_clock(minix_fs_t *fs) {
+    struct timespec ts;
+    if (!fs->stats) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+* Counts one read that reached the backend, started at `start`.
+*/
+static void stats_image_read(minix_fs_t *fs, off_t abs_offset, \
+    size_t nbytes, uint64_t start) {
+    if (!fs->stats) return;
 
-// ~~~ 2. Filesystem Initialization
+    uint64_t end = (uint64_t)abs_offset + nbytes;
+    uint64_t prev = __atomic_exchange_n(&fs->stats->image_last_end, end, \
+        __ATOMIC_RELAXED);
+    STAT_ADD(fs, image_reads, 1);
+    STAT_ADD(fs, image_bytes, nbytes);
+    if (prev != (uint64_t)abs_offset) STAT_ADD(fs, image_seeks, 1);
+    STAT_ADD(fs, image_read_ns, stats_clock(fs) - start);
+}
 
 /**
-* Initializes the global state (fs_offset, superblock).
+* Opens the image and sets up the selected backend. If the image can't
+* be mapped (empty file, pipe, ...) the mmap backend falls back to pread.
 * Returns 0 on success, -1 on failure.
 */
-int init_filesystem(const char *image_file, int p_num, int s_num, \
-    int verbose_flag) {
-    verbose = verbose_flag;
-    
-    // Open the image file
-    image_fp = fopen(image_file, "r");
-    if (!image_fp) {
+static int open_image(minix_fs_t *fs, const char *image_file) {
+    struct stat st;
+
+    fs->image_fd = open(image_file, O_RDONLY);
+    if (fs->image_fd < 0) {
         perror("Error opening image file");
         return -1;
     }
 
+    if (fs->io_backend != IO_BACKEND_MMAP) {
+        return 0;
+    }
+
+    if (fstat(fs->image_fd, &st) == 0 && S_ISREG(st.st_mode) && \
+        st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, \
+            fs->image_fd, 0);
+        if (map != MAP_FAILED) {
+            fs->image_map = map;
+            fs->image_map_len = (size_t)st.st_size;
+            return 0;
+        }
+    }
+
+    if (fs->verbose) fprintf(stderr, \
+        "open_image: mmap unavailable, falling back to pread.\n");
+    fs->io_backend = IO_BACKEND_PREAD;
+    return 0;
+}
+
+/**
+* Reads bytes from an absolute offset in the image through the selected
+* backend. Reads are positional, so no seek state is shared between calls.
+* Returns 0 on success, -1 on failure (including short reads).
+*/
+int read_image_bytes(minix_fs_t *fs, off_t abs_offset, void *buffer, \
+    size_t nbytes) {
+    if (abs_offset < 0) return -1;
+
+    uint64_t start = stats_clock(fs);
+    if (fs->io_backend == IO_BACKEND_MMAP) {
+        if ((size_t)abs_offset > fs->image_map_len || \
+            nbytes > fs->image_map_len - (size_t)abs_offset) {
+            if (fs->verbose) fprintf(stderr, "read_image_bytes: \
+        %zu bytes at offset %ld is past the end of the image.\n", \
+                nbytes, (long)abs_offset);
+            return -1;
+        }
+        memcpy(buffer, fs->image_map + abs_offset, nbytes);
+        stats_image_read(fs, abs_offset, nbytes, start);
+        return 0;
+    }
+
+    // pread may return short counts, so keep going until done
+    uint8_t *dst = buffer;
+    size_t done = 0;
+    while (done < nbytes) {
+        ssize_t n = pread(fs->image_fd, dst + done, nbytes - done, \
+            abs_offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (fs->verbose) fprintf(stderr, "read_image_bytes: \
+        pread %zu bytes at offset %ld failed (errno: %d).\n", \
+                nbytes, (long)abs_offset, n < 0 ? errno : 0);
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    stats_image_read(fs, abs_offset, nbytes, start);
+    return 0;
+}
+
+/**
+* Copies nbytes starting at a filesystem offset straight to out_fd at
+* its current position, without a userspace buffer: copy_file_range for
+* a regular file destination, sendfile otherwise (pipes, sockets), or a
+* single write out of the mapping with the mmap backend.
+* *copied_out is set to the number of bytes copied, even on failure, so
+* the caller can finish the range another way.
+* Returns 0 on success, -1 on failure (errno set).
+*/
+int copy_fs_bytes_to_fd(minix_fs_t *fs, off_t offset_from_fs_start, \
+    size_t nbytes, int out_fd, int out_is_regular, size_t *copied_out) {
+    off_t abs_offset = fs->fs_offset + offset_from_fs_start;
+    size_t done = 0;
+
+    *copied_out = 0;
+    if (fs->io_backend == IO_BACKEND_MMAP && \
+        ((size_t)abs_offset > fs->image_map_len || \
+        nbytes > fs->image_map_len - (size_t)abs_offset)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (done < nbytes) {
+        ssize_t n;
+        if (fs->io_backend == IO_BACKEND_MMAP) {
+            n = write(out_fd, fs->image_map + abs_offset + done, nbytes - done);
+        } else if (out_is_regular) {
+            loff_t in_off = abs_offset + (off_t)done;
+            n = copy_file_range(fs->image_fd, &in_off, out_fd, NULL, \
+                nbytes - done, 0);
+        } else {
+            off_t in_off = abs_offset + (off_t)done;
+            n = sendfile(out_fd, fs->image_fd, &in_off, nbytes - done);
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            // 0 means the image ended early
+            if (n == 0) errno = EIO;
+            *copied_out = done;
+            STAT_ADD(fs, copy_bytes, done);
+            return -1;
+        }
+        done += (size_t)n;
+    }
+
+    *copied_out = done;
+    STAT_ADD(fs, copy_bytes, done);
+    return 0;
+}
+
+/**
+* Hints that a range of the filesystem will be read soon, so the kernel
+* can start reading it in the background (posix_fadvise for pread,
+* madvise for mmap). Purely advisory: errors are ignored.
+*/
+void prefetch_fs_bytes(minix_fs_t *fs, off_t offset_from_fs_start, \
+    size_t nbytes) {
+    off_t abs_offset = fs->fs_offset + offset_from_fs_start;
+
+    if (abs_offset < 0 || nbytes == 0) return;
+
+    if (fs->io_backend == IO_BACKEND_MMAP) {
+        if ((size_t)abs_offset >= fs->image_map_len) return;
+        if (nbytes > fs->image_map_len - (size_t)abs_offset) {
+            nbytes = fs->image_map_len - (size_t)abs_offset;
+        }
+        // madvise wants a page-aligned start
+        long page = sysconf(_SC_PAGESIZE);
+        size_t lead = (size_t)abs_offset % (size_t)page;
+        madvise((void *)(fs->image_map + abs_offset - lead), nbytes + lead, \
+            MADV_WILLNEED);
+        return;
+    }
+
+    posix_fadvise(fs->image_fd, abs_offset, (off_t)nbytes, POSIX_FADV_WILLNEED);
+}
+
+/**
+* Sizes and allocates the block cache from the budget, once blocksize
+* is known. A budget smaller than one block leaves the cache disabled.
+* Returns 0 on success, -1 on allocation failure.
+*/
+static int block_cache_init(minix_fs_t *fs, size_t budget) {
+    struct block_cache *bc = fs->block_cache;
+    uint32_t capacity = 0;
+    uint32_t nshards;
+    uint32_t s;
+    uint32_t i;
+
+    for (s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+        bc->shards[s].lru_head = bc->shards[s].lru_tail = CACHE_NONE;
+    }
+    if (fs->sb.blocksize > 0) {
+        capacity = budget / fs->sb.blocksize;
+    }
+    if (capacity == 0) return 0;
+
+    nshards = capacity / BLOCK_CACHE_MIN_SHARD;
+    if (nshards > BLOCK_CACHE_SHARDS) nshards = BLOCK_CACHE_SHARDS;
+    if (nshards == 0) nshards = 1;
+
+    bc->data_mem = malloc((size_t)capacity * fs->sb.blocksize);
+    if (!bc->data_mem) {
+        perror("Error allocating block cache");
+        return -1;
+    }
+
+    uint8_t *data = bc->data_mem;
+    for (s = 0; s < nshards; s++) {
+        cache_shard_t *sh = &bc->shards[s];
+        uint32_t nbuckets = 1;
+
+        // Split the entries evenly, the first shards taking the remainder
+        sh->capacity = capacity / nshards + (s < capacity % nshards);
+
+        // Keep chains short: at least one bucket per entry
+        while (nbuckets < sh->capacity) nbuckets <<= 1;
+
+        sh->entries = malloc((size_t)sh->capacity * sizeof(cache_entry_t));
+        sh->buckets = malloc((size_t)nbuckets * sizeof(int32_t));
+        if (!sh->entries || !sh->buckets) {
+            perror("Error allocating block cache");
+            return -1;
+        }
+        for (i = 0; i < nbuckets; i++) {
+            sh->buckets[i] = CACHE_NONE;
+        }
+        for (i = 0; i < sh->capacity; i++) {
+            sh->entries[i].data = data;
+            data += fs->sb.blocksize;
+        }
+        sh->bucket_mask = nbuckets - 1;
+    }
+    bc->nshards = nshards;
+    return 0;
+}
+
+/**
+* Releases the block cache's memory, printing its counters first in
+* verbose mode.
+*/
+static void block_cache_free(minix_fs_t *fs) {
+    struct block_cache *bc = fs->block_cache;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    uint32_t capacity = 0;
+    uint32_t s;
+
+    for (s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+        cache_shard_t *sh = &bc->shards[s];
+        hits += sh->hits;
+        misses += sh->misses;
+        evictions += sh->evictions;
+        capacity += sh->capacity;
+        free(sh->entries);
+        free(sh->buckets);
+        sh->entries = NULL;
+        sh->buckets = NULL;
+        sh->capacity = 0;
+    }
+    if (fs->verbose && bc->nshards > 0) {
+        fprintf(stderr, "Block cache: %lu hits, %lu misses, \
+%lu evictions (%u x %u-byte blocks, %u shards)\n", \
+            (unsigned long)hits, (unsigned long)misses, \
+            (unsigned long)evictions, capacity, fs->sb.blocksize, \
+            bc->nshards);
+    }
+    free(bc->data_mem);
+    bc->data_mem = NULL;
+    bc->nshards = 0;
+}
+
+static uint32_t block_cache_hash(const cache_shard_t *sh, uint64_t block) {
+    // Fibonacci hashing spreads runs of consecutive block numbers
+    return (uint32_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & \
+        sh->bucket_mask;
+}
+
+static void lru_unlink(cache_shard_t *sh, int32_t i) {
+    cache_entry_t *e = &sh->entries[i];
+    if (e->lru_prev != CACHE_NONE) {
+        sh->entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        sh->lru_head = e->lru_next;
+    }
+    if (e->lru_next != CACHE_NONE) {
+        sh->entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        sh->lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(cache_shard_t *sh, int32_t i) {
+    cache_entry_t *e = &sh->entries[i];
+    e->lru_prev = CACHE_NONE;
+    e->lru_next = sh->lru_head;
+    if (sh->lru_head != CACHE_NONE) {
+        sh->entries[sh->lru_head].lru_prev = i;
+    } else {
+        sh->lru_tail = i;
+    }
+    sh->lru_head = i;
+}
+
+/**
+* Removes entry i from its hash chain.
+*/
+static void hash_unlink(cache_shard_t *sh, int32_t i) {
+    int32_t *link = &sh->buckets[block_cache_hash(sh, sh->entries[i].block)];
+    while (*link != i) {
+        link = &sh->entries[*link].hash_next;
+    }
+    *link = sh->entries[i].hash_next;
+}
+
+/**
+* Returns the cached contents of one fs-relative block from its shard,
+* or NULL on a miss. Caller must hold the shard lock; the data stays
+* valid until it is released.
+*/
+static const uint8_t *block_cache_find(cache_shard_t *sh, uint64_t block) {
+    int32_t i;
+
+    for (i = sh->buckets[block_cache_hash(sh, block)]; i != CACHE_NONE; \
+        i = sh->entries[i].hash_next) {
+        if (sh->entries[i].block == block) {
+            if (sh->lru_head != i) {
+                lru_unlink(sh, i);
+                lru_push_front(sh, i);
+            }
+            return sh->entries[i].data;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Caches a block that was read with no lock held, evicting the shard's
+* least recently used block when the shard is full. If another thread
+* cached the block in the meantime, its copy is kept. Caller must hold
+* the shard lock.
+*/
+static void block_cache_insert(minix_fs_t *fs, cache_shard_t *sh, \
+    uint64_t block, const uint8_t *data) {
+    uint32_t bucket = block_cache_hash(sh, block);
+    int32_t i;
+
+    if (block_cache_find(sh, block)) return;
+
+    // Take a fresh entry while there are any, else recycle the LRU one
+    if (sh->used < sh->capacity) {
+        i = (int32_t)sh->used++;
+    } else {
+        i = sh->lru_tail;
+        lru_unlink(sh, i);
+        hash_unlink(sh, i);
+        sh->evictions++;
+    }
+
+    cache_entry_t *e = &sh->entries[i];
+    memcpy(e->data, data, fs->sb.blocksize);
+    e->block = block;
+    e->hash_next = sh->buckets[bucket];
+    sh->buckets[bucket] = i;
+    lru_push_front(sh, i);
+}
+
+/** * Reads bytes from the disk image relative to the 
+* filesystem start (fs->fs_offset). Small reads are served block by block
+* from the block cache; large reads and reads the cache can't satisfy
+* go directly to the backend. A missing block is read with no shard
+* lock held, so other threads using the shard don't wait on the I/O.
+* Safe to call from any number of threads.
+* Returns 0 on success, -1 on failure.
+*/
+int read_fs_bytes(minix_fs_t *fs, off_t offset_from_fs_start, void *buffer, \
+    size_t nbytes) {
+    struct block_cache *bc = fs->block_cache;
+    STAT_ADD(fs, read_calls, 1);
+    STAT_ADD(fs, read_bytes, nbytes);
+    if (bc->nshards == 0 || nbytes > BLOCK_CACHE_BYPASS || \
+        offset_from_fs_start < 0) {
+        return read_image_bytes(fs, fs->fs_offset + offset_from_fs_start, \
+            buffer, nbytes);
+    }
+
+    uint8_t *dst = buffer;
+    uint8_t *block_buf = NULL;
+    uint64_t offset = (uint64_t)offset_from_fs_start;
+    int status = 0;
+    while (nbytes > 0) {
+        uint64_t block = offset / fs->sb.blocksize;
+        size_t in_block = (size_t)(offset % fs->sb.blocksize);
+        size_t chunk = fs->sb.blocksize - in_block;
+        if (chunk > nbytes) chunk = nbytes;
+
+        // The block stays valid only while its shard lock is held
+        cache_shard_t *sh = &bc->shards[block % bc->nshards];
+        pthread_mutex_lock(&sh->lock);
+        const uint8_t *data = block_cache_find(sh, block);
+        if (data) {
+            sh->hits++;
+            memcpy(dst, data + in_block, chunk);
+        } else {
+            sh->misses++;
+        }
+        pthread_mutex_unlock(&sh->lock);
+
+        if (!data) {
+            if (!block_buf) block_buf = malloc(fs->sb.blocksize);
+            if (block_buf && read_image_bytes(fs, fs->fs_offset + \
+                (off_t)block * fs->sb.blocksize, block_buf, \
+                fs->sb.blocksize) == 0) {
+                pthread_mutex_lock(&sh->lock);
+                block_cache_insert(fs, sh, block, block_buf);
+                pthread_mutex_unlock(&sh->lock);
+                memcpy(dst, block_buf + in_block, chunk);
+            } else if (read_image_bytes(fs, fs->fs_offset + (off_t)offset, \
+                dst, chunk) != 0) {
+                // e.g. a partial block at the end of the image
+                status = -1;
+                break;
+            }
+        }
+
+        dst += chunk;
+        offset += chunk;
+        nbytes -= chunk;
+    }
+    free(block_buf);
+    return status;
+}
+
+
+// ~~~ 2. Filesystem Initialization
+
+/**
+* Opens the image, locates the filesystem (partition/subpartition if
+* requested), reads the superblock and sets up the caches. opts may be
+* NULL for the defaults. The superblock and geometry in the returned
+* handle don't change afterwards, and every read function may be
+* called on it from many threads at once.
+* Returns the new handle, or NULL on failure (errors printed to stderr).
+*/
+minix_fs_t *init_filesystem(const char *image_file, int p_num, int s_num, \
+    const fs_options_t *opts) {
+    fs_options_t defaults;
+    if (!opts) {
+        fs_default_options(&defaults);
+        opts = &defaults;
+    }
+
+    minix_fs_t *fs = calloc(1, sizeof(minix_fs_t));
+    if (!fs) {
+        perror("Error allocating filesystem");
+        return NULL;
+    }
+    fs->image_fd = -1;
+    fs->io_backend = opts->io_backend;
+    fs->verbose = opts->verbose;
+    fs->stats_format = opts->stats;
+    fs->read_ahead = opts->read_ahead < PIPELINE_MAX_DEPTH ? \
+        opts->read_ahead : PIPELINE_MAX_DEPTH;
+    fs->read_ahead_threads = opts->read_ahead_threads;
+
+    fs->ptr_cache = calloc(1, sizeof(struct ptr_cache));
+    fs->block_cache = calloc(1, sizeof(struct block_cache));
+    fs->dirs = calloc(1, sizeof(struct dir_table));
+    fs->dcache = calloc(1, sizeof(struct dcache));
+    if (opts->stats != FS_STATS_OFF) {
+        fs->stats = calloc(1, sizeof(fs_stats_t));
+    }
+    if (!fs->ptr_cache || !fs->block_cache || !fs->dirs || !fs->dcache || \
+        (opts->stats != FS_STATS_OFF && !fs->stats)) {
+        perror("Error allocating filesystem");
+        cleanup_filesystem(fs);
+        return NULL;
+    }
+    for (int i = 0; i < PTR_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&fs->ptr_cache->shards[i].lock, NULL);
+    }
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&fs->block_cache->shards[i].lock, NULL);
+    }
+    pthread_rwlock_init(&fs->dirs->lock, NULL);
+    pthread_rwlock_init(&fs->dcache->lock, NULL);
+    
+    // Open the image file with the selected backend
+    if (open_image(fs, image_file) != 0) {
+        cleanup_filesystem(fs);
+        return NULL;
+    }
+
     // 1) Determine fs_offset from partitioning (if requested)
-    fs_offset = 0; // Default to unpartitioned
+    fs->fs_offset = 0; // Default to unpartitioned
     
     if (p_num != -1) {
         // Primary partition table is at disk offset 0 + 0x1BE
-        uint32_t p_start_sector = get_partition_start(p_num, \
+        uint32_t p_start_sector = get_partition_start(fs, p_num, \
             PARTITION_TABLE_OFFSET);
         if (p_start_sector == 0) {
             // Error already printed in get_partition_start
-            return -1; 
+            cleanup_filesystem(fs);
+            return NULL; 
         }
         
-        fs_offset = (long)p_start_sector * SECTOR_SIZE;
+        fs->fs_offset = (long)p_start_sector * SECTOR_SIZE;
         
         if (s_num != -1) {
 // Subpartition table starts relative to the containing partition's MBR block
 // MBR block is at fs_offset, and the table is at MBR_block + 0x1BE
-            off_t sub_pt_addr = fs_offset + PARTITION_TABLE_OFFSET;
+            off_t sub_pt_addr = fs->fs_offset + PARTITION_TABLE_OFFSET;
             uint32_t s_start_sector_rel_disk = \
-            get_partition_start(s_num, sub_pt_addr);
+            get_partition_start(fs, s_num, sub_pt_addr);
             
             if (s_start_sector_rel_disk == 0) {
                 // Error already printed in get_partition_start
-                return -1; 
+                cleanup_filesystem(fs);
+                return NULL; 
             }
             
             // The subpartition's LBA is relative to the disk start, 
             // so we update fs_offset
-            fs_offset = (long)s_start_sector_rel_disk * SECTOR_SIZE;
+            fs->fs_offset = (long)s_start_sector_rel_disk * SECTOR_SIZE;
         }
     }
     
     // 2) Read Superblock (always at offset 1024 bytes from FS start)
-    if (read_fs_bytes(1024, &curr_sb, sizeof(minix_superblock_t)) != 0) {
+    if (read_fs_bytes(fs, 1024, &fs->sb, sizeof(minix_superblock_t)) != 0) {
         fprintf(stderr, \
-            "Error reading superblock (offset %ld).\n", fs_offset + 1024);
-        return -1;
+            "Error reading superblock (offset %ld).\n", fs->fs_offset + 1024);
+        cleanup_filesystem(fs);
+        return NULL;
     }
     
     // 3) Validate Magic Number
-    if (curr_sb.magic != 0x4D5A) { // MINIX v3 magic number
-        fprintf(stderr, "Bad magic number. (0x%04x)\n", curr_sb.magic);
+    if (fs->sb.magic != 0x4D5A) { // MINIX v3 magic number
+        fprintf(stderr, "Bad magic number. (0x%04x)\n", fs->sb.magic);
         fprintf(stderr, "This doesn't look like a MINIX filesystem.\n");
-        return -1;
+        cleanup_filesystem(fs);
+        return NULL;
     }
     
     // 4) Calculate disk geometry
-    blocks_per_zone = 1 << curr_sb.log_zone_size;
-    zone_size = (uint32_t)curr_sb.blocksize * blocks_per_zone;
+    fs->blocks_per_zone = 1 << fs->sb.log_zone_size;
+    fs->zone_size = (uint32_t)fs->sb.blocksize * fs->blocks_per_zone;
+    
+    // 5) Allocate the indirect block cache now that blocksize is known
+    fs->ptr_cache->mem = malloc((size_t)PTR_CACHE_SHARDS * PTR_CACHE_SLOTS * \
+        fs->sb.blocksize);
+    if (!fs->ptr_cache->mem) {
+        perror("Error allocating indirect block cache");
+        cleanup_filesystem(fs);
+        return NULL;
+    }
+    uint32_t *slot_mem = fs->ptr_cache->mem;
+    for (int i = 0; i < PTR_CACHE_SHARDS; i++) {
+        for (int j = 0; j < PTR_CACHE_SLOTS; j++) {
+            fs->ptr_cache->shards[i].slots[j].ptrs = slot_mem;
+            slot_mem += fs->sb.blocksize / sizeof(uint32_t);
+        }
+    }
+
+    // 6) Set up the block cache under read_fs_bytes
+    if (block_cache_init(fs, opts->block_cache_budget) != 0) {
+        cleanup_filesystem(fs);
+        return NULL;
+    }
     
-    if (verbose) {
-        print_verbose_superblock(image_file, p_num, s_num);
+    if (fs->verbose) {
+        print_verbose_superblock(fs, image_file, p_num, s_num);
+    }
+
+    // 7) Use the path index, if there is a valid one for this image
+    if (!opts->path_index || opts->path_index[0] != '\0') {
+        attach_path_index(fs, image_file, opts->path_index);
     }
     
-    return 0;
+    return fs;
 }
 
 /**
-* Cleans up global state, closing the file pointer.
+* Releases everything owned by the handle: caches, the mapping and the
+* image descriptor, printing the --stats summary first if one was
+* requested. Accepts NULL and partially initialized handles.
 */
-void cleanup_filesystem(void) {
-    if (image_fp) {
-        fclose(image_fp);
-        image_fp = NULL;
+void cleanup_filesystem(minix_fs_t *fs) {
+    if (!fs) return;
+
+    if (fs->stats && fs->block_cache) {
+        print_fs_stats(fs, stderr, fs->stats_format);
+    }
+    free(fs->stats);
+    fs->stats = NULL;
+    free_path_index(fs);
+
+    // The locks were only set up if every cache was allocated
+    if (fs->dcache && fs->dirs && fs->block_cache && fs->ptr_cache) {
+        free_dcache(fs);
+        free_dir_indexes(fs);
+        block_cache_free(fs);
+        free(fs->ptr_cache->mem);
+
+        pthread_rwlock_destroy(&fs->dcache->lock);
+        pthread_rwlock_destroy(&fs->dirs->lock);
+        for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+            pthread_mutex_destroy(&fs->block_cache->shards[i].lock);
+        }
+        for (int i = 0; i < PTR_CACHE_SHARDS; i++) {
+            pthread_mutex_destroy(&fs->ptr_cache->shards[i].lock);
+        }
+    }
+    free(fs->dcache);
+    free(fs->dirs);
+    free(fs->block_cache);
+    free(fs->ptr_cache);
+    if (fs->image_map) {
+        munmap((void *)fs->image_map, fs->image_map_len);
+    }
+    if (fs->image_fd >= 0) {
+        close(fs->image_fd);
     }
+    free(fs);
 }
 
 
@@ -191,115 +989,678 @@ void cleanup_filesystem(void) {
 * Reads an inode into the provided structure.
 * Returns 0 on success, -1 on failure.
 */
-int read_inode(uint32_t inode_num, minix_inode_t *inode_out) {
-    if (inode_num == 0 || inode_num > curr_sb.ninodes) {
+int read_inode(minix_fs_t *fs, uint32_t inode_num, minix_inode_t *inode_out) {
+    if (inode_num == 0 || inode_num > fs->sb.ninodes) {
         return -1;
     }
 
     // Inodes start at block 2 + B_imap + B_zmap
     uint32_t inode_start_block = 2 + \
-    curr_sb.i_blocks + curr_sb.z_blocks;
+    fs->sb.i_blocks + fs->sb.z_blocks;
     
     // Inodes are numbered 1-based, array i is 0-based
     uint32_t i = inode_num - 1;
 
     // Offset calculation: (block * blocksize) + (i * Inode_Size)
-    off_t offset = (off_t)inode_start_block * curr_sb.blocksize;
+    off_t offset = (off_t)inode_start_block * fs->sb.blocksize;
     offset += (off_t)i * INODE_SIZE;
 
-    return read_fs_bytes(offset, inode_out, sizeof(minix_inode_t));
+    return read_fs_bytes(fs, offset, inode_out, sizeof(minix_inode_t));
+}
+
+// Sort key for read_inodes_bulk: inode number plus its caller position
+typedef struct {
+    uint32_t inode_num;
+    uint32_t pos;
+} inode_ref_t;
+
+static int compare_inode_refs(const void *a, const void *b) {
+    const inode_ref_t *x = a;
+    const inode_ref_t *y = b;
+    if (x->inode_num != y->inode_num) {
+        return (x->inode_num < y->inode_num) ? -1 : 1;
+    }
+    return (x->pos < y->pos) ? -1 : (x->pos > y->pos);
 }
 
 /**
-* Converts a logical block number (from the start of the file) to an
-* absolute block number on disk (relative to the FS start).
-* Returns the absolute block number on disk (0 for holes/invalid).
-* NOTE: For MINIX v3, zones are typically 1 block (log_zone_size=0).
+* Reads many inodes at once. The requested numbers are sorted and the
+* inode-table blocks covering them are read in large sequential chunks
+* (runs of up to BULK_INODE_IO bytes, reading through small gaps), then
+* each inode is copied to its original position in inodes_out.
+* ok_out[i] is set to 1 if inode_nums[i] was read, 0 if it was invalid
+* or its block couldn't be read.
+* Returns 0 on success, -1 on allocation failure.
 */
-uint32_t get_file_block(const minix_inode_t *inode, uint32_t logical_block) {
-    uint32_t zone_num = 0;
-    uint32_t blocks_per_zone_val = 1 << curr_sb.log_zone_size;
-    uint32_t ptrs_per_block = curr_sb.blocksize / sizeof(uint32_t);
-    
-    uint32_t logical_zone = logical_block / blocks_per_zone_val;
-    uint32_t block_in_zone = logical_block % blocks_per_zone_val;
+int read_inodes_bulk(minix_fs_t *fs, const uint32_t *inode_nums, \
+    uint32_t count, minix_inode_t *inodes_out, uint8_t *ok_out) {
+    uint32_t inode_start_block = 2 + fs->sb.i_blocks + fs->sb.z_blocks;
+    off_t table_offset = (off_t)inode_start_block * fs->sb.blocksize;
+    uint32_t bs = fs->sb.blocksize;
+    uint32_t i;
+    uint32_t n = 0;
 
-    // Direct Zones (0 to DIRECT_ZONES-1)
-    if (logical_zone < DIRECT_ZONES) { 
-        zone_num = inode->zone[logical_zone];
+    if (count == 0) return 0;
+
+    inode_ref_t *refs = malloc((size_t)count * sizeof(inode_ref_t));
+    uint8_t *run_buf = malloc(BULK_INODE_IO);
+    if (!refs || !run_buf) {
+        free(refs);
+        free(run_buf);
+        return -1;
     }
-    // Single indirect Zone
-    else if (logical_zone < DIRECT_ZONES + ptrs_per_block) {
-        uint32_t indir_zone_i = logical_zone - DIRECT_ZONES;
-        
-        // Check if the indir zone itself exists
-        if (inode->indirect != 0) {
-            uint32_t indir_ptrs[ptrs_per_block];
-            off_t indir_block_offset = (off_t)inode->indirect * zone_size;
-
-            // Read the block containing the list of zone ptrs
-            if (read_fs_bytes(indir_block_offset, \
-                indir_ptrs, curr_sb.blocksize) == 0) {
-                // Get the actual data zone number from the list
-                zone_num = indir_ptrs[indir_zone_i];
-            }
+
+    // Only valid inode numbers take part in the sorted pass
+    for (i = 0; i < count; i++) {
+        ok_out[i] = 0;
+        if (inode_nums[i] != 0 && inode_nums[i] <= fs->sb.ninodes) {
+            refs[n].inode_num = inode_nums[i];
+            refs[n].pos = i;
+            n++;
         }
     }
-    // Double indir Zone
-    else {
-        // Calculate the logical zone i relative to the double indir
-        uint32_t ptrs_in_single = ptrs_per_block;
-        uint32_t double_indir_start = DIRECT_ZONES + ptrs_in_single;
-        uint32_t offset_in_double = logical_zone - double_indir_start;
-        zone_num = 0; // Default to file hole
+    qsort(refs, n, sizeof(inode_ref_t), compare_inode_refs);
 
-        // Check if the double indir block itself exists
-        if (inode->two_indirect != 0) {
-            uint32_t first_level_ptrs[ptrs_in_single];
-            off_t double_indir_offset = \
-                (off_t)inode->two_indirect * zone_size;
-
-            // Read the first level (ptrs to single indir blocks)
-            if (read_fs_bytes(double_indir_offset, \
-                first_level_ptrs, curr_sb.blocksize) == 0) {
-                
-                uint32_t first_level_i = \
-                    offset_in_double / ptrs_in_single;
-                
-                // Check if the i is valid
-                if (first_level_i < ptrs_in_single) {
-                    uint32_t second_level_zone = \
-                        first_level_ptrs[first_level_i];
-
-                    if (second_level_zone != 0) {
-                        uint32_t second_level_ptrs[ptrs_in_single];
-                        off_t second_indir_offset = \
-                            (off_t)second_level_zone * zone_size;
-                        
-                        // Read the second level (ptrs to data zones)
-                        if (read_fs_bytes(second_indir_offset, \
-          second_level_ptrs, curr_sb.blocksize) == 0) {
-
-                            uint32_t second_level_i = \
-                                offset_in_double % ptrs_in_single;
-                            
-                            zone_num = \
-                                second_level_ptrs[second_level_i];
-                        }
-                    }
+    i = 0;
+    while (i < n) {
+        // Start a run at the table block holding this inode and extend it
+        // while the next wanted block is close and the run still fits
+        uint64_t run_first = (uint64_t)(refs[i].inode_num - 1) * \
+            INODE_SIZE / bs;
+        uint64_t run_last = run_first;
+        uint32_t j = i + 1;
+        while (j < n) {
+            uint64_t blk = (uint64_t)(refs[j].inode_num - 1) * INODE_SIZE / bs;
+            if (blk > run_last + BULK_INODE_GAP || \
+                (blk - run_first + 1) * bs > BULK_INODE_IO) {
+                break;
+            }
+            run_last = blk;
+            j++;
+        }
+
+        size_t run_bytes = (size_t)(run_last - run_first + 1) * bs;
+        if (read_fs_bytes(fs, table_offset + (off_t)run_first * bs, \
+            run_buf, run_bytes) == 0) {
+            for (; i < j; i++) {
+                uint64_t at = (uint64_t)(refs[i].inode_num - 1) * INODE_SIZE \
+                    - run_first * bs;
+                memcpy(&inodes_out[refs[i].pos], run_buf + at, \
+                    sizeof(minix_inode_t));
+                ok_out[refs[i].pos] = 1;
+            }
+        } else {
+            // Fall back to single reads so one bad block only loses
+            // the inodes inside it
+            for (; i < j; i++) {
+                if (read_inode(fs, refs[i].inode_num, \
+                    &inodes_out[refs[i].pos]) == 0) {
+                    ok_out[refs[i].pos] = 1;
                 }
             }
         }
     }
-    
-    // Check for file hole (zone 0)
-    if (zone_num == 0) return 0; 
-    
-    // block number = Zone number * blocks_per_zone_val + block_in_zone
-    uint32_t disk_block_num = (zone_num * blocks_per_zone_val) + block_in_zone;
 
-    // This block number is now ready to be multiplied by curr_sb.blocksize
-    return disk_block_num;
+    free(refs);
+    free(run_buf);
+    return 0;
+}
+
+/**
+* Hands every inode allocated in the inode bit map to fn, in inode
+* order, in batches of up to SCAN_INODE_IO / INODE_SIZE. The table is
+* read SCAN_INODE_IO bytes (a whole number of blocks) at a time, asking
+* the kernel for the next piece while the current one is handed out;
+* pieces with no allocated inode aren't read at all.
+* Returns 0 once the whole table is scanned, fn's return value if it
+* was non-zero (the scan stops there), or -1 on failure.
+*/
+int scan_inode_table(minix_fs_t *fs, inode_batch_fn fn, void *arg) {
+    uint64_t ninodes = fs->sb.ninodes;
+    size_t imap_bytes = (size_t)(fs->sb.i_blocks > 0 ? fs->sb.i_blocks : 0) \
+        * fs->sb.blocksize;
+    uint32_t per_read = SCAN_INODE_IO / INODE_SIZE;
+    off_t table_offset = (off_t)(2 + fs->sb.i_blocks + fs->sb.z_blocks) * \
+        fs->sb.blocksize;
+    int status = 0;
+
+    if (ninodes + 1 > (uint64_t)imap_bytes * 8) {
+        fprintf(stderr, "Error: The inode bit map is too small for \
+%llu inodes.\n", (unsigned long long)ninodes);
+        return -1;
+    }
+
+    uint8_t *imap = malloc(imap_bytes);
+    uint8_t *table_buf = malloc(SCAN_INODE_IO);
+    uint32_t *nums = malloc(per_read * sizeof(uint32_t));
+    minix_inode_t *batch = malloc(per_read * sizeof(minix_inode_t));
+    if (!imap || !table_buf || !nums || !batch) {
+        perror("malloc inode scan");
+        status = -1;
+        goto out;
+    }
+    if (read_fs_bytes(fs, 2 * (off_t)fs->sb.blocksize, imap, \
+        imap_bytes) != 0) {
+        fprintf(stderr, "Error: Failed to read the inode bit map.\n");
+        status = -1;
+        goto out;
+    }
+
+    for (uint64_t first = 1; first <= ninodes; first += per_read) {
+        uint32_t count = per_read;
+        if (first + count - 1 > ninodes) {
+            count = (uint32_t)(ninodes - first + 1);
+        }
+        if (count_bits(imap, first, first + count) == 0) continue;
+
+        off_t offset = table_offset + (off_t)(first - 1) * INODE_SIZE;
+        if (first + per_read <= ninodes) {
+            prefetch_fs_bytes(fs, offset + SCAN_INODE_IO, SCAN_INODE_IO);
+        }
+        if (read_fs_bytes(fs, offset, table_buf, \
+            (size_t)count * INODE_SIZE) != 0) {
+            fprintf(stderr, "Error: Failed to read inodes %llu-%llu.\n", \
+                (unsigned long long)first, \
+                (unsigned long long)(first + count - 1));
+            status = -1;
+            break;
+        }
+
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t ino = first + i;
+            if (!((imap[ino / 8] >> (ino % 8)) & 1)) continue;
+            nums[n] = (uint32_t)ino;
+            memcpy(&batch[n], table_buf + (size_t)i * INODE_SIZE, \
+                sizeof(minix_inode_t));
+            n++;
+        }
+
+        status = fn(arg, nums, batch, n);
+        if (status != 0) break;
+    }
+
+out:
+    free(imap);
+    free(table_buf);
+    free(nums);
+    free(batch);
+    return status;
+}
+
+/**
+* Returns the zone pointers cached for the given indirect zone, or NULL
+* on a miss. Caller must hold the shard lock; the pointer is valid
+* until it is released.
+*/
+static const uint32_t *ptr_cache_find_locked(minix_fs_t *fs, \
+    ptr_cache_shard_t *sh, uint32_t zone) {
+    int i;
+
+    STAT_ADD(fs, ptr_lookups, 1);
+    for (i = 0; i < PTR_CACHE_SLOTS; i++) {
+        if (sh->slots[i].zone == zone) {
+            sh->slots[i].last_used = ++sh->clock;
+            return sh->slots[i].ptrs;
+        }
+    }
+    return NULL;
+}
+
+static ptr_cache_shard_t *ptr_cache_shard(minix_fs_t *fs, uint32_t zone) {
+    return &fs->ptr_cache->shards[zone % PTR_CACHE_SHARDS];
+}
+
+/**
+* Reads the first block of the indirect zone into ptrs (blocksize bytes)
+* with no lock held, then caches it in the zone's shard over the least
+* recently used slot, unless another thread cached it meanwhile.
+* Returns 0 on success, -1 on read failure.
+*/
+static int ptr_cache_fill(minix_fs_t *fs, uint32_t zone, uint32_t *ptrs) {
+    ptr_cache_shard_t *sh = ptr_cache_shard(fs, zone);
+    int i;
+
+    STAT_ADD(fs, ptr_block_reads, 1);
+    if (read_fs_bytes(fs, (off_t)zone * fs->zone_size, ptrs, \
+        fs->sb.blocksize) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    ptr_cache_slot_t *victim = &sh->slots[0];
+    for (i = 0; i < PTR_CACHE_SLOTS; i++) {
+        if (sh->slots[i].zone == zone) {
+            victim = NULL;
+            break;
+        }
+        // Evict the least recently used slot (empty slots have age 0)
+        if (sh->slots[i].last_used < victim->last_used) {
+            victim = &sh->slots[i];
+        }
+    }
+    if (victim) {
+        memcpy(victim->ptrs, ptrs, fs->sb.blocksize);
+        victim->zone = zone;
+        victim->last_used = ++sh->clock;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return 0;
+}
+
+/**
+* Reads pointer i of the indirect zone through the cache.
+* Returns 0 on success, -1 on read failure.
+*/
+static int read_zone_ptr(minix_fs_t *fs, uint32_t zone, uint32_t i, \
+    uint32_t *ptr_out) {
+    ptr_cache_shard_t *sh = ptr_cache_shard(fs, zone);
+    pthread_mutex_lock(&sh->lock);
+    const uint32_t *ptrs = ptr_cache_find_locked(fs, sh, zone);
+    if (ptrs) *ptr_out = ptrs[i];
+    pthread_mutex_unlock(&sh->lock);
+    if (ptrs) return 0;
+
+    uint32_t *block = malloc(fs->sb.blocksize);
+    if (!block) return -1;
+    int status = ptr_cache_fill(fs, zone, block);
+    if (status == 0) *ptr_out = block[i];
+    free(block);
+    return status;
+}
+
+/**
+* Copies the whole pointer block of the indirect zone out of the cache
+* into ptrs_out (blocksize bytes).
+* Returns 0 on success, -1 on read failure.
+*/
+static int read_ptr_block(minix_fs_t *fs, uint32_t zone, uint32_t *ptrs_out) {
+    ptr_cache_shard_t *sh = ptr_cache_shard(fs, zone);
+    pthread_mutex_lock(&sh->lock);
+    const uint32_t *ptrs = ptr_cache_find_locked(fs, sh, zone);
+    if (ptrs) memcpy(ptrs_out, ptrs, fs->sb.blocksize);
+    pthread_mutex_unlock(&sh->lock);
+    if (ptrs) return 0;
+
+    return ptr_cache_fill(fs, zone, ptrs_out);
+}
+
+/**
+* Converts a logical block number (from the start of the file) to an
+* absolute block number on disk (relative to the FS start).
+* Returns the absolute block number on disk (0 for holes/invalid).
+* Indirect blocks are served from the indirect block cache.
+* NOTE: For MINIX v3, zones are typically 1 block (log_zone_size=0).
+*/
+uint32_t get_file_block(minix_fs_t *fs, const minix_inode_t *inode, \
+    uint32_t logical_block) {
+    uint32_t zone_num = 0;
+    uint32_t blocks_per_zone_val = 1 << fs->sb.log_zone_size;
+    uint32_t ptrs_per_block = fs->sb.blocksize / sizeof(uint32_t);
+    
+    uint32_t logical_zone = logical_block / blocks_per_zone_val;
+    uint32_t block_in_zone = logical_block % blocks_per_zone_val;
+
+    // Direct Zones (0 to DIRECT_ZONES-1)
+    if (logical_zone < DIRECT_ZONES) { 
+        zone_num = inode->zone[logical_zone];
+    }
+    // Single indirect Zone
+    else if (logical_zone < DIRECT_ZONES + ptrs_per_block) {
+        uint32_t indir_zone_i = logical_zone - DIRECT_ZONES;
+        
+        // Check if the indir zone itself exists, then get the actual
+        // data zone number from its list of zone ptrs
+        if (inode->indirect != 0 && \
+            read_zone_ptr(fs, inode->indirect, indir_zone_i, &zone_num) != 0) {
+            zone_num = 0;
+        }
+    }
+    // Double indir Zone
+    else {
+        // Calculate the logical zone i relative to the double indir
+        uint32_t double_indir_start = DIRECT_ZONES + ptrs_per_block;
+        uint32_t offset_in_double = logical_zone - double_indir_start;
+        uint32_t first_level_i = offset_in_double / ptrs_per_block;
+        uint32_t second_level_i = offset_in_double % ptrs_per_block;
+        zone_num = 0; // Default to file hole
+
+        // First level (ptrs to single indir blocks), if it exists and
+        // the i is valid
+        uint32_t second_level_zone = 0;
+        if (inode->two_indirect != 0 && first_level_i < ptrs_per_block && \
+            read_zone_ptr(fs, inode->two_indirect, first_level_i, \
+            &second_level_zone) == 0 && second_level_zone != 0) {
+
+            // Second level (ptrs to data zones)
+            if (read_zone_ptr(fs, second_level_zone, second_level_i, \
+                &zone_num) != 0) {
+                zone_num = 0;
+            }
+        }
+    }
+    
+    // Check for file hole (zone 0)
+    if (zone_num == 0) return 0; 
+    
+    // block number = Zone number * blocks_per_zone_val + block_in_zone
+    uint32_t disk_block_num = (zone_num * blocks_per_zone_val) + block_in_zone;
+
+    // This block number is now ready to be multiplied by fs->sb.blocksize
+    return disk_block_num;
+}
+
+// Growable list of extents used while building an extent map
+typedef struct {
+    file_extent_t *items;
+    uint32_t count;
+    uint32_t cap;
+} extent_list_t;
+
+/**
+* Appends a run of blocks to the list, merging it into the previous
+* extent when both are holes or the disk blocks are contiguous.
+* Returns 0 on success, -1 on allocation failure.
+*/
+static int add_extent(extent_list_t *list, uint32_t logical, \
+    uint32_t physical, uint32_t length) {
+    uint8_t hole = (physical == 0);
+
+    if (list->count > 0) {
+        file_extent_t *last = &list->items[list->count - 1];
+        if (last->hole == hole && \
+            (hole || last->physical + last->length == physical)) {
+            last->length += length;
+            return 0;
+        }
+    }
+
+    if (list->count == list->cap) {
+        uint32_t new_cap = list->cap ? list->cap * 2 : 16;
+        file_extent_t *grown = \
+            realloc(list->items, new_cap * sizeof(file_extent_t));
+        if (!grown) return -1;
+        list->items = grown;
+        list->cap = new_cap;
+    }
+
+    list->items[list->count].logical = logical;
+    list->items[list->count].physical = physical;
+    list->items[list->count].length = length;
+    list->items[list->count].hole = hole;
+    list->count++;
+    return 0;
+}
+
+/**
+* Adds the blocks of one logical zone (zone_num 0 for a hole), clipped
+* to the number of blocks the file actually covers.
+*/
+static int add_zone_extent(minix_fs_t *fs, extent_list_t *list, \
+    uint32_t logical_zone, uint32_t zone_num, uint32_t file_blocks) {
+    uint32_t logical = logical_zone * fs->blocks_per_zone;
+    uint32_t length = fs->blocks_per_zone;
+
+    if (logical + length > file_blocks) {
+        length = file_blocks - logical;
+    }
+    return add_extent(list, logical, zone_num * fs->blocks_per_zone, length);
+}
+
+/**
+* Adds the zones listed in one pointer block (read into ptrs), or holes
+* for all of them if the pointer block itself is missing (zone 0).
+* Returns 0 on success, -1 on failure.
+*/
+static int add_ptr_block_extents(minix_fs_t *fs, extent_list_t *list, \
+    uint32_t ptr_zone, uint32_t *ptrs, uint32_t *logical_zone, uint32_t n, \
+    uint32_t file_blocks) {
+    uint32_t i;
+
+    if (ptr_zone == 0) {
+        for (i = 0; i < n; i++, (*logical_zone)++) {
+            if (add_zone_extent(fs, list, *logical_zone, 0, file_blocks) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (read_ptr_block(fs, ptr_zone, ptrs) != 0) return -1;
+
+    for (i = 0; i < n; i++, (*logical_zone)++) {
+        if (add_zone_extent(fs, list, *logical_zone, ptrs[i], \
+            file_blocks) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+* Resolves the whole file into a list of extents in one pass over
+* zone[], the indirect block and the double indirect tree, reading each
+* pointer block once. *extents_out is malloc'd; caller must free.
+* Returns 0 on success, -1 on failure.
+*/
+int build_extent_map(minix_fs_t *fs, const minix_inode_t *inode, \
+    file_extent_t **extents_out, uint32_t *count_out) {
+    extent_list_t list = { NULL, 0, 0 };
+    uint32_t ptrs_per_block = fs->sb.blocksize / sizeof(uint32_t);
+    uint32_t file_blocks = (uint32_t)(((uint64_t)inode->size + \
+        fs->sb.blocksize - 1) / fs->sb.blocksize);
+    uint32_t file_zones = \
+        (file_blocks + fs->blocks_per_zone - 1) / fs->blocks_per_zone;
+    uint32_t logical_zone = 0;
+    uint32_t *first_level = NULL;
+
+    // One buffer for the pointer block being expanded, one for the
+    // first level of the double indirect tree
+    uint32_t *ptrs = malloc(fs->sb.blocksize);
+    if (!ptrs) return -1;
+
+    // Direct Zones
+    for (; logical_zone < DIRECT_ZONES && logical_zone < file_zones; \
+        logical_zone++) {
+        if (add_zone_extent(fs, &list, logical_zone, \
+            inode->zone[logical_zone], file_blocks) != 0) goto fail;
+    }
+
+    // Single indirect Zone
+    if (logical_zone < file_zones) {
+        uint32_t n = file_zones - logical_zone;
+        if (n > ptrs_per_block) n = ptrs_per_block;
+        if (add_ptr_block_extents(fs, &list, inode->indirect, ptrs, \
+            &logical_zone, n, file_blocks) != 0) goto fail;
+    }
+
+    // Double indir Zone
+    if (logical_zone < file_zones) {
+        uint32_t first_level_i;
+
+        if (inode->two_indirect != 0) {
+            first_level = malloc(fs->sb.blocksize);
+            if (!first_level || \
+                read_ptr_block(fs, inode->two_indirect, first_level) != 0) {
+                goto fail;
+            }
+        }
+
+        for (first_level_i = 0; first_level_i < ptrs_per_block && \
+            logical_zone < file_zones; first_level_i++) {
+            uint32_t n = file_zones - logical_zone;
+            if (n > ptrs_per_block) n = ptrs_per_block;
+            uint32_t second_level_zone = \
+                first_level ? first_level[first_level_i] : 0;
+            if (add_ptr_block_extents(fs, &list, second_level_zone, ptrs, \
+                &logical_zone, n, file_blocks) != 0) goto fail;
+        }
+    }
+
+    free(ptrs);
+    free(first_level);
+    *extents_out = list.items;
+    *count_out = list.count;
+    return 0;
+
+fail:
+    free(ptrs);
+    free(first_level);
+    free(list.items);
+    return -1;
+}
+
+/**
+* Visits the first n data zones listed in one pointer block, numbering
+* them from *logical_zone, which is advanced past them.
+* Returns 0 on success, -1 if the pointer block can't be read.
+*/
+static int walk_ptr_block(minix_fs_t *fs, uint32_t ptr_zone, uint32_t *ptrs, \
+    uint32_t *logical_zone, uint32_t n, zone_visit_fn visit, void *arg) {
+    if (read_ptr_block(fs, ptr_zone, ptrs) != 0) return -1;
+
+    for (uint32_t i = 0; i < n; i++, (*logical_zone)++) {
+        if (ptrs[i] != 0) visit(arg, ptrs[i], ZONE_DATA, *logical_zone);
+    }
+    return 0;
+}
+
+/**
+* Calls visit for every zone the inode claims: the data zones up to its
+* size, found the way get_file_block finds them, and the indirect and
+* double indirect pointer zones that lead to them. Pointer zones are
+* visited before the zones they list; if visit returns non-zero for one
+* it isn't read (e.g. a zone number out of range). Holes are skipped.
+* Returns 0 on success, -1 if any pointer block couldn't be read (the
+* rest of the tree is still walked).
+*/
+int walk_inode_zones(minix_fs_t *fs, const minix_inode_t *inode, \
+    zone_visit_fn visit, void *arg) {
+    uint32_t ptrs_per_block = fs->sb.blocksize / sizeof(uint32_t);
+    uint32_t file_blocks = (uint32_t)(((uint64_t)inode->size + \
+        fs->sb.blocksize - 1) / fs->sb.blocksize);
+    uint32_t file_zones = \
+        (file_blocks + fs->blocks_per_zone - 1) / fs->blocks_per_zone;
+    uint32_t logical_zone = 0;
+    int status = 0;
+
+    // Direct Zones
+    for (; logical_zone < DIRECT_ZONES && logical_zone < file_zones; \
+        logical_zone++) {
+        if (inode->zone[logical_zone] != 0) {
+            visit(arg, inode->zone[logical_zone], ZONE_DATA, logical_zone);
+        }
+    }
+    if (logical_zone >= file_zones) return 0;
+
+    uint32_t *ptrs = malloc(fs->sb.blocksize);
+    uint32_t *first_level = malloc(fs->sb.blocksize);
+    if (!ptrs || !first_level) {
+        free(ptrs);
+        free(first_level);
+        return -1;
+    }
+
+    // Single indirect Zone
+    uint32_t n = file_zones - logical_zone;
+    if (n > ptrs_per_block) n = ptrs_per_block;
+    if (inode->indirect != 0 && \
+        visit(arg, inode->indirect, ZONE_INDIRECT, logical_zone) == 0) {
+        if (walk_ptr_block(fs, inode->indirect, ptrs, &logical_zone, n, \
+            visit, arg) != 0) status = -1;
+    }
+    logical_zone = DIRECT_ZONES + ptrs_per_block;
+
+    // Double indir Zone
+    if (logical_zone < file_zones && inode->two_indirect != 0 && \
+        visit(arg, inode->two_indirect, ZONE_DOUBLE_INDIRECT, \
+        logical_zone) == 0) {
+        if (read_ptr_block(fs, inode->two_indirect, first_level) != 0) {
+            status = -1;
+        } else {
+            for (uint32_t i = 0; i < ptrs_per_block && \
+                logical_zone < file_zones; i++) {
+                uint32_t start = logical_zone;
+                n = file_zones - logical_zone;
+                if (n > ptrs_per_block) n = ptrs_per_block;
+                if (first_level[i] != 0 && visit(arg, first_level[i], \
+                    ZONE_INDIRECT, logical_zone) == 0 && \
+                    walk_ptr_block(fs, first_level[i], ptrs, &logical_zone, \
+                    n, visit, arg) != 0) {
+                    status = -1;
+                }
+                logical_zone = start + n;
+            }
+        }
+    }
+
+    free(ptrs);
+    free(first_level);
+    return status;
+}
+
+
+/**
+* Reads the live entries (inode != 0) of a directory, in on-disk order.
+* Holes and unreadable blocks are skipped; if bad_blocks_out isn't NULL
+* it is set to the number of blocks that couldn't be read. *entries_out
+* is malloc'd (NULL when there are no entries); caller must free.
+* Returns 0 on success, -1 on allocation failure.
+*/
+int read_directory(minix_fs_t *fs, const minix_inode_t *dir_inode, \
+    minix_dir_entry_t **entries_out, uint32_t *count_out, \
+    uint32_t *bad_blocks_out) {
+    uint32_t entries_per_block = fs->sb.blocksize / DIR_ENTRY_SIZE;
+    uint32_t nblocks = (uint32_t)(((uint64_t)dir_inode->size + \
+        fs->sb.blocksize - 1) / fs->sb.blocksize);
+    minix_dir_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint32_t cap = 0;
+    uint32_t bad_blocks = 0;
+    uint32_t i;
+    uint32_t j;
+
+    uint8_t *dir_block_buf = malloc(fs->sb.blocksize);
+    if (!dir_block_buf) return -1;
+
+    for (i = 0; i < nblocks; i++) {
+        uint32_t disk_block = get_file_block(fs, dir_inode, i);
+        if (disk_block == 0) continue;
+
+        off_t block_offset = (off_t)disk_block * fs->sb.blocksize;
+        STAT_ADD(fs, dir_blocks_read, 1);
+        if (read_fs_bytes(fs, block_offset, \
+            dir_block_buf, fs->sb.blocksize) != 0) {
+            bad_blocks++;
+            continue;
+        }
+
+        for (j = 0; j < entries_per_block; j++) {
+            minix_dir_entry_t *entry = 
+            (minix_dir_entry_t *)(dir_block_buf + j * DIR_ENTRY_SIZE);
+            if (entry->inode == 0) continue;
+
+            if (count == cap) {
+                uint32_t new_cap = cap ? cap * 2 : 64;
+                minix_dir_entry_t *grown = \
+                    realloc(entries, new_cap * sizeof(minix_dir_entry_t));
+                if (!grown) {
+                    free(dir_block_buf);
+                    free(entries);
+                    return -1;
+                }
+                entries = grown;
+                cap = new_cap;
+            }
+            entries[count++] = *entry;
+        }
+    }
+
+    free(dir_block_buf);
+    *entries_out = entries;
+    *count_out = count;
+    if (bad_blocks_out) *bad_blocks_out = bad_blocks;
+    return 0;
 }
 
 
@@ -364,94 +1725,452 @@ char *canonicalize_path(const char *path) {
 }
 
 /**
-* Finds the inode number for a given canonicalized path.
-* Returns inode number on success (1-based), 0 on failure.
+* FNV-1a hash of a directory entry name.
 */
-uint32_t get_inode_by_path(const char *canonical_path) {
-    uint32_t curr_inode_num = 1;
-    
-    // Handle the root path quickly
-    if (strcmp(canonical_path, "/") == 0) {
-        return curr_inode_num;
+static uint32_t hash_name(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
     }
+    return h;
+}
 
-    char path_copy[1024];
-    // Copy the path, skipping the leading '/'
-    strncpy(path_copy, canonical_path + 1, 1023);
-    path_copy[1023] = '\0';
-    
-    char *token;
-    char *saveptr = NULL; // Initialize saveptr
-    
-    // Start tokenizing from the first component
-    token = strtok_r(path_copy, "/", &saveptr);
+/**
+* Returns 1 if a directory entry's name is exactly name (len bytes).
+* Entry names are up to 60 bytes and only NUL-terminated when shorter.
+*/
+static int entry_name_matches(const minix_dir_entry_t *entry, \
+    const char *name, size_t len) {
+    if (len > DIR_NAME_MAX) return 0;
+    if (strncmp(name, (const char *)entry->name, len) != 0) return 0;
+    // Ensure the match is exact (prevent "a" matching "abc")
+    return len == DIR_NAME_MAX || entry->name[len] == '\0';
+}
 
-    // Loop through path components
-    while (token != NULL) {
-        minix_inode_t dir_inode;
-        uint32_t i;
-        uint32_t j;
-        if (read_inode(curr_inode_num, &dir_inode) != 0) return 0;
+/**
+* Finds the slot for name in an index: either the slot holding it or
+* the empty slot where it would go.
+*/
+static uint32_t *dir_index_slot(dir_index_t *idx, const char *name, \
+    size_t len) {
+    uint32_t at = hash_name(name, len) & idx->slot_mask;
+    while (idx->slots[at] != 0 && \
+        !entry_name_matches(&idx->entries[idx->slots[at] - 1], name, len)) {
+        at = (at + 1) & idx->slot_mask;
+    }
+    return &idx->slots[at];
+}
+
+static void free_dir_index(dir_index_t *idx) {
+    if (!idx) return;
+    free(idx->slots);
+    free(idx->entries);
+    free(idx);
+}
+
+/**
+* Reads every block of a directory once and builds its index.
+* Returns the new index, or NULL on allocation failure.
+*/
+static dir_index_t *build_dir_index(minix_fs_t *fs, uint32_t dir_inode_num, \
+    const minix_inode_t *dir_inode) {
+    uint32_t i;
+
+    dir_index_t *idx = calloc(1, sizeof(dir_index_t));
+    if (!idx) return NULL;
+    idx->dir_inode = dir_inode_num;
+    STAT_ADD(fs, dir_index_builds, 1);
+
+    // 1) Collect the live entries of every directory block
+    if (read_directory(fs, dir_inode, &idx->entries, &idx->count, \
+        NULL) != 0) {
+        free_dir_index(idx);
+        return NULL;
+    }
+
+    // 2) Hash them, keeping at most half the slots in use
+    uint32_t nslots = 16;
+    while (nslots < idx->count * 2) nslots <<= 1;
+    idx->slots = calloc(nslots, sizeof(uint32_t));
+    if (!idx->slots) {
+        free_dir_index(idx);
+        return NULL;
+    }
+    idx->slot_mask = nslots - 1;
+
+    for (i = 0; i < idx->count; i++) {
+        const char *name = (const char *)idx->entries[i].name;
+        size_t len = strnlen(name, DIR_NAME_MAX);
+        uint32_t *slot = dir_index_slot(idx, name, len);
+        // A linear scan returns the first match, so keep the first one
+        if (*slot == 0) *slot = i + 1;
+    }
+    return idx;
+}
+
+/**
+* Linear scan of a directory for name, used when no index can be built.
+* Returns the inode number, or 0 if not found.
+*/
+static uint32_t scan_directory(minix_fs_t *fs, const minix_inode_t *dir_inode, \
+    const char *name, size_t len) {
+    uint32_t entries_per_block = fs->sb.blocksize / DIR_ENTRY_SIZE;
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i * fs->sb.blocksize < dir_inode->size; i++) {
+        uint32_t disk_block = get_file_block(fs, dir_inode, i);
+        if (disk_block == 0) continue; 
         
-        // saveptr now points to the character *after* the delimiter,
-        // or to the NULL terminator if this is the last token.
-        char *next_token_start = saveptr;
+        off_t block_offset = (off_t)disk_block * fs->sb.blocksize;
         
-        uint32_t target_inode = 0;
-        size_t token_len = strlen(token);
+        uint8_t dir_block_buf[fs->sb.blocksize];
+        STAT_ADD(fs, dir_blocks_read, 1);
+        if (read_fs_bytes(fs, block_offset, 
+            dir_block_buf, fs->sb.blocksize) != 0) continue;
         
-        // Loop through all blocks of the directory file
-        for (i= 0; i * curr_sb.blocksize < dir_inode.size; i++) {
-            uint32_t disk_block = get_file_block(&dir_inode, i);
-            if (disk_block == 0) continue; 
-            
-            off_t block_offset = (off_t)disk_block * curr_sb.blocksize;
-            
-            uint8_t dir_block_buf[curr_sb.blocksize];
-            if (read_fs_bytes(block_offset, 
-                dir_block_buf, curr_sb.blocksize) != 0) continue;
-            
-            for (j = 0; j*DIR_ENTRY_SIZE < curr_sb.blocksize;j++){
-                minix_dir_entry_t *entry = 
-                (minix_dir_entry_t *)(dir_block_buf + j * DIR_ENTRY_SIZE);
-                
-                if (entry->inode == 0) continue; 
-                
-                // Compare token to entry->name
-                // Assuming minix dir entry name size is 60 or less
-                if (token_len > 60) continue; 
-
-                if (strncmp(token, (char*)entry->name, token_len) != 0) {
-                    continue; 
-                }
-
-            // Ensure the match is exact (prevent "a" matching "abc")
-                if (token_len < 60 && entry->name[token_len] != '\0') {
-                    continue; 
-                }
-                
-                // Match found!
-                target_inode = entry->inode;
-                goto found_component;
+        for (j = 0; j < entries_per_block; j++) {
+            minix_dir_entry_t *entry = 
+            (minix_dir_entry_t *)(dir_block_buf + j * DIR_ENTRY_SIZE);
+            if (entry->inode != 0 && entry_name_matches(entry, name, len)) {
+                return entry->inode;
             }
         }
+    }
+    return 0;
+}
+
+/**
+* Returns the published index of a directory, or NULL if it has none
+* yet. Caller must hold the table lock.
+*/
+static dir_index_t *find_dir_index_locked(minix_fs_t *fs, \
+    uint32_t dir_inode_num) {
+    dir_index_t *idx = fs->dirs->buckets[dir_inode_num % DIR_TABLE_BUCKETS];
+    while (idx && idx->dir_inode != dir_inode_num) {
+        idx = idx->next;
+    }
+    return idx;
+}
+
+/**
+* Looks up one name in a directory through its index, building the
+* index on first use. If two threads build the same index at once, the
+* first one published wins and the other copy is dropped.
+* Returns the entry's inode number, or 0 if there is no such entry.
+*/
+uint32_t lookup_in_directory(minix_fs_t *fs, uint32_t dir_inode_num, \
+    const minix_inode_t *dir_inode, const char *name) {
+    size_t len = strlen(name);
+    dir_index_t *idx;
+
+    if (len > DIR_NAME_MAX) return 0;
+
+    pthread_rwlock_rdlock(&fs->dirs->lock);
+    idx = find_dir_index_locked(fs, dir_inode_num);
+    pthread_rwlock_unlock(&fs->dirs->lock);
+
+    if (!idx) {
+        // Build outside the lock: it reads the whole directory
+        dir_index_t *built = build_dir_index(fs, dir_inode_num, dir_inode);
+        if (!built) return scan_directory(fs, dir_inode, name, len);
+
+        pthread_rwlock_wrlock(&fs->dirs->lock);
+        idx = find_dir_index_locked(fs, dir_inode_num);
+        if (!idx) {
+            dir_index_t **bucket = \
+                &fs->dirs->buckets[dir_inode_num % DIR_TABLE_BUCKETS];
+            built->next = *bucket;
+            *bucket = built;
+            idx = built;
+        }
+        pthread_rwlock_unlock(&fs->dirs->lock);
+        if (idx != built) free_dir_index(built);
+    }
+
+    uint32_t slot = *dir_index_slot(idx, name, len);
+    return slot ? idx->entries[slot - 1].inode : 0;
+}
+
+/**
+* Frees every directory index built so far.
+*/
+static void free_dir_indexes(minix_fs_t *fs) {
+    int b;
+    for (b = 0; b < DIR_TABLE_BUCKETS; b++) {
+        while (fs->dirs->buckets[b]) {
+            dir_index_t *next = fs->dirs->buckets[b]->next;
+            free_dir_index(fs->dirs->buckets[b]);
+            fs->dirs->buckets[b] = next;
+        }
+    }
+}
+
+static uint32_t dentry_hash(uint32_t parent, const char *name, size_t len) {
+    return hash_name(name, len) ^ (parent * 0x9E3779B1u);
+}
+
+/**
+* Finds a cached dentry. Caller must hold the dcache lock.
+* Returns NULL if (parent, name) isn't cached.
+*/
+static dentry_t *dcache_find_locked(minix_fs_t *fs, uint32_t parent, \
+    const char *name, size_t len, uint32_t h) {
+    struct dcache *dc = fs->dcache;
+    if (!dc->buckets) return NULL;
+
+    dentry_t *d;
+    for (d = dc->buckets[h & dc->mask]; d; d = d->next) {
+        if (d->hash == h && d->parent == parent && d->len == len && \
+            memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Looks (parent, name) up in the dentry cache, copying out the cached
+* inode (0 for a cached miss) and mode.
+* Returns 1 if it was cached, 0 if not.
+*/
+static int dcache_lookup(minix_fs_t *fs, uint32_t parent, const char *name, \
+    size_t len, uint32_t *inode_out, uint16_t *mode_out) {
+    uint32_t h = dentry_hash(parent, name, len);
+
+    pthread_rwlock_rdlock(&fs->dcache->lock);
+    dentry_t *d = dcache_find_locked(fs, parent, name, len, h);
+    if (d) {
+        *inode_out = d->inode;
+        *mode_out = d->mode;
+        __atomic_store_n(&d->referenced, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&fs->dcache->lock);
+    if (d) STAT_ADD(fs, dcache_hits, 1);
+    return d != NULL;
+}
+
+/**
+* Frees one dentry chosen by CLOCK: the hand walks the buckets clearing
+* reference bits and takes the first entry that wasn't hit since the
+* hand last passed it. Caller must hold the dcache write lock.
+*/
+static void dcache_evict_locked(struct dcache *dc) {
+    for (;;) {
+        dentry_t **link = &dc->buckets[dc->hand & dc->mask];
+        while (*link) {
+            dentry_t *d = *link;
+            if (!d->referenced) {
+                *link = d->next;
+                free(d);
+                dc->count--;
+                return;
+            }
+            d->referenced = 0;
+            link = &d->next;
+        }
+        dc->hand = (dc->hand + 1) & dc->mask;
+    }
+}
+
+/**
+* Caches (parent, name) -> inode, growing the table to keep chains
+* short, or evicting an entry once it holds DCACHE_MAX_ENTRIES.
+* Failing to allocate just means the entry isn't cached.
+*/
+static void dcache_insert(minix_fs_t *fs, uint32_t parent, const char *name, \
+    size_t len, uint32_t inode, uint16_t mode) {
+    struct dcache *dc = fs->dcache;
+    uint32_t h = dentry_hash(parent, name, len);
+    uint32_t i;
+
+    // Allocate before taking the lock to keep the write side short
+    dentry_t *d = malloc(sizeof(dentry_t) + len);
+    if (!d) return;
+    d->parent = parent;
+    d->inode = inode;
+    d->mode = mode;
+    d->referenced = 0;
+    d->hash = h;
+    d->len = len;
+    memcpy(d->name, name, len);
+
+    pthread_rwlock_wrlock(&dc->lock);
+
+    // Another thread may have resolved the same name meanwhile
+    if (dcache_find_locked(fs, parent, name, len, h)) {
+        pthread_rwlock_unlock(&dc->lock);
+        free(d);
+        return;
+    }
+
+    if (!dc->buckets) {
+        dc->buckets = calloc(DCACHE_INITIAL_BUCKETS, sizeof(dentry_t *));
+        if (!dc->buckets) {
+            pthread_rwlock_unlock(&dc->lock);
+            free(d);
+            return;
+        }
+        dc->mask = DCACHE_INITIAL_BUCKETS - 1;
+    } else if (dc->count >= DCACHE_MAX_ENTRIES) {
+        dcache_evict_locked(dc);
+    } else if (dc->count > dc->mask * 2) {
+        uint32_t new_mask = dc->mask * 2 + 1;
+        dentry_t **grown = calloc((size_t)new_mask + 1, sizeof(dentry_t *));
+        if (grown) {
+            for (i = 0; i <= dc->mask; i++) {
+                while (dc->buckets[i]) {
+                    dentry_t *e = dc->buckets[i];
+                    dc->buckets[i] = e->next;
+                    e->next = grown[e->hash & new_mask];
+                    grown[e->hash & new_mask] = e;
+                }
+            }
+            free(dc->buckets);
+            dc->buckets = grown;
+            dc->mask = new_mask;
+        }
+    }
+
+    d->next = dc->buckets[h & dc->mask];
+    dc->buckets[h & dc->mask] = d;
+    dc->count++;
+    pthread_rwlock_unlock(&dc->lock);
+}
+
+/**
+* Frees the dentry cache.
+*/
+static void free_dcache(minix_fs_t *fs) {
+    struct dcache *dc = fs->dcache;
+    uint32_t i;
+    if (!dc->buckets) return;
+    for (i = 0; i <= dc->mask; i++) {
+        while (dc->buckets[i]) {
+            dentry_t *next = dc->buckets[i]->next;
+            free(dc->buckets[i]);
+            dc->buckets[i] = next;
+        }
+    }
+    free(dc->buckets);
+    dc->buckets = NULL;
+    dc->mask = 0;
+    dc->count = 0;
+    dc->hand = 0;
+}
+
+/**
+* Resolves a canonicalized path for get_inode_by_path.
+* Resolution starts from the longest already-resolved prefix of the
+* path (so a sibling of an earlier path costs one directory lookup), and
+* each component goes through the dentry cache before the directory
+* index. Every resolved prefix is added to the path cache.
+* Returns inode number on success (1-based), 0 on failure.
+*/
+static uint32_t resolve_path(minix_fs_t *fs, const char *canonical_path) {
+    uint32_t curr_inode_num = 1;
+    size_t path_len = strlen(canonical_path);
+    size_t start = 1; // Index of the first component left to resolve
+    
+    // Handle the root path quickly
+    if (strcmp(canonical_path, "/") == 0) {
+        return curr_inode_num;
+    }
+    if (path_len > 1023) {
+        path_len = 1023; // Same limit as the component buffer below
+    }
+
+    // A path index answers in one probe. Paths it doesn't have (bad
+    // paths, or ones it left out) are resolved the long way below, so
+    // errors are reported the same with or without it.
+    const path_index_path_t *indexed = !fs->path_index ? NULL : \
+        path_index_lookup(fs, canonical_path, path_len);
+    if (indexed) {
+        STAT_ADD(fs, path_index_hits, 1);
+        return indexed->inode;
+    }
+
+    // Start from the deepest cached prefix (the whole path included)
+    size_t k;
+    for (k = path_len; k > 1; k--) {
+        if (k != path_len && canonical_path[k] != '/') continue;
+        uint32_t cached_inode;
+        uint16_t cached_mode;
+        if (!dcache_lookup(fs, DCACHE_PATH_PARENT, canonical_path, k, \
+            &cached_inode, &cached_mode)) continue;
+        if (k == path_len) return cached_inode;
+        if ((cached_mode & 0170000) != 0040000) {
+            fprintf(stderr, "Not a directory: trying to traverse file: %s\n", \
+                    canonical_path);
+            return 0;
+        }
+        curr_inode_num = cached_inode;
+        start = k + 1;
+        break;
+    }
+
+    char path_copy[1024];
+    // Copy the unresolved rest of the path
+    memcpy(path_copy, canonical_path + start, path_len - start);
+    path_copy[path_len - start] = '\0';
+    
+    char *token;
+    char *saveptr = NULL; // Initialize saveptr
+
+    // Inode of the current directory, when the previous step read it
+    minix_inode_t dir_inode;
+    int have_dir_inode = 0;
+    
+    // Start tokenizing from the first component
+    token = strtok_r(path_copy, "/", &saveptr);
+
+    // Loop through path components
+    while (token != NULL) {
+        size_t token_len = strlen(token);
+        uint32_t target_inode;
+        uint16_t target_mode;
+        
+        // saveptr now points to the character *after* the delimiter,
+        // or to the NULL terminator if this is the last token.
+        char *next_token_start = saveptr;
+        
+        if (dcache_lookup(fs, curr_inode_num, token, token_len, \
+            &target_inode, &target_mode)) {
+            have_dir_inode = 0;
+        } else {
+            if (!have_dir_inode && \
+                read_inode(fs, curr_inode_num, &dir_inode) != 0) return 0;
+
+            // Find the component through the directory's name index
+            target_inode = \
+                lookup_in_directory(fs, curr_inode_num, &dir_inode, token);
+            target_mode = 0;
+            have_dir_inode = 0;
+
+            // Read the target once: its mode is checked below and, if
+            // it's a directory, it is searched on the next iteration
+            if (target_inode != 0) {
+                if (read_inode(fs, target_inode, &dir_inode) != 0) return 0;
+                target_mode = dir_inode.mode;
+                have_dir_inode = 1;
+            }
+            dcache_insert(fs, curr_inode_num, token, token_len, \
+                target_inode, target_mode);
+        }
+        
+        // CHECK 1: Component not found
+        if (target_inode == 0) {
+             return 0; 
+        }
         
-        found_component:
-        
-        // CHECK 1: Component not found
-        if (target_inode == 0) {
-             return 0; 
-        }
-        
-    // CHECK 2: Traversal Error (Attempting to descend into a non-directory)
-        
-        minix_inode_t target_inode_data;
-        if (read_inode(target_inode, &target_inode_data) != 0) return 0;
+    // CHECK 2: Traversal Error (Attempting to descend into a non-directory)
 
         // If this is NOT the last component (*saveptr != '\0') 
         // AND the target inode is NOT a directory (mode & 0170000) != 0040000
         if (*next_token_start != '\0' && 
-            (target_inode_data.mode & 0170000) != 0040000) {
+            (target_mode & 0170000) != 0040000) {
             // File is not a directory or doesn't exist
             fprintf(stderr, "Not a directory: trying to traverse file: %s\n", \
                     canonical_path);
@@ -460,6 +2179,11 @@ uint32_t get_inode_by_path(const char *canonical_path) {
           
         curr_inode_num = target_inode;
 
+        // Remember the resolved prefix ending with this component
+        size_t prefix_len = (size_t)(token - path_copy) + start + token_len;
+        dcache_insert(fs, DCACHE_PATH_PARENT, canonical_path, prefix_len, \
+            curr_inode_num, target_mode);
+
         // Get the next path component: This is the only call to 
         // strtok_r that advances state.
         token = strtok_r(NULL, "/", &saveptr);
@@ -468,6 +2192,56 @@ uint32_t get_inode_by_path(const char *canonical_path) {
     return curr_inode_num;
 }
 
+/**
+* Finds the inode number for a given canonicalized path, timing the
+* lookup when stats are on.
+* Returns inode number on success (1-based), 0 on failure.
+*/
+uint32_t get_inode_by_path(minix_fs_t *fs, const char *canonical_path) {
+    uint64_t start = stats_clock(fs);
+    uint32_t inode_num = resolve_path(fs, canonical_path);
+
+    STAT_ADD(fs, path_lookups, 1);
+    STAT_ADD(fs, path_lookup_ns, stats_clock(fs) - start);
+    return inode_num;
+}
+
+/**
+* Like get_inode_by_path, but also returns the inode's mode and size.
+* A path index has all three, so an indexed path costs no inode read.
+* Returns the inode number, or 0 if the path can't be found or its inode
+* can't be read.
+*/
+uint32_t stat_path(minix_fs_t *fs, const char *canonical_path, \
+    uint16_t *mode_out, uint32_t *size_out) {
+    size_t len = strlen(canonical_path);
+
+    if (fs->path_index && len <= PATH_INDEX_MAX_PATH) {
+        uint64_t start = stats_clock(fs);
+        const path_index_path_t *p = \
+            path_index_lookup(fs, canonical_path, len);
+        if (p) {
+            STAT_ADD(fs, path_index_hits, 1);
+            STAT_ADD(fs, path_lookups, 1);
+            STAT_ADD(fs, path_lookup_ns, stats_clock(fs) - start);
+            *mode_out = p->mode;
+            *size_out = p->size;
+            return p->inode;
+        }
+    }
+
+    minix_inode_t inode;
+    uint32_t inode_num = get_inode_by_path(fs, canonical_path);
+    if (inode_num == 0) return 0;
+    if (read_inode(fs, inode_num, &inode) != 0) {
+        fprintf(stderr, "Failed to read inode %u.\n", inode_num);
+        return 0;
+    }
+    *mode_out = inode.mode;
+    *size_out = inode.size;
+    return inode_num;
+}
+
 
 // ~~~ 5. Utility/Formatting
 
@@ -502,25 +2276,26 @@ void get_permissions_string(uint16_t mode, char *perm_str) {
 /**
 * Prints Superblock and Partition info to stderr for -v flag.
 */
-void print_verbose_superblock(const char *image_file, int p_num, int s_num) {
+void print_verbose_superblock(minix_fs_t *fs, const char *image_file, \
+    int p_num, int s_num) {
     fprintf(stderr, "\n=== VERBOSE MODE (fs_util.c) ===\n");
     fprintf(stderr, "Image File: %s\n", image_file);
     fprintf(stderr, "Partition: %d, Subpartition: %d\n", p_num, s_num);
     fprintf(stderr, "FS Start (Disk Offset): %ld bytes (Sector: %ld)\n", \
-        fs_offset, fs_offset / SECTOR_SIZE);
+        fs->fs_offset, fs->fs_offset / SECTOR_SIZE);
     
     fprintf(stderr, "\nSuperblock Contents:\n");
-    fprintf(stderr, "  ninodes:    %u\n", curr_sb.ninodes);
-    fprintf(stderr, "  i_blocks:    %d\n", curr_sb.i_blocks);
-    fprintf(stderr, "  z_blocks:    %d\n", curr_sb.z_blocks);
-    fprintf(stderr, "  firstdata:   %u\n", curr_sb.firstdata);
+    fprintf(stderr, "  ninodes:    %u\n", fs->sb.ninodes);
+    fprintf(stderr, "  i_blocks:    %d\n", fs->sb.i_blocks);
+    fprintf(stderr, "  z_blocks:    %d\n", fs->sb.z_blocks);
+    fprintf(stderr, "  firstdata:   %u\n", fs->sb.firstdata);
     fprintf(stderr, "  log_zone_size: %d (zone size: %u)\n", \
-        curr_sb.log_zone_size, zone_size);
-    fprintf(stderr, "  max_file:    %u\n", curr_sb.max_file);
-    fprintf(stderr, "  zones:     %u\n", curr_sb.zones);
-    fprintf(stderr, "  magic:     0x%x\n", curr_sb.magic);
-    fprintf(stderr, "  blocksize:   %u\n", curr_sb.blocksize);
-    fprintf(stderr, "  subversion:   %u\n", curr_sb.subversion);
+        fs->sb.log_zone_size, fs->zone_size);
+    fprintf(stderr, "  max_file:    %u\n", fs->sb.max_file);
+    fprintf(stderr, "  zones:     %u\n", fs->sb.zones);
+    fprintf(stderr, "  magic:     0x%x\n", fs->sb.magic);
+    fprintf(stderr, "  blocksize:   %u\n", fs->sb.blocksize);
+    fprintf(stderr, "  subversion:   %u\n", fs->sb.subversion);
     fprintf(stderr, "==================================\n");
 }
 
@@ -551,4 +2326,1486 @@ void print_verbose_inode(uint32_t inode_num, const minix_inode_t *inode) {
     }
     fprintf(stderr, "  indir:    %u\n", inode->indirect);
     fprintf(stderr, "  two_indir:  %u\n", inode->two_indirect);
-}
\ No newline at end of file
+}
+
+
+/**
+* Prints the handle's counters (see fs_stats_t) in the given format.
+* Does nothing if stats were not requested in init_filesystem.
+*/
+void print_fs_stats(minix_fs_t *fs, FILE *out, fs_stats_format_t format) {
+    const fs_stats_t *st = fs->stats;
+    struct block_cache *bc = fs->block_cache;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    uint32_t s;
+
+    if (!st || format == FS_STATS_OFF) return;
+
+    for (s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+        pthread_mutex_lock(&bc->shards[s].lock);
+        hits += bc->shards[s].hits;
+        misses += bc->shards[s].misses;
+        evictions += bc->shards[s].evictions;
+        pthread_mutex_unlock(&bc->shards[s].lock);
+    }
+
+    if (format == FS_STATS_JSON) {
+        fprintf(out, "{\"read_calls\":%lu,\"read_bytes\":%lu,\
+\"image_reads\":%lu,\"image_bytes\":%lu,\"image_seeks\":%lu,\
+\"image_read_ns\":%lu,\"copy_bytes\":%lu,\"cache_hits\":%lu,\
+\"cache_misses\":%lu,\"cache_evictions\":%lu,\"ptr_lookups\":%lu,\
+\"ptr_block_reads\":%lu,\"path_lookups\":%lu,\"path_lookup_ns\":%lu,\
+\"path_index_hits\":%lu,\"dcache_hits\":%lu,\"dir_index_builds\":%lu,\
+\"dir_blocks_read\":%lu}\n", \
+            (unsigned long)st->read_calls, (unsigned long)st->read_bytes, \
+            (unsigned long)st->image_reads, (unsigned long)st->image_bytes, \
+            (unsigned long)st->image_seeks, \
+            (unsigned long)st->image_read_ns, (unsigned long)st->copy_bytes, \
+            (unsigned long)hits, (unsigned long)misses, \
+            (unsigned long)evictions, (unsigned long)st->ptr_lookups, \
+            (unsigned long)st->ptr_block_reads, \
+            (unsigned long)st->path_lookups, \
+            (unsigned long)st->path_lookup_ns, \
+            (unsigned long)st->path_index_hits, \
+            (unsigned long)st->dcache_hits, \
+            (unsigned long)st->dir_index_builds, \
+            (unsigned long)st->dir_blocks_read);
+        return;
+    }
+
+    fprintf(out, "Stats: read_fs_bytes: %lu calls, %lu bytes\n", \
+        (unsigned long)st->read_calls, (unsigned long)st->read_bytes);
+    fprintf(out, "Stats: image reads: %lu (%lu bytes, %lu seeks, \
+%.3f ms); zero-copy: %lu bytes\n", \
+        (unsigned long)st->image_reads, (unsigned long)st->image_bytes, \
+        (unsigned long)st->image_seeks, st->image_read_ns / 1e6, \
+        (unsigned long)st->copy_bytes);
+    fprintf(out, "Stats: block cache: %lu hits, %lu misses, \
+%lu evictions\n", (unsigned long)hits, (unsigned long)misses, \
+        (unsigned long)evictions);
+    fprintf(out, "Stats: indirect blocks: %lu lookups, %lu reads\n", \
+        (unsigned long)st->ptr_lookups, (unsigned long)st->ptr_block_reads);
+    fprintf(out, "Stats: path lookups: %lu (%.3f ms, %lu from path index, \
+%lu dcache hits)\n", (unsigned long)st->path_lookups, \
+        st->path_lookup_ns / 1e6, (unsigned long)st->path_index_hits, \
+        (unsigned long)st->dcache_hits);
+    fprintf(out, "Stats: directories: %lu indexes built, %lu blocks read \
+(%.2f per path lookup)\n", (unsigned long)st->dir_index_builds, \
+        (unsigned long)st->dir_blocks_read, st->path_lookups ? \
+        (double)st->dir_blocks_read / st->path_lookups : 0.0);
+}
+
+
+// ~~~ 7. File Data Copy
+
+/**
+* Writes the whole buffer to fd, retrying short writes.
+* Returns 0 on success, -1 on failure (errno set).
+*/
+int write_all(int fd, const void *buf, size_t nbytes) {
+    const uint8_t *src = buf;
+    while (nbytes > 0) {
+        ssize_t n = write(fd, src, nbytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        src += n;
+        nbytes -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+* Reads exactly nbytes from fd, retrying short reads.
+* Returns 0 on success, -1 on failure (errno set) or if the descriptor
+* reached end of file first (errno set to 0).
+*/
+int read_all(int fd, void *buf, size_t nbytes) {
+    uint8_t *dst = buf;
+    while (nbytes > 0) {
+        ssize_t n = read(fd, dst, nbytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = 0;
+            return -1;
+        }
+        dst += n;
+        nbytes -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+* Writes nbytes of zeros to the destination, for file holes.
+* Returns 0 on success, -1 on failure.
+*/
+static int write_zeros(uint8_t *buf, size_t buf_size, uint64_t nbytes, \
+    int dest_fd) {
+    memset(buf, 0, buf_size);
+    while (nbytes > 0) {
+        size_t chunk = (nbytes < buf_size) ? (size_t)nbytes : buf_size;
+        if (write_all(dest_fd, buf, chunk) != 0) {
+            perror("Error writing zero data for file hole");
+            return -1;
+        }
+        nbytes -= chunk;
+    }
+    return 0;
+}
+
+/**
+* Leaves a hole of nbytes in a seekable destination instead of writing
+* zeros: seeks past it, punching out any old data the destination
+* already had in that range (e.g. stdout opened without O_TRUNC).
+* Returns 0 on success, -1 if the hole has to be written as zeros.
+*/
+static int skip_hole(int dest_fd, uint64_t nbytes, off_t dest_old_size) {
+    off_t pos = lseek(dest_fd, 0, SEEK_CUR);
+    if (pos < 0) return -1;
+
+    if (pos < dest_old_size) {
+        uint64_t overlap = (uint64_t)(dest_old_size - pos);
+        if (overlap > nbytes) overlap = nbytes;
+        if (fallocate(dest_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, \
+            pos, (off_t)overlap) != 0) {
+            return -1;
+        }
+    }
+
+    return lseek(dest_fd, (off_t)nbytes, SEEK_CUR) < 0 ? -1 : 0;
+}
+
+/**
+* Writes a hole to the destination: as a real hole when it is sparse
+* capable, as zeros otherwise (or if leaving a hole fails).
+* Returns 0 on success, -1 on failure.
+*/
+static int write_hole(uint8_t *buf, size_t buf_size, uint64_t nbytes, \
+    int dest_fd, int dest_sparse, off_t dest_old_size) {
+    if (dest_sparse && skip_hole(dest_fd, nbytes, dest_old_size) == 0) {
+        return 0;
+    }
+    return write_zeros(buf, buf_size, nbytes, dest_fd);
+}
+
+/**
+* Returns 1 if a failed kernel-side copy means "this kind of copy isn't
+* possible here" (so the buffered path should take over) rather than a
+* real I/O error.
+*/
+static int kernel_copy_unsupported(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || \
+        err == EOPNOTSUPP || err == EBADF || err == EPERM;
+}
+
+// One piece of the file for the read-ahead pipeline: a chunk of a data
+// extent, or a whole hole
+typedef struct {
+    off_t image_offset;         // absolute offset in the image
+    uint64_t length;
+    uint8_t hole;
+} pipe_seg_t;
+
+// Segment k lives in slot k % depth of the ring while it is read and
+// written out. A reader may start segment k once segment k - depth has
+// been written (k < next_write + depth), so the slot is always free.
+typedef struct {
+    minix_fs_t *fs;
+    const pipe_seg_t *segs;
+    uint32_t nsegs;
+    uint32_t depth;
+    uint8_t **bufs;             // depth buffers, the largest segment each
+    int *ready;                 // per slot: 1 once its segment is read
+    int *error;                 // per slot: errno of a failed read
+    uint32_t next_read;         // next segment for a reader (threads)
+    uint32_t next_write;        // next segment to write out
+    int stop;                   // the writer gave up
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} pipeline_t;
+
+/**
+* Cuts the extents into pipeline segments, clamped to the file size.
+* Anything past the last extent is a trailing hole.
+* Returns the segment count, or -1 on allocation failure.
+*/
+static int64_t build_pipe_segs(minix_fs_t *fs, const file_extent_t *extents, \
+    uint32_t extent_count, uint64_t size, pipe_seg_t **segs_out) {
+    uint64_t nsegs = 1;
+    uint64_t remaining = size;
+    uint32_t i;
+
+    for (i = 0; i < extent_count; i++) {
+        uint64_t bytes = (uint64_t)extents[i].length * fs->sb.blocksize;
+        nsegs += extents[i].hole ? 1 : bytes / PIPELINE_CHUNK + 1;
+    }
+    pipe_seg_t *segs = malloc(nsegs * sizeof(pipe_seg_t));
+    if (!segs) return -1;
+
+    nsegs = 0;
+    for (i = 0; i < extent_count && remaining > 0; i++) {
+        uint64_t bytes = (uint64_t)extents[i].length * fs->sb.blocksize;
+        off_t at = fs->fs_offset + \
+            (off_t)extents[i].physical * fs->sb.blocksize;
+        if (bytes > remaining) bytes = remaining;
+        remaining -= bytes;
+
+        while (bytes > 0) {
+            uint64_t chunk = bytes;
+            if (!extents[i].hole && chunk > PIPELINE_CHUNK) {
+                chunk = PIPELINE_CHUNK;
+            }
+            segs[nsegs].image_offset = at;
+            segs[nsegs].length = chunk;
+            segs[nsegs].hole = extents[i].hole;
+            nsegs++;
+            at += (off_t)chunk;
+            bytes -= chunk;
+        }
+    }
+    if (remaining > 0) {
+        segs[nsegs].image_offset = 0;
+        segs[nsegs].length = remaining;
+        segs[nsegs].hole = 1;
+        nsegs++;
+    }
+
+    *segs_out = segs;
+    return (int64_t)nsegs;
+}
+
+/**
+* Reads one segment into buf with pread (the threads engine, and short
+* io_uring reads).
+* Returns 0 on success, else an errno value.
+*/
+static int pipe_pread(minix_fs_t *fs, const pipe_seg_t *seg, uint8_t *buf, \
+    uint64_t done) {
+    while (done < seg->length) {
+        ssize_t n = pread(fs->image_fd, buf + done, seg->length - done, \
+            seg->image_offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return n < 0 ? errno : EIO;
+        done += (uint64_t)n;
+    }
+    return 0;
+}
+
+/**
+* Marks a slot read (err 0) or failed, waking the writer.
+*/
+static void pipe_complete(pipeline_t *p, uint32_t slot, int err) {
+    pthread_mutex_lock(&p->lock);
+    p->error[slot] = err;
+    p->ready[slot] = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+* Waits until segment k is read.
+* Returns 0 on success, else the read's errno value.
+*/
+static int pipe_wait(pipeline_t *p, uint32_t k) {
+    uint32_t slot = k % p->depth;
+    pthread_mutex_lock(&p->lock);
+    while (!p->ready[slot]) {
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    int err = p->error[slot];
+    pthread_mutex_unlock(&p->lock);
+    return err;
+}
+
+/**
+* Frees segment k's slot for segment k + depth once it is written.
+*/
+static void pipe_release(pipeline_t *p, uint32_t k) {
+    pthread_mutex_lock(&p->lock);
+    p->ready[k % p->depth] = 0;
+    p->next_write = k + 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+* Threads engine: claims the next segment whose slot is free and reads
+* it, until every segment is claimed or the writer stops.
+*/
+static void *pipe_reader(void *arg) {
+    pipeline_t *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->next_read < p->nsegs && \
+            p->next_read >= p->next_write + p->depth) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (p->stop || p->next_read >= p->nsegs) break;
+        uint32_t k = p->next_read++;
+        pthread_mutex_unlock(&p->lock);
+
+        const pipe_seg_t *seg = &p->segs[k];
+        int err = seg->hole ? 0 : \
+            pipe_pread(p->fs, seg, p->bufs[k % p->depth], 0);
+        if (!seg->hole) {
+            STAT_ADD(p->fs, image_reads, 1);
+            STAT_ADD(p->fs, image_bytes, seg->length);
+        }
+        pipe_complete(p, k % p->depth, err);
+
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// A raw io_uring (no liburing): the mapped submission and completion
+// rings, set up with io_uring_setup and driven with io_uring_enter
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;              // same mapping as sq_ring if single mmap
+    size_t cq_ring_len;
+    size_t sqes_len;
+    unsigned to_submit;         // queued entries not yet submitted
+    unsigned inflight;          // submitted entries not yet reaped
+} uring_t;
+
+static void uring_close(uring_t *u) {
+    if (u->sqes) munmap(u->sqes, u->sqes_len);
+    if (u->cq_ring && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_len);
+    }
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_len);
+    if (u->fd >= 0) close(u->fd);
+}
+
+/**
+* Sets up a ring with room for entries requests.
+* Returns 0 on success, -1 if io_uring is unavailable (not built in,
+* blocked, or out of memory).
+*/
+static int uring_open(uring_t *u, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(u, 0, sizeof(*u));
+    memset(&params, 0, sizeof(params));
+#ifdef __NR_io_uring_setup
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+#else
+    u->fd = -1;
+#endif
+    if (u->fd < 0) return -1;
+
+    u->sq_ring_len = params.sq_off.array + params.sq_entries * \
+        sizeof(unsigned);
+    u->cq_ring_len = params.cq_off.cqes + params.cq_entries * \
+        sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && u->cq_ring_len > u->sq_ring_len) {
+        u->sq_ring_len = u->cq_ring_len;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, \
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        uring_close(u);
+        return -1;
+    }
+    u->cq_ring = single ? u->sq_ring : mmap(NULL, u->cq_ring_len, \
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, \
+        IORING_OFF_CQ_RING);
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, \
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        if (u->cq_ring == MAP_FAILED) u->cq_ring = NULL;
+        if (u->sqes == MAP_FAILED) u->sqes = NULL;
+        uring_close(u);
+        return -1;
+    }
+
+    uint8_t *sq = u->sq_ring;
+    uint8_t *cq = u->cq_ring;
+    u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + params.sq_off.array);
+    u->cq_head = (unsigned *)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+* Queues a read of len bytes at offset into buf, tagged with slot.
+* The caller never has more than the ring's entries outstanding.
+*/
+static void uring_queue_read(uring_t *u, int fd, void *buf, uint32_t len, \
+    off_t offset, uint32_t slot) {
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = slot;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+    u->inflight++;
+}
+
+/**
+* Submits what is queued and, if wait is set, blocks for at least one
+* completion.
+* Returns 0 on success, else an errno value.
+*/
+static int uring_enter(uring_t *u, int wait) {
+    for (;;) {
+        long rc = syscall(__NR_io_uring_enter, u->fd, u->to_submit, \
+            wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0) return errno;
+        u->to_submit -= (unsigned)rc < u->to_submit ? (unsigned)rc : \
+            u->to_submit;
+        return 0;
+    }
+}
+
+/**
+* Reaps every outstanding completion, so no read still targets the
+* pipeline's buffers when they are freed.
+*/
+static void uring_drain(uring_t *u) {
+    while (u->inflight > 0) {
+        unsigned head = *u->cq_head;
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (uring_enter(u, 1) != 0) return;
+            continue;
+        }
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        u->inflight--;
+    }
+}
+
+/**
+* io_uring engine: keeps up to depth segment reads queued ahead of the
+* writer. Called from the writer's thread for each segment k before it
+* waits for it: tops the queue up to k + depth, then reaps completions
+* until segment k is in. Short or failed reads (e.g. a kernel without
+* IORING_OP_READ) are finished with pread.
+* Returns 0 on success, else an errno value.
+*/
+static int uring_advance(pipeline_t *p, uring_t *u, uint32_t k, \
+    uint32_t *next_submit) {
+    while (*next_submit < p->nsegs && *next_submit < k + p->depth) {
+        uint32_t j = (*next_submit)++;
+        const pipe_seg_t *seg = &p->segs[j];
+        if (seg->hole) {
+            p->ready[j % p->depth] = 1;
+            p->error[j % p->depth] = 0;
+            continue;
+        }
+        uring_queue_read(u, p->fs->image_fd, p->bufs[j % p->depth], \
+            (uint32_t)seg->length, seg->image_offset, j);
+        STAT_ADD(p->fs, image_reads, 1);
+        STAT_ADD(p->fs, image_bytes, seg->length);
+    }
+
+    int err = uring_enter(u, 0);
+    while (err == 0 && !p->ready[k % p->depth]) {
+        unsigned head = *u->cq_head;
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+            err = uring_enter(u, 1);
+            continue;
+        }
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        uint32_t j = (uint32_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        u->inflight--;
+
+        const pipe_seg_t *seg = &p->segs[j];
+        int read_err = 0;
+        if (res < 0 || (uint64_t)res < seg->length) {
+            read_err = pipe_pread(p->fs, seg, p->bufs[j % p->depth], \
+                res < 0 ? 0 : (uint64_t)res);
+        }
+        p->ready[j % p->depth] = 1;
+        p->error[j % p->depth] = read_err;
+    }
+    return err;
+}
+
+/**
+* Copies the data and holes of a file to the destination through the
+* read-ahead pipeline: reads for the next read_ahead segments are in
+* flight while the current one is written out, in file order. Holes
+* are handled like in copy_file_data. *ended_in_hole is set if the
+* last segment was a hole. The ring is no deeper than the file has
+* data segments, and its buffers no larger than the largest of them.
+* Returns 0 on success, 1 (nothing copied) if the file has at most one
+* data segment and isn't worth a pipeline, -1 on failure (error
+* printed).
+*/
+static int copy_pipelined(minix_fs_t *fs, const file_extent_t *extents, \
+    uint32_t extent_count, uint64_t size, int dest_fd, int dest_sparse, \
+    off_t dest_old_size, uint8_t *hole_buf, size_t hole_buf_size, \
+    int *ended_in_hole) {
+    pipeline_t p;
+    pipe_seg_t *segs = NULL;
+    pthread_t readers[PIPELINE_THREADS];
+    int nreaders = 0;
+    uring_t u;
+    int use_uring = 0;
+    uint32_t next_submit = 0;
+    int status = -1;
+    uint32_t i;
+
+    int64_t nsegs = build_pipe_segs(fs, extents, extent_count, size, &segs);
+    if (nsegs < 0) {
+        perror("Error allocating read-ahead pipeline");
+        return -1;
+    }
+
+    uint32_t data_segs = 0;
+    uint64_t buf_len = 0;
+    for (i = 0; i < (uint32_t)nsegs; i++) {
+        if (segs[i].hole) continue;
+        data_segs++;
+        if (segs[i].length > buf_len) buf_len = segs[i].length;
+    }
+    if (data_segs <= 1) {
+        free(segs);
+        return 1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.fs = fs;
+    p.segs = segs;
+    p.nsegs = (uint32_t)nsegs;
+    p.depth = fs->read_ahead < data_segs ? fs->read_ahead : data_segs;
+    p.bufs = calloc(p.depth, sizeof(uint8_t *));
+    p.ready = calloc(p.depth, sizeof(int));
+    p.error = calloc(p.depth, sizeof(int));
+    int alloc_ok = p.bufs && p.ready && p.error;
+    for (i = 0; alloc_ok && i < p.depth; i++) {
+        p.bufs[i] = malloc((size_t)buf_len);
+        if (!p.bufs[i]) alloc_ok = 0;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    if (!alloc_ok) {
+        perror("Error allocating read-ahead pipeline");
+        goto done;
+    }
+
+    // Prefer io_uring; fall back to reader threads if it's unavailable
+    if (!fs->read_ahead_threads && uring_open(&u, p.depth) == 0) {
+        use_uring = 1;
+    } else {
+        int want = p.depth < PIPELINE_THREADS ? (int)p.depth : \
+            PIPELINE_THREADS;
+        while (nreaders < want && \
+            pthread_create(&readers[nreaders], NULL, pipe_reader, &p) == 0) {
+            nreaders++;
+        }
+        if (nreaders == 0) {
+            perror("Error starting read-ahead threads");
+            goto done;
+        }
+    }
+    if (fs->verbose) {
+        fprintf(stderr, "  Read-ahead: %u segments, %u in flight (%s).\n", \
+            p.nsegs, p.depth, use_uring ? "io_uring" : "threads");
+    }
+
+    // The writer: segments in file order, each as soon as it is read
+    for (i = 0; i < p.nsegs; i++) {
+        const pipe_seg_t *seg = &segs[i];
+        int err = use_uring ? uring_advance(&p, &u, i, &next_submit) : 0;
+        if (err == 0) err = pipe_wait(&p, i);
+        if (err != 0) {
+            fprintf(stderr, "Error reading file data from image: %s\n", \
+                strerror(err));
+            goto done;
+        }
+
+        if (seg->hole) {
+            if (write_hole(hole_buf, hole_buf_size, seg->length, dest_fd, \
+                dest_sparse, dest_old_size) != 0) goto done;
+        } else if (write_all(dest_fd, p.bufs[i % p.depth], \
+            (size_t)seg->length) != 0) {
+            perror("Error writing file data to destination");
+            goto done;
+        }
+        *ended_in_hole = seg->hole;
+        pipe_release(&p, i);
+    }
+    status = 0;
+
+done:
+    pthread_mutex_lock(&p.lock);
+    p.stop = 1;
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+    while (nreaders > 0) {
+        pthread_join(readers[--nreaders], NULL);
+    }
+    if (use_uring) {
+        // Reads still in flight target our buffers: reap them first
+        uring_drain(&u);
+        uring_close(&u);
+    }
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+    for (i = 0; p.bufs && i < p.depth; i++) {
+        free(p.bufs[i]);
+    }
+    free(p.bufs);
+    free(p.ready);
+    free(p.error);
+    free(segs);
+    return status;
+}
+
+/**
+* Copies the contents of the file described by the inode (number
+* inode_num) to the destination descriptor, driven by the file's extent
+* list (from the path index when it has one). Data
+* extents are copied kernel-to-kernel (copy_file_range into regular
+* files, sendfile into pipes and sockets, write from the mapping with
+* the mmap backend). If the kernel can't do that for this destination,
+* the rest of the file falls back to reading each extent into a buffer
+* in chunks of at most MAX_COPY_IO bytes. Holes (zone 0) stay holes
+* when the destination is a seekable regular file (seeked over, with
+* the file size fixed up at the end); otherwise they are written as
+* zeros. With read-ahead on (fs_options_t.read_ahead), data is instead
+* read through copy_pipelined, several chunks ahead of the writer.
+* Returns 0 on success, -1 on failure.
+*/
+int copy_file_data(minix_fs_t *fs, uint32_t inode_num, \
+    const minix_inode_t *inode, int dest_fd) {
+    // The total file size determines how many bytes we need to copy
+    uint64_t remaining_size = inode->size;
+    file_extent_t *extents = NULL;
+    uint32_t extent_count = 0;
+    uint8_t *block_buf = NULL;
+    int status = -1;
+    uint32_t i;
+
+    if (get_file_extents(fs, inode_num, inode, &extents, \
+        &extent_count) != 0) {
+        fprintf(stderr, "Error resolving file blocks.\n");
+        return -1;
+    }
+
+    // Pick the kernel copy that suits the destination
+    struct stat dest_st;
+    int dest_is_regular = \
+        fstat(dest_fd, &dest_st) == 0 && S_ISREG(dest_st.st_mode);
+    int use_kernel_copy = 1;
+
+    // Holes can be left unwritten in a regular file we write in place
+    // (with O_APPEND every write goes to the end, so seeking is useless)
+    int flags = fcntl(dest_fd, F_GETFL);
+    int dest_sparse = dest_is_regular && flags >= 0 && !(flags & O_APPEND);
+    off_t dest_old_size = dest_is_regular ? dest_st.st_size : 0;
+    int ended_in_hole = 0;
+
+    // One I/O buffer for holes and the fallback path, no larger than
+    // the file needs
+    size_t buf_size = MAX_COPY_IO;
+    if (remaining_size < buf_size) {
+        buf_size = remaining_size > 0 ? (size_t)remaining_size : 1;
+    }
+    block_buf = (uint8_t *)malloc(buf_size);
+    if (!block_buf) {
+        perror("Error allocating buffer");
+        free(extents);
+        return -1;
+    }
+
+    if (fs->verbose) {
+        fprintf(stderr,
+    "Starting copy. File size: %u bytes. Block size: %u. Extents: %u.\n", 
+            inode->size, fs->sb.blocksize, extent_count);
+    }
+    
+    // With read-ahead on, the pipeline does the whole copy (unless the
+    // file is a single read, which gains nothing from it)
+    if (fs->read_ahead > 0) {
+        int piped = copy_pipelined(fs, extents, extent_count, \
+            remaining_size, dest_fd, dest_sparse, dest_old_size, \
+            block_buf, buf_size, &ended_in_hole);
+        if (piped < 0) goto done;
+        if (piped == 0) {
+            remaining_size = 0;
+            extent_count = 0;
+        }
+    }
+
+    // Loop until all bytes are copied, one extent at a time
+    for (i = 0; i < extent_count && remaining_size > 0; i++) {
+        const file_extent_t *ext = &extents[i];
+
+        // Calculate how many bytes this extent covers in the file
+        uint64_t extent_bytes = (uint64_t)ext->length * fs->sb.blocksize;
+        if (extent_bytes > remaining_size) {
+            extent_bytes = remaining_size;
+        }
+
+        if (ext->hole) {
+            // Zone 0 indicates a file hole: skip reading, leave a hole.
+            if (fs->verbose) {
+                fprintf(stderr, 
+                    "  [LBlock %u+%u] Hole found. %s %lu bytes.\n",
+                    ext->logical, ext->length,
+                    dest_sparse ? "Skipping" : "Writing zeros for",
+                    (unsigned long)extent_bytes);
+            }
+            if (write_hole(block_buf, buf_size, extent_bytes, dest_fd, \
+                dest_sparse, dest_old_size) != 0) goto done;
+            remaining_size -= extent_bytes;
+            ended_in_hole = 1;
+            continue;
+        }
+        ended_in_hole = 0;
+
+        // Normal data extent: copy from disk to destination.
+        // Calculate the disk offset (relative to FS start)
+        off_t disk_offset = (off_t)ext->physical * fs->sb.blocksize;
+        
+        if (fs->verbose) {
+            fprintf(stderr, \
+    "  [LBlock %u+%u] Disk Block %u (Offset %ld). Copying %lu bytes.\n",
+                ext->logical, ext->length, ext->physical,
+                fs->fs_offset + disk_offset, (unsigned long)extent_bytes);
+        }
+
+        if (use_kernel_copy) {
+            size_t copied = 0;
+            int rc = copy_fs_bytes_to_fd(fs, disk_offset, \
+                (size_t)extent_bytes, dest_fd, dest_is_regular, &copied);
+            disk_offset += copied;
+            extent_bytes -= copied;
+            remaining_size -= copied;
+            if (rc != 0) {
+                if (!kernel_copy_unsupported(errno)) {
+                    perror("Error writing file data to destination");
+                    goto done;
+                }
+                if (fs->verbose) {
+                    fprintf(stderr, "  Kernel copy unavailable (%s), \
+using buffered copy.\n", strerror(errno));
+                }
+                use_kernel_copy = 0;
+            }
+        }
+
+        while (extent_bytes > 0) {
+            size_t chunk = (extent_bytes < buf_size) ? \
+                (size_t)extent_bytes : buf_size;
+
+            // Read the run of blocks from the disk image
+            if (read_fs_bytes(fs, disk_offset, block_buf, chunk) != 0) {
+                fprintf(stderr, "Error reading data block %u from image.\n", \
+                    ext->physical);
+                goto done;
+            }
+
+            // Write the data to the destination
+            if (write_all(dest_fd, block_buf, chunk) != 0) {
+                perror("Error writing file data to destination");
+                goto done;
+            }
+
+            disk_offset += chunk;
+            extent_bytes -= chunk;
+            remaining_size -= chunk;
+        }
+    }
+
+    // Anything past the last addressable zone reads as a hole
+    if (remaining_size > 0) {
+        if (write_hole(block_buf, buf_size, remaining_size, dest_fd, \
+            dest_sparse, dest_old_size) != 0) goto done;
+        ended_in_hole = 1;
+    }
+
+    // A trailing hole was only seeked over: extend the file to cover it
+    if (dest_sparse && ended_in_hole) {
+        off_t end = lseek(dest_fd, 0, SEEK_CUR);
+        if (end < 0 || (end > dest_old_size && ftruncate(dest_fd, end) != 0)) {
+            perror("Error extending destination over trailing hole");
+            goto done;
+        }
+    }
+    status = 0;
+
+done:
+    free(block_buf);
+    free(extents);
+    return status;
+}
+
+
+// ~~~ 8. Path Index
+
+/**
+* Returns "<image_file>.midx", the default index file name. Caller
+* must free. Returns NULL on allocation failure.
+*/
+static char *default_index_name(const char *image_file) {
+    size_t len = strlen(image_file);
+    char *name = malloc(len + sizeof(PATH_INDEX_SUFFIX));
+    if (!name) return NULL;
+    memcpy(name, image_file, len);
+    memcpy(name + len, PATH_INDEX_SUFFIX, sizeof(PATH_INDEX_SUFFIX));
+    return name;
+}
+
+/**
+* Returns 1 if count items of size bytes starting at off lie inside a
+* file of file_size bytes.
+*/
+static int index_section_fits(uint64_t off, uint64_t count, uint64_t size, \
+    uint64_t file_size) {
+    return off <= file_size && count <= (file_size - off) / size;
+}
+
+/**
+* Checks a mapped index against itself (magic, sizes, section bounds)
+* and against the open image (size, mtime, fs offset, superblock).
+* Returns NULL if it can be used, else the reason it can't.
+*/
+static const char *check_path_index(minix_fs_t *fs, const uint8_t *map, \
+    size_t map_len) {
+    const path_index_header_t *hdr = (const path_index_header_t *)map;
+    struct stat st;
+
+    if (map_len < sizeof(*hdr) || \
+        memcmp(hdr->magic, PATH_INDEX_MAGIC, sizeof(hdr->magic)) != 0) {
+        return "not a path index";
+    }
+    if (hdr->file_size != map_len || hdr->nslots == 0 || \
+        (hdr->nslots & (hdr->nslots - 1)) != 0 || \
+        !index_section_fits(hdr->slots_off, hdr->nslots, \
+            sizeof(uint32_t), map_len) || \
+        !index_section_fits(hdr->paths_off, hdr->npaths, \
+            sizeof(path_index_path_t), map_len) || \
+        !index_section_fits(hdr->inodes_off, hdr->ninodes, \
+            sizeof(path_index_inode_t), map_len) || \
+        !index_section_fits(hdr->extents_off, hdr->nextents, \
+            sizeof(path_index_extent_t), map_len) || \
+        !index_section_fits(hdr->strings_off, hdr->strings_len, 1, map_len)) {
+        return "truncated or corrupt";
+    }
+
+    if (fstat(fs->image_fd, &st) != 0 || \
+        hdr->image_size != (uint64_t)st.st_size || \
+        hdr->image_mtime_sec != (int64_t)st.st_mtim.tv_sec || \
+        hdr->image_mtime_nsec != (int64_t)st.st_mtim.tv_nsec) {
+        return "image changed since it was built";
+    }
+    if (hdr->fs_offset != fs->fs_offset || \
+        memcmp(&hdr->sb, &fs->sb, sizeof(fs->sb)) != 0) {
+        return "built for a different filesystem";
+    }
+    return NULL;
+}
+
+/**
+* Maps the path index (index_file, or the default name when NULL) and
+* uses it if it matches the image. A missing or stale index is not an
+* error: lookups just walk the directories as usual.
+*/
+static void attach_path_index(minix_fs_t *fs, const char *image_file, \
+    const char *index_file) {
+    char *default_name = NULL;
+    struct stat st;
+
+    if (!index_file) {
+        default_name = default_index_name(image_file);
+        if (!default_name) return;
+        index_file = default_name;
+    }
+
+    int fd = open(index_file, O_RDONLY);
+    if (fd < 0) {
+        if (fs->verbose && errno != ENOENT) {
+            fprintf(stderr, "Path index %s: %s\n", index_file, \
+                strerror(errno));
+        }
+        free(default_name);
+        return;
+    }
+
+    const char *problem = NULL;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        problem = "not a regular file";
+    } else {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            problem = strerror(errno);
+        } else {
+            problem = check_path_index(fs, map, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+
+    struct path_index *pi = NULL;
+    if (!problem) {
+        pi = calloc(1, sizeof(struct path_index));
+        if (!pi) problem = "out of memory";
+    }
+    if (problem) {
+        if (fs->verbose) {
+            fprintf(stderr, "Not using path index %s: %s\n", \
+                index_file, problem);
+        }
+        if (map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+        free(default_name);
+        return;
+    }
+
+    pi->map = map;
+    pi->map_len = (size_t)st.st_size;
+    pi->hdr = map;
+    pi->slots = (const uint32_t *)(pi->map + pi->hdr->slots_off);
+    pi->paths = (const path_index_path_t *)(pi->map + pi->hdr->paths_off);
+    pi->inodes = (const path_index_inode_t *)(pi->map + pi->hdr->inodes_off);
+    pi->extents = \
+        (const path_index_extent_t *)(pi->map + pi->hdr->extents_off);
+    pi->strings = (const char *)(pi->map + pi->hdr->strings_off);
+    fs->path_index = pi;
+
+    if (fs->verbose) {
+        fprintf(stderr, "Using path index %s (%u paths, %u files)\n", \
+            index_file, pi->hdr->npaths, pi->hdr->ninodes);
+    }
+    free(default_name);
+}
+
+static void free_path_index(minix_fs_t *fs) {
+    if (!fs->path_index) return;
+    munmap((void *)fs->path_index->map, fs->path_index->map_len);
+    free(fs->path_index);
+    fs->path_index = NULL;
+}
+
+/**
+* Probes the path index for a canonical path (len bytes).
+* Returns the path's record, or NULL if the path is not indexed.
+*/
+static const path_index_path_t *path_index_lookup(minix_fs_t *fs, \
+    const char *path, size_t len) {
+    const struct path_index *pi = fs->path_index;
+    uint32_t mask = pi->hdr->nslots - 1;
+    uint32_t h = hash_name(path, len);
+    uint32_t at = h & mask;
+    uint32_t probes;
+
+    for (probes = 0; probes <= mask; probes++) {
+        uint32_t slot = pi->slots[at];
+        if (slot == 0 || slot > pi->hdr->npaths) return NULL;
+
+        const path_index_path_t *p = &pi->paths[slot - 1];
+        if (p->hash == h && p->path_len == len && \
+            p->path_off <= pi->hdr->strings_len && \
+            len <= pi->hdr->strings_len - p->path_off && \
+            memcmp(pi->strings + p->path_off, path, len) == 0) {
+            return p;
+        }
+        at = (at + 1) & mask;
+    }
+    return NULL;
+}
+
+static int compare_index_inodes(const void *a, const void *b) {
+    uint32_t x = ((const path_index_inode_t *)a)->inode;
+    uint32_t y = ((const path_index_inode_t *)b)->inode;
+    return (x > y) - (x < y);
+}
+
+/**
+* Like build_extent_map, but takes the extents from the path index when
+* it has this inode, so no pointer blocks are read.
+* *extents_out is malloc'd; caller must free.
+* Returns 0 on success, -1 on failure.
+*/
+int get_file_extents(minix_fs_t *fs, uint32_t inode_num, \
+    const minix_inode_t *inode, file_extent_t **extents_out, \
+    uint32_t *count_out) {
+    const struct path_index *pi = fs->path_index;
+    path_index_inode_t key;
+    uint32_t i;
+
+    key.inode = inode_num;
+    const path_index_inode_t *rec = !pi ? NULL : \
+        bsearch(&key, pi->inodes, pi->hdr->ninodes, \
+            sizeof(path_index_inode_t), compare_index_inodes);
+    if (!rec || rec->extent_first > pi->hdr->nextents || \
+        rec->extent_count > pi->hdr->nextents - rec->extent_first) {
+        return build_extent_map(fs, inode, extents_out, count_out);
+    }
+
+    file_extent_t *extents = \
+        malloc((rec->extent_count ? rec->extent_count : 1) * \
+            sizeof(file_extent_t));
+    if (!extents) return -1;
+    for (i = 0; i < rec->extent_count; i++) {
+        const path_index_extent_t *e = &pi->extents[rec->extent_first + i];
+        extents[i].logical = e->logical;
+        extents[i].physical = e->physical;
+        extents[i].length = e->length;
+        extents[i].hole = (uint8_t)e->hole;
+    }
+    *extents_out = extents;
+    *count_out = rec->extent_count;
+    return 0;
+}
+
+// Everything collected while walking the tree for build_path_index
+typedef struct {
+    path_index_path_t *paths;
+    uint32_t npaths;
+    uint32_t paths_cap;
+    path_index_inode_t *inodes;
+    uint32_t ninodes;
+    uint32_t inodes_cap;
+    path_index_extent_t *extents;
+    uint64_t nextents;
+    uint64_t extents_cap;
+    char *strings;
+    uint64_t strings_len;
+    uint64_t strings_cap;
+    uint8_t *visited_dirs;      // bitmap: directories already walked
+    uint8_t *seen_files;        // bitmap: files whose extents are stored
+} index_build_t;
+
+/**
+* Grows an array to hold at least need items. Returns 0 on success,
+* -1 on allocation failure.
+*/
+static int index_reserve(void **items, uint64_t *cap, uint64_t need, \
+    size_t item_size) {
+    if (need <= *cap) return 0;
+    uint64_t new_cap = *cap ? *cap * 2 : 1024;
+    while (new_cap < need) new_cap *= 2;
+    void *grown = realloc(*items, new_cap * item_size);
+    if (!grown) return -1;
+    *items = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+/**
+* Records one path (and, for a regular file seen for the first time,
+* its extent list).
+* Returns 0 on success, -1 on failure.
+*/
+static int index_add_path(minix_fs_t *fs, index_build_t *b, \
+    const char *path, size_t len, uint32_t inode_num, \
+    const minix_inode_t *inode) {
+    uint64_t cap;
+    uint32_t i;
+
+    cap = b->paths_cap;
+    if (index_reserve((void **)&b->paths, &cap, (uint64_t)b->npaths + 1, \
+        sizeof(path_index_path_t)) != 0) return -1;
+    b->paths_cap = (uint32_t)cap;
+    if (index_reserve((void **)&b->strings, &b->strings_cap, \
+        b->strings_len + len, 1) != 0) return -1;
+
+    path_index_path_t *p = &b->paths[b->npaths++];
+    p->hash = hash_name(path, len);
+    p->inode = inode_num;
+    p->path_off = b->strings_len;
+    p->path_len = (uint16_t)len;
+    p->mode = inode->mode;
+    p->size = inode->size;
+    memcpy(b->strings + b->strings_len, path, len);
+    b->strings_len += len;
+
+    if ((inode->mode & 0170000) != 0100000 || \
+        (b->seen_files[inode_num / 8] & (1 << (inode_num % 8)))) {
+        return 0;
+    }
+    b->seen_files[inode_num / 8] |= 1 << (inode_num % 8);
+
+    file_extent_t *extents = NULL;
+    uint32_t count = 0;
+    if (build_extent_map(fs, inode, &extents, &count) != 0) {
+        // Leave the file out; copies will map it themselves
+        return 0;
+    }
+
+    cap = b->inodes_cap;
+    if (index_reserve((void **)&b->inodes, &cap, (uint64_t)b->ninodes + 1, \
+        sizeof(path_index_inode_t)) != 0 || \
+        index_reserve((void **)&b->extents, &b->extents_cap, \
+        b->nextents + count, sizeof(path_index_extent_t)) != 0) {
+        free(extents);
+        return -1;
+    }
+    b->inodes_cap = (uint32_t)cap;
+
+    path_index_inode_t *rec = &b->inodes[b->ninodes++];
+    rec->inode = inode_num;
+    rec->extent_count = count;
+    rec->extent_first = b->nextents;
+    for (i = 0; i < count; i++) {
+        path_index_extent_t *e = &b->extents[b->nextents++];
+        e->logical = extents[i].logical;
+        e->physical = extents[i].physical;
+        e->length = extents[i].length;
+        e->hole = extents[i].hole;
+    }
+    free(extents);
+    return 0;
+}
+
+/**
+* Adds every path below a directory, depth-first. Only entries that
+* get_inode_by_path would resolve to are added (the first of duplicate
+* names, no "." or ".."), and each directory is walked once.
+* Returns 0 on success, -1 on failure.
+*/
+static int index_walk_dir(minix_fs_t *fs, index_build_t *b, \
+    uint32_t dir_inode_num, const minix_inode_t *dir_inode, \
+    const char *dir_path, size_t dir_len) {
+    minix_dir_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint32_t i;
+    int status = 0;
+
+    if (b->visited_dirs[dir_inode_num / 8] & (1 << (dir_inode_num % 8))) {
+        return 0;
+    }
+    b->visited_dirs[dir_inode_num / 8] |= 1 << (dir_inode_num % 8);
+
+    if (read_directory(fs, dir_inode, &entries, &count, NULL) != 0) {
+        return -1;
+    }
+
+    uint32_t *nums = malloc((count ? count : 1) * sizeof(uint32_t));
+    minix_inode_t *inodes = malloc((count ? count : 1) * sizeof(minix_inode_t));
+    uint8_t *ok = malloc(count ? count : 1);
+    char *path = malloc(dir_len + 1 + DIR_NAME_MAX + 1);
+    if (!nums || !inodes || !ok || !path) status = -1;
+
+    for (i = 0; status == 0 && i < count; i++) {
+        nums[i] = entries[i].inode;
+    }
+    if (status == 0 && read_inodes_bulk(fs, nums, count, inodes, ok) != 0) {
+        status = -1;
+    }
+
+    for (i = 0; status == 0 && i < count; i++) {
+        const char *name = (const char *)entries[i].name;
+        size_t name_len = strnlen(name, DIR_NAME_MAX);
+        char name_buf[DIR_NAME_MAX + 1];
+
+        memcpy(name_buf, name, name_len);
+        name_buf[name_len] = '\0';
+        if (!ok[i] || name_len == 0 || memchr(name, '/', name_len) || \
+            strcmp(name_buf, ".") == 0 || strcmp(name_buf, "..") == 0) {
+            continue;
+        }
+        if (lookup_in_directory(fs, dir_inode_num, dir_inode, name_buf) != \
+            entries[i].inode) {
+            continue;
+        }
+
+        // dir_path is "/" for the root and has no trailing slash otherwise
+        size_t len = dir_len;
+        memcpy(path, dir_path, dir_len);
+        if (dir_len > 1) path[len++] = '/';
+        memcpy(path + len, name, name_len);
+        len += name_len;
+        if (len > PATH_INDEX_MAX_PATH) continue;
+
+        if (index_add_path(fs, b, path, len, entries[i].inode, \
+            &inodes[i]) != 0) {
+            status = -1;
+            break;
+        }
+        if ((inodes[i].mode & 0170000) == 0040000 && \
+            index_walk_dir(fs, b, entries[i].inode, &inodes[i], path, \
+                len) != 0) {
+            status = -1;
+        }
+    }
+
+    free(nums);
+    free(inodes);
+    free(ok);
+    free(path);
+    free(entries);
+    return status;
+}
+
+/**
+* Writes len bytes followed by zero padding up to the next multiple of
+* 8. Returns 0 on success, -1 on failure.
+*/
+static int write_index_section(int fd, const void *data, uint64_t len) {
+    static const uint8_t zeros[8];
+    if (len > 0 && write_all(fd, data, (size_t)len) != 0) return -1;
+    return write_all(fd, zeros, (size_t)((8 - len % 8) % 8));
+}
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+/**
+* Walks the whole filesystem and writes a path index for it to
+* index_file (NULL for "<image_file>.midx"), replacing any old one
+* atomically. init_filesystem uses the index from then on, until the
+* image is modified.
+* Returns 0 on success, -1 on failure (errors printed to stderr).
+*/
+int build_path_index(minix_fs_t *fs, const char *image_file, \
+    const char *index_file) {
+    index_build_t b;
+    path_index_header_t hdr;
+    minix_inode_t root;
+    struct stat st;
+    char *default_name = NULL;
+    char *tmp_name = NULL;
+    uint32_t *slots = NULL;
+    int status = -1;
+    int fd;
+    uint32_t i;
+
+    memset(&b, 0, sizeof(b));
+    if (!index_file) {
+        default_name = default_index_name(image_file);
+        index_file = default_name;
+    }
+    b.visited_dirs = calloc((size_t)fs->sb.ninodes / 8 + 1, 1);
+    b.seen_files = calloc((size_t)fs->sb.ninodes / 8 + 1, 1);
+    if (!index_file || !b.visited_dirs || !b.seen_files) {
+        perror("Error allocating path index");
+        goto done;
+    }
+
+    // 1) Collect every path, starting with the root itself
+    if (read_inode(fs, 1, &root) != 0) {
+        fprintf(stderr, "Error reading root inode.\n");
+        goto done;
+    }
+    if (index_add_path(fs, &b, "/", 1, 1, &root) != 0 || \
+        index_walk_dir(fs, &b, 1, &root, "/", 1) != 0) {
+        fprintf(stderr, "Error walking the filesystem.\n");
+        goto done;
+    }
+    qsort(b.inodes, b.ninodes, sizeof(path_index_inode_t), \
+        compare_index_inodes);
+
+    // 2) Hash the paths, keeping at most half the slots in use
+    uint32_t nslots = 16;
+    while (nslots < b.npaths * 2) nslots <<= 1;
+    slots = calloc(nslots, sizeof(uint32_t));
+    if (!slots) {
+        perror("Error allocating path index");
+        goto done;
+    }
+    for (i = 0; i < b.npaths; i++) {
+        uint32_t at = b.paths[i].hash & (nslots - 1);
+        while (slots[at] != 0) at = (at + 1) & (nslots - 1);
+        slots[at] = i + 1;
+    }
+
+    // 3) Lay out the file
+    if (fstat(fs->image_fd, &st) != 0) {
+        perror("Error reading image status");
+        goto done;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PATH_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.image_size = (uint64_t)st.st_size;
+    hdr.image_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    hdr.image_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    hdr.fs_offset = fs->fs_offset;
+    hdr.sb = fs->sb;
+    hdr.nslots = nslots;
+    hdr.npaths = b.npaths;
+    hdr.ninodes = b.ninodes;
+    hdr.nextents = b.nextents;
+    hdr.strings_len = b.strings_len;
+    hdr.slots_off = align8(sizeof(hdr));
+    hdr.paths_off = hdr.slots_off + align8((uint64_t)nslots * 4);
+    hdr.inodes_off = hdr.paths_off + \
+        align8((uint64_t)b.npaths * sizeof(path_index_path_t));
+    hdr.extents_off = hdr.inodes_off + \
+        align8((uint64_t)b.ninodes * sizeof(path_index_inode_t));
+    hdr.strings_off = hdr.extents_off + \
+        align8(b.nextents * sizeof(path_index_extent_t));
+    hdr.file_size = hdr.strings_off + align8(b.strings_len);
+
+    // 4) Write it next to its final name and rename it into place
+    tmp_name = malloc(strlen(index_file) + 5);
+    if (!tmp_name) {
+        perror("Error allocating path index");
+        goto done;
+    }
+    sprintf(tmp_name, "%s.tmp", index_file);
+    fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating %s: %s\n", tmp_name, strerror(errno));
+        goto done;
+    }
+    int write_failed = \
+        write_index_section(fd, &hdr, sizeof(hdr)) != 0 || \
+        write_index_section(fd, slots, (uint64_t)nslots * 4) != 0 || \
+        write_index_section(fd, b.paths, \
+            (uint64_t)b.npaths * sizeof(path_index_path_t)) != 0 || \
+        write_index_section(fd, b.inodes, \
+            (uint64_t)b.ninodes * sizeof(path_index_inode_t)) != 0 || \
+        write_index_section(fd, b.extents, \
+            b.nextents * sizeof(path_index_extent_t)) != 0 || \
+        write_index_section(fd, b.strings, b.strings_len) != 0;
+    if (close(fd) != 0) write_failed = 1;
+    if (write_failed) {
+        fprintf(stderr, "Error writing %s: %s\n", tmp_name, strerror(errno));
+        unlink(tmp_name);
+        goto done;
+    }
+    if (rename(tmp_name, index_file) != 0) {
+        fprintf(stderr, "Error renaming %s to %s: %s\n", tmp_name, \
+            index_file, strerror(errno));
+        unlink(tmp_name);
+        goto done;
+    }
+
+    if (fs->verbose) {
+        fprintf(stderr, "Path index %s: %u paths, %u files, %lu extents, \
+%lu bytes\n", index_file, b.npaths, b.ninodes, (unsigned long)b.nextents, \
+            (unsigned long)hdr.file_size);
+    }
+    status = 0;
+
+done:
+    free(slots);
+    free(tmp_name);
+    free(default_name);
+    free(b.paths);
+    free(b.inodes);
+    free(b.extents);
+    free(b.strings);
+    free(b.visited_dirs);
+    free(b.seen_files);
+    return status;
+}
+
+
+// ~~~ 9. Allocation Bitmaps
+
+// On x86-64 count_bits is built twice, with and without the popcnt
+// instruction, and the loader picks the one the CPU supports: the
+// baseline ISA has no popcnt and __builtin_popcountll falls back to a
+// table walk several times slower. ThreadSanitizer can't run ifunc
+// resolvers that early, so its builds keep the baseline version.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__SANITIZE_THREAD__)
+#define POPCNT_CLONES __attribute__((target_clones("popcnt", "default")))
+#else
+#define POPCNT_CLONES
+#endif
+
+/**
+* Reads the inode bit map and the zone bit map, which sit back to back
+* from block 2, with one read straight from the image (they are read
+* once, so they would only crowd the block cache). The zone map starts
+* sb.i_blocks * sb.blocksize bytes into the returned buffer. Bit n of a
+* map is bit n % 8 of byte n / 8; bit 0 of both is reserved, bit i of
+* the inode map is inode i and bit i of the zone map is zone
+* firstdata + i - 1. Caller must free. Returns NULL on failure.
+*/
+uint8_t *read_bitmaps(minix_fs_t *fs) {
+    if (fs->sb.i_blocks <= 0 || fs->sb.z_blocks <= 0) {
+        fprintf(stderr, "Error: Bad bitmap sizes in superblock \
+(%d inode, %d zone blocks).\n", fs->sb.i_blocks, fs->sb.z_blocks);
+        return NULL;
+    }
+
+    size_t nbytes = ((size_t)fs->sb.i_blocks + (size_t)fs->sb.z_blocks) * \
+        fs->sb.blocksize;
+    uint8_t *maps = malloc(nbytes);
+    if (!maps) {
+        perror("malloc bitmaps");
+        return NULL;
+    }
+
+    STAT_ADD(fs, read_calls, 1);
+    STAT_ADD(fs, read_bytes, nbytes);
+    if (read_image_bytes(fs, fs->fs_offset + 2 * (off_t)fs->sb.blocksize, \
+        maps, nbytes) != 0) {
+        fprintf(stderr, "Error: Failed to read the allocation bitmaps.\n");
+        free(maps);
+        return NULL;
+    }
+    return maps;
+}
+
+/**
+* Returns the number of set bits in [first_bit, end_bit) of a bit map
+* laid out as read_bitmaps describes. The whole 64-bit words in between
+* are counted four at a time into separate sums, so the popcounts don't
+* wait on each other.
+*/
+POPCNT_CLONES
+uint64_t count_bits(const uint8_t *map, uint64_t first_bit, \
+    uint64_t end_bit) {
+    uint64_t count = 0;
+    uint64_t bit = first_bit;
+
+    // Odd bits up to a word boundary
+    while (bit < end_bit && (bit & 63) != 0) {
+        count += (map[bit / 8] >> (bit % 8)) & 1;
+        bit++;
+    }
+
+    uint64_t nwords = (end_bit - bit) / 64;
+    const uint8_t *p = map + bit / 8;
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    uint64_t w[4];
+    uint64_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+        memcpy(w, p + i * 8, sizeof(w));
+        c0 += (uint64_t)__builtin_popcountll(w[0]);
+        c1 += (uint64_t)__builtin_popcountll(w[1]);
+        c2 += (uint64_t)__builtin_popcountll(w[2]);
+        c3 += (uint64_t)__builtin_popcountll(w[3]);
+    }
+    for (; i < nwords; i++) {
+        memcpy(w, p + i * 8, sizeof(w[0]));
+        c0 += (uint64_t)__builtin_popcountll(w[0]);
+    }
+    count += c0 + c1 + c2 + c3;
+    bit += nwords * 64;
+
+    // Bits left over after the last whole word
+    for (; bit < end_bit; bit++) {
+        count += (map[bit / 8] >> (bit % 8)) & 1;
+    }
+    return count;
+}
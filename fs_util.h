@@ -10,6 +10,10 @@
 #include <errno.h>
 #include <time.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 // ~~~ Constants
 #define DIRECT_ZONES 7
@@ -76,38 +80,273 @@ typedef struct PACKED {
     unsigned char name[60];     // filename string
 } minix_dir_entry_t;
 
-// ~~~ Global State Declarations
+// A run of logical file blocks that map to consecutive disk blocks
+// (or that are all holes)
+typedef struct {
+    uint32_t logical;           // first logical block of the run
+    uint32_t physical;          // first disk block (0 for holes)
+    uint32_t length;            // number of blocks in the run
+    uint8_t hole;               // 1 if the run is a file hole
+} file_extent_t;
 
-extern FILE *image_fp;
-extern long fs_offset;
-extern minix_superblock_t curr_sb;
-extern uint32_t zone_size;
-extern int verbose;
+// What a zone claimed by an inode holds (see walk_inode_zones)
+typedef enum {
+    ZONE_DATA = 0,              // file data
+    ZONE_INDIRECT,              // pointers to data zones
+    ZONE_DOUBLE_INDIRECT        // pointers to ZONE_INDIRECT zones
+} zone_kind_t;
+
+// Called by walk_inode_zones for each zone; logical_zone is the first
+// logical zone of the file the zone holds or leads to. For pointer
+// zones a non-zero return skips the zones they list.
+typedef int (*zone_visit_fn)(void *arg, uint32_t zone, zone_kind_t kind,
+    uint32_t logical_zone);
+
+// Called by scan_inode_table with the next count allocated inodes and
+// their numbers, in inode order. A non-zero return stops the scan.
+typedef int (*inode_batch_fn)(void *arg, const uint32_t *inode_nums,
+    const minix_inode_t *inodes, uint32_t count);
+
+// I/O backends for read_fs_bytes
+typedef enum {
+    IO_BACKEND_PREAD = 0,       // pread(2) on the image descriptor
+    IO_BACKEND_MMAP             // read-only mapping of the whole image
+} io_backend_t;
+
+// Formats for the --stats summary printed by cleanup_filesystem
+typedef enum {
+    FS_STATS_OFF = 0,
+    FS_STATS_TEXT,              // a few "Stats:" lines on stderr
+    FS_STATS_JSON               // one JSON object on stderr
+} fs_stats_format_t;
+
+// getopt_long value the tools use for --stats[=text|json]
+#define FS_OPT_STATS 256
+
+// Options for init_filesystem (fs_default_options fills in defaults)
+typedef struct {
+    io_backend_t io_backend;
+    size_t block_cache_budget;  // bytes, 0 disables the block cache
+    int verbose;
+    const char *path_index;     // NULL: "<image>.midx" if valid, "": none
+    fs_stats_format_t stats;    // counters are only kept if not OFF
+    uint32_t read_ahead;        // copy_file_data reads in flight, 0: off
+    int read_ahead_threads;     // read ahead with threads, not io_uring
+} fs_options_t;
+
+// I/O and lookup counters of one handle. Any thread may bump them (with
+// relaxed atomic adds); they are read when the handle is cleaned up.
+// Block cache hits/misses are kept by the cache itself.
+typedef struct {
+    uint64_t read_calls;        // read_fs_bytes calls
+    uint64_t read_bytes;        // bytes asked of read_fs_bytes
+    uint64_t image_reads;       // reads that reached the backend
+    uint64_t image_bytes;
+    uint64_t image_seeks;       // ...not starting where the last one ended
+    uint64_t image_read_ns;     // time spent in backend reads
+    uint64_t image_last_end;    // image offset the last backend read ended
+    uint64_t copy_bytes;        // bytes moved by copy_fs_bytes_to_fd
+    uint64_t ptr_lookups;       // indirect pointer block lookups
+    uint64_t ptr_block_reads;   // ...that had to read the block
+    uint64_t path_lookups;      // get_inode_by_path calls
+    uint64_t path_lookup_ns;
+    uint64_t path_index_hits;
+    uint64_t dcache_hits;
+    uint64_t dir_index_builds;
+    uint64_t dir_blocks_read;   // directory blocks read to find names
+} fs_stats_t;
+
+// ~~~ Query Server Protocol (minsrv <-> mincli)
+//
+// The client sends a request header followed by path_len bytes of path
+// (no terminator). The server answers each request with a reply header
+// followed by length bytes of payload:
+//   MINSRV_OP_LS    one minsrv_dirent_t + name per listed entry; with
+//                   MINSRV_REPLY_DIR set the path was a directory. An
+//                   entry whose inode can't be read is still sent, with
+//                   MINSRV_DIRENT_UNREADABLE set and mode and size 0
+//   MINSRV_OP_GET   the file contents (holes as zeros)
+//   MINSRV_OP_STAT  one minsrv_stat_t
+// A non-zero status is an errno value and carries no payload. Fields are
+// in host byte order: the socket is local. A connection may carry any
+// number of requests.
+#define MINSRV_MAGIC 0x4D53     // "MS"
+#define MINSRV_PATH_MAX 4096
+#define MINSRV_REPLY_DIR 0x1
+#define MINSRV_DIRENT_UNREADABLE 0x1
+
+typedef enum {
+    MINSRV_OP_LS = 1,
+    MINSRV_OP_GET = 2,
+    MINSRV_OP_STAT = 3
+} minsrv_op_t;
+
+typedef struct PACKED {
+    uint16_t magic;             // MINSRV_MAGIC
+    uint8_t op;                 // minsrv_op_t
+    uint8_t pad;
+    uint32_t path_len;          // bytes of path that follow
+} minsrv_request_t;
+
+typedef struct PACKED {
+    int32_t status;             // 0 or an errno value
+    uint32_t flags;             // MINSRV_REPLY_*
+    uint64_t length;            // bytes of payload that follow
+} minsrv_reply_t;
+
+typedef struct PACKED {
+    uint32_t inode;
+    uint16_t mode;
+    uint16_t name_len;          // bytes of name that follow
+    uint32_t size;
+    uint32_t flags;             // MINSRV_DIRENT_*
+} minsrv_dirent_t;
+
+typedef struct PACKED {
+    uint32_t inode_num;
+    minix_inode_t inode;
+} minsrv_stat_t;
+
+// ~~~ Binary Listing Format (minls -f bin)
+//
+// The stream starts with the 8 bytes of MINLS_BIN_MAGIC, then one
+// minls_record_t + name per record. A MINLS_REC_DIR record (name is the
+// directory's path) comes before the entries listed from it; a lone
+// non-directory is one MINLS_REC_ENTRY whose name is its path. Fields
+// are in host byte order.
+#define MINLS_BIN_MAGIC "MINLSBIN"
+#define MINLS_REC_DIR 1
+#define MINLS_REC_ENTRY 2
+
+typedef struct PACKED {
+    uint16_t type;              // MINLS_REC_*
+    uint16_t pad;
+    uint32_t name_len;          // bytes of name that follow
+    uint32_t inode;
+    uint16_t mode;
+    uint16_t links;
+    uint16_t uid;
+    uint16_t gid;
+    uint32_t size;
+    int32_t atime;
+    int32_t mtime;
+    int32_t ctime;
+} minls_record_t;
+
+// ~~~ Inode Dump Format (minidump -f bin)
+//
+// The stream starts with the 8 bytes of MINIDUMP_MAGIC, then one
+// minidump_record_t per allocated inode, in inode order: the inode
+// number followed by the inode exactly as it is on disk (host byte
+// order, like the image).
+#define MINIDUMP_MAGIC "MINIDUMP"
+
+typedef struct PACKED {
+    uint32_t inode_num;
+    minix_inode_t inode;
+} minidump_record_t;
+
+// ~~~ Filesystem Handle
+
+// One open filesystem, created by init_filesystem. A process can have
+// any number of these open at once, and any number of threads can read
+// through one handle at once (reads are positional, caches are locked).
+// The geometry fields are filled in by init_filesystem and read-only
+// afterwards; the I/O state and caches belong to fs_util.c.
+typedef struct minix_fs {
+    minix_superblock_t sb;
+    long fs_offset;             // byte offset of the FS within the image
+    uint32_t zone_size;         // bytes per zone
+    uint32_t blocks_per_zone;   // calculated from log_zone_size
+    int verbose;
+    uint32_t read_ahead;        // see fs_options_t
+    int read_ahead_threads;
+
+    int image_fd;
+    io_backend_t io_backend;
+    const uint8_t *image_map;   // whole-image mapping (mmap only)
+    size_t image_map_len;
+
+    struct ptr_cache *ptr_cache;
+    struct block_cache *block_cache;
+    struct dir_table *dirs;
+    struct dcache *dcache;
+    struct path_index *path_index; // NULL if not using one
+
+    fs_stats_format_t stats_format;
+    fs_stats_t *stats;          // NULL unless stats were requested
+} minix_fs_t;
 
 // ~~~ Function Prototypes---
 
 // Low-Level I/O
-int read_fs_bytes(off_t offset_from_fs_start, void *buffer, size_t nbytes);
+void fs_default_options(fs_options_t *opts);
+int parse_io_backend(const char *name, io_backend_t *backend_out);
+int parse_stats_format(const char *name, fs_stats_format_t *format_out);
+int parse_cache_size(const char *kib, size_t *budget_out);
+int read_image_bytes(minix_fs_t *fs, off_t abs_offset, void *buffer,
+    size_t nbytes);
+int read_fs_bytes(minix_fs_t *fs, off_t offset_from_fs_start, void *buffer,
+    size_t nbytes);
+void prefetch_fs_bytes(minix_fs_t *fs, off_t offset_from_fs_start,
+    size_t nbytes);
+int copy_fs_bytes_to_fd(minix_fs_t *fs, off_t offset_from_fs_start,
+    size_t nbytes, int out_fd, int out_is_regular, size_t *copied_out);
 
 // File System Initialization
-int init_filesystem(const char *image_file, int p_num, int s_num,\
-     int verbose_flag);
-void cleanup_filesystem(void);
+minix_fs_t *init_filesystem(const char *image_file, int p_num, int s_num,
+    const fs_options_t *opts);
+void cleanup_filesystem(minix_fs_t *fs);
 
 // Inode and Block Access
-int read_inode(uint32_t inode_num, minix_inode_t *inode_out);
-uint32_t get_file_block(const minix_inode_t *inode, uint32_t logical_block);
+int read_inode(minix_fs_t *fs, uint32_t inode_num, minix_inode_t *inode_out);
+int read_inodes_bulk(minix_fs_t *fs, const uint32_t *inode_nums,
+    uint32_t count, minix_inode_t *inodes_out, uint8_t *ok_out);
+int scan_inode_table(minix_fs_t *fs, inode_batch_fn fn, void *arg);
+uint32_t get_file_block(minix_fs_t *fs, const minix_inode_t *inode,
+    uint32_t logical_block);
+int build_extent_map(minix_fs_t *fs, const minix_inode_t *inode,
+    file_extent_t **extents_out, uint32_t *count_out);
+int get_file_extents(minix_fs_t *fs, uint32_t inode_num,
+    const minix_inode_t *inode, file_extent_t **extents_out,
+    uint32_t *count_out);
+int walk_inode_zones(minix_fs_t *fs, const minix_inode_t *inode,
+    zone_visit_fn visit, void *arg);
+int read_directory(minix_fs_t *fs, const minix_inode_t *dir_inode,
+    minix_dir_entry_t **entries_out, uint32_t *count_out,
+    uint32_t *bad_blocks_out);
 
 // Path Traversal
 char *canonicalize_path(const char *path);
-uint32_t get_inode_by_path(const char *canonical_path);
+uint32_t lookup_in_directory(minix_fs_t *fs, uint32_t dir_inode_num,
+    const minix_inode_t *dir_inode, const char *name);
+uint32_t get_inode_by_path(minix_fs_t *fs, const char *canonical_path);
+uint32_t stat_path(minix_fs_t *fs, const char *canonical_path,
+    uint16_t *mode_out, uint32_t *size_out);
 
 // Utility/Formatting
 void get_permissions_string(uint16_t mode, char *perm_str);
 
 // Verbose Output (minls -v)
-void print_verbose_superblock(const char *image_file, int p_num, int s_num);
+void print_verbose_superblock(minix_fs_t *fs, const char *image_file,
+    int p_num, int s_num);
 void print_verbose_inode(uint32_t inode_num, const minix_inode_t *inode);
+void print_fs_stats(minix_fs_t *fs, FILE *out, fs_stats_format_t format);
+
+// File Data Copy
+int write_all(int fd, const void *buf, size_t nbytes);
+int read_all(int fd, void *buf, size_t nbytes);
+int copy_file_data(minix_fs_t *fs, uint32_t inode_num,
+    const minix_inode_t *inode, int dest_fd);
+
+// Path Index (minidx)
+int build_path_index(minix_fs_t *fs, const char *image_file,
+    const char *index_file);
+
+// Allocation Bitmaps (minstat)
+uint8_t *read_bitmaps(minix_fs_t *fs);
+uint64_t count_bits(const uint8_t *map, uint64_t first_bit,
+    uint64_t end_bit);
 
 
 #endif // FS_UTIL_H
\ No newline at end of file
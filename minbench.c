@@ -0,0 +1,589 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+// Operations per benchmark, and how many are timed together as one
+// latency sample (single block lookups are too fast to time one by one)
+#define DEFAULT_OPS 20000
+#define BLOCK_BATCH 16
+#define COPY_REPS 5
+
+// Lookups on fresh handles per run; each one opens the image (and in a
+// wide directory, indexes it), so -n is capped here
+#define FRESH_LOOKUPS 1000
+
+// Depths reported separately by the lookup benchmark, and widths
+// (entries in the path's directory) in powers of ten: <10 ... >=100000
+#define MAX_DEPTH 16
+#define WIDTH_BUCKETS 6
+
+// One file or directory found while walking the image
+typedef struct {
+    char *path;
+    uint32_t inode_num;
+    uint32_t depth;
+    uint32_t width;             // entries in the directory holding it
+} bench_path_t;
+
+// What the walk found: every path, plus the files and directory the
+// other benchmarks use
+typedef struct {
+    bench_path_t *paths;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t biggest_dir;       // inode with the most entries
+    uint32_t biggest_dir_entries;
+    uint32_t biggest_file;      // largest regular file
+    uint32_t biggest_file_size;
+    uint32_t sparsest_file;     // regular file with the most hole blocks
+    uint64_t sparsest_holes;
+} bench_tree_t;
+
+// Latency samples of one benchmark run
+typedef struct {
+    uint64_t *ns;               // per-op latency of each sample
+    uint32_t count;
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t total_ns;
+} bench_samples_t;
+
+// Function prototypes
+void print_usage(const char *progname);
+int walk_image(minix_fs_t *fs, bench_tree_t *tree);
+int bench_image(const char *image_file, uint32_t nops, FILE *out);
+
+
+/**
+ * Prints the usage message for minbench.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-n ops] [-o outfile] [-i io] \
+imagefile...\n", progname);
+    fprintf(stderr, "Benchmarks block mapping, path lookup, directory \
+listing and file copy\non each image, with a cold and a warm page \
+cache.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -n <num>   operations per benchmark \
+(default: %d)\n", DEFAULT_OPS);
+    fprintf(stderr, "  -o <file>  write the results here \
+(default: stdout)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Deterministic xorshift64, so every run picks the same operations
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static fs_options_t bench_options;
+
+/**
+ * Opens a fresh handle on the image. For a cold run the image's pages
+ * are dropped from the page cache first, so every read goes to disk.
+ */
+static minix_fs_t *open_image_handle(const char *image_file, int cold) {
+    if (cold) {
+        int fd = open(image_file, O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+    return init_filesystem(image_file, -1, -1, &bench_options);
+}
+
+/**
+ * Adds a path to the tree.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int add_path(bench_tree_t *tree, const char *path, \
+    uint32_t inode_num, uint32_t depth, uint32_t width) {
+    if (tree->count == tree->cap) {
+        uint32_t new_cap = tree->cap ? tree->cap * 2 : 1024;
+        bench_path_t *grown = realloc(tree->paths, \
+            new_cap * sizeof(bench_path_t));
+        if (!grown) return -1;
+        tree->paths = grown;
+        tree->cap = new_cap;
+    }
+    tree->paths[tree->count].path = strdup(path);
+    if (!tree->paths[tree->count].path) return -1;
+    tree->paths[tree->count].inode_num = inode_num;
+    tree->paths[tree->count].depth = depth;
+    tree->paths[tree->count].width = width;
+    tree->count++;
+    return 0;
+}
+
+/**
+ * Walks the whole image breadth first, recording every path and the
+ * biggest directory, biggest file and sparsest file.
+ * Returns 0 on success, -1 on failure (error printed).
+ */
+int walk_image(minix_fs_t *fs, bench_tree_t *tree) {
+    uint8_t *visited = calloc((size_t)fs->sb.ninodes / 8 + 1, 1);
+    uint32_t next = 0;
+
+    memset(tree, 0, sizeof(*tree));
+    if (!visited || add_path(tree, "/", 1, 0, 1) != 0) {
+        perror("minbench: Error allocating tree");
+        free(visited);
+        return -1;
+    }
+    visited[0] |= 1 << 1;
+
+    // Directories are appended as they are found, so this visits them
+    // level by level
+    while (next < tree->count) {
+        bench_path_t dir = tree->paths[next++];
+        minix_inode_t dir_inode;
+        minix_dir_entry_t *entries = NULL;
+        uint32_t count = 0;
+
+        if (read_inode(fs, dir.inode_num, &dir_inode) != 0 || \
+            (dir_inode.mode & 0170000) != 0040000 || \
+            read_directory(fs, &dir_inode, &entries, &count, NULL) != 0) {
+            continue;
+        }
+        if (count > tree->biggest_dir_entries) {
+            tree->biggest_dir = dir.inode_num;
+            tree->biggest_dir_entries = count;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            char name[61];
+            char path[1024];
+            minix_inode_t inode;
+            uint32_t ino = entries[i].inode;
+
+            memcpy(name, entries[i].name, 60);
+            name[60] = '\0';
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || \
+                ino == 0 || ino > fs->sb.ninodes || \
+                read_inode(fs, ino, &inode) != 0) {
+                continue;
+            }
+            if ((inode.mode & 0170000) == 0040000) {
+                if (visited[ino / 8] & (1 << (ino % 8))) continue;
+                visited[ino / 8] |= 1 << (ino % 8);
+            }
+            snprintf(path, sizeof(path), "%s%s%s", dir.path, \
+                dir.depth ? "/" : "", name);
+            if (add_path(tree, path, ino, dir.depth + 1, count) != 0) {
+                perror("minbench: Error allocating tree");
+                free(entries);
+                free(visited);
+                return -1;
+            }
+
+            if ((inode.mode & 0170000) != 0100000) continue;
+            if (inode.size >= tree->biggest_file_size) {
+                tree->biggest_file = ino;
+                tree->biggest_file_size = inode.size;
+            }
+
+            file_extent_t *extents = NULL;
+            uint32_t nextents = 0;
+            uint64_t holes = 0;
+            if (build_extent_map(fs, &inode, &extents, &nextents) != 0) {
+                continue;
+            }
+            for (uint32_t k = 0; k < nextents; k++) {
+                if (extents[k].hole) holes += extents[k].length;
+            }
+            free(extents);
+            if (holes > tree->sparsest_holes) {
+                tree->sparsest_file = ino;
+                tree->sparsest_holes = holes;
+            }
+        }
+        free(entries);
+    }
+
+    free(visited);
+    return 0;
+}
+
+static void free_tree(bench_tree_t *tree) {
+    for (uint32_t i = 0; i < tree->count; i++) {
+        free(tree->paths[i].path);
+    }
+    free(tree->paths);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Starts a run that will take at most max_samples latency samples.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int samples_init(bench_samples_t *s, uint32_t max_samples) {
+    memset(s, 0, sizeof(*s));
+    s->ns = malloc((max_samples ? max_samples : 1) * sizeof(uint64_t));
+    if (!s->ns) {
+        perror("minbench: Error allocating samples");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Records one sample: ops operations moving bytes bytes in ns.
+ */
+static void samples_add(bench_samples_t *s, uint64_t ops, uint64_t bytes, \
+    uint64_t ns) {
+    s->ns[s->count++] = ops ? ns / ops : ns;
+    s->ops += ops;
+    s->bytes += bytes;
+    s->total_ns += ns;
+}
+
+/**
+ * Prints one result line and frees the samples.
+ */
+static void report(FILE *out, const char *image, const char *name, \
+    int cold, bench_samples_t *s) {
+    double secs = s->total_ns / 1e9;
+    uint64_t p50 = 0, p99 = 0;
+
+    if (s->count > 0) {
+        qsort(s->ns, s->count, sizeof(uint64_t), compare_u64);
+        p50 = s->ns[(s->count - 1) / 2];
+        p99 = s->ns[(uint64_t)(s->count - 1) * 99 / 100];
+    }
+    fprintf(out, "%-16s %-28s %-4s %9lu %12.0f %9.1f %10.2f %10.2f\n", \
+        image, name, cold ? "cold" : "warm", (unsigned long)s->ops, \
+        secs > 0 ? s->ops / secs : 0.0, \
+        secs > 0 ? s->bytes / secs / (1024 * 1024) : 0.0, \
+        p50 / 1e3, p99 / 1e3);
+    free(s->ns);
+    s->ns = NULL;
+}
+
+/**
+ * get_file_block on random logical blocks of one level of the biggest
+ * file: direct zones, single indirect or double indirect.
+ */
+static void bench_file_block(FILE *out, const char *image_file, \
+    const char *label, const bench_tree_t *tree, uint32_t nops, int cold) {
+    static const char *levels[] = { "direct", "indirect", "double" };
+    minix_fs_t *fs = open_image_handle(image_file, cold);
+    minix_inode_t inode;
+
+    if (!fs) return;
+    if (read_inode(fs, tree->biggest_file, &inode) != 0) {
+        cleanup_filesystem(fs);
+        return;
+    }
+
+    uint64_t ptrs = fs->sb.blocksize / sizeof(uint32_t);
+    uint64_t nblocks = ((uint64_t)inode.size + fs->sb.blocksize - 1) / \
+        fs->sb.blocksize;
+    uint64_t bounds[4] = { 0, DIRECT_ZONES * fs->blocks_per_zone, \
+        (DIRECT_ZONES + ptrs) * fs->blocks_per_zone, nblocks };
+
+    for (int level = 0; level < 3; level++) {
+        uint64_t lo = bounds[level];
+        uint64_t hi = bounds[level + 1] < nblocks ? bounds[level + 1] : \
+            nblocks;
+        uint64_t seed = 0x2545F4914F6CDD1DULL + (uint64_t)level;
+        bench_samples_t s;
+        char name[64];
+
+        if (lo >= hi || samples_init(&s, nops / BLOCK_BATCH + 1) != 0) {
+            continue;
+        }
+        for (uint32_t done = 0; done < nops; done += BLOCK_BATCH) {
+            uint64_t start = now_ns();
+            for (int k = 0; k < BLOCK_BATCH; k++) {
+                uint32_t lb = (uint32_t)(lo + bench_rand(&seed) % (hi - lo));
+                (void)get_file_block(fs, &inode, lb);
+            }
+            samples_add(&s, BLOCK_BATCH, 0, now_ns() - start);
+        }
+        snprintf(name, sizeof(name), "file_block %s", levels[level]);
+        report(out, label, name, cold, &s);
+    }
+    cleanup_filesystem(fs);
+}
+
+/**
+ * get_inode_by_path on random paths, reported per path depth and per
+ * directory width. Each path is looked up twice on a fresh handle: the
+ * first lookup starts with empty block and directory caches, the repeat
+ * finds everything cached. At most FRESH_LOOKUPS paths per run.
+ */
+static void bench_lookup(FILE *out, const char *image_file, \
+    const char *label, const bench_tree_t *tree, uint32_t nops, int cold) {
+    static const char *passes[] = { "first", "repeat" };
+    static const char *widths[] = { "<10", "<100", "<1000", "<10000", \
+        "<100000", ">=100000" };
+    bench_samples_t by_depth[2][MAX_DEPTH + 1];
+    bench_samples_t by_width[2][WIDTH_BUCKETS];
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uint32_t done;
+    int pass, i;
+
+    if (nops > FRESH_LOOKUPS) nops = FRESH_LOOKUPS;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i <= MAX_DEPTH; i++) {
+            if (samples_init(&by_depth[pass][i], nops) != 0) return;
+        }
+        for (i = 0; i < WIDTH_BUCKETS; i++) {
+            if (samples_init(&by_width[pass][i], nops) != 0) return;
+        }
+    }
+
+    for (done = 0; done < nops; done++) {
+        const bench_path_t *p = \
+            &tree->paths[1 + bench_rand(&seed) % (tree->count - 1)];
+        int depth = p->depth < MAX_DEPTH ? (int)p->depth : MAX_DEPTH;
+        int width = 0;
+        for (uint32_t w = p->width; w >= 10 && width < WIDTH_BUCKETS - 1; \
+            w /= 10) {
+            width++;
+        }
+
+        minix_fs_t *fs = open_image_handle(image_file, cold);
+        if (!fs) break;
+        for (pass = 0; pass < 2; pass++) {
+            uint64_t start = now_ns();
+            (void)get_inode_by_path(fs, p->path);
+            uint64_t ns = now_ns() - start;
+            samples_add(&by_depth[pass][depth], 1, 0, ns);
+            samples_add(&by_width[pass][width], 1, 0, ns);
+        }
+        cleanup_filesystem(fs);
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        char name[64];
+        for (i = 0; i <= MAX_DEPTH; i++) {
+            if (by_depth[pass][i].count > 0) {
+                snprintf(name, sizeof(name), "lookup depth=%d %s", i, \
+                    passes[pass]);
+                report(out, label, name, cold, &by_depth[pass][i]);
+            }
+            free(by_depth[pass][i].ns);
+        }
+        for (i = 0; i < WIDTH_BUCKETS; i++) {
+            if (by_width[pass][i].count > 0) {
+                snprintf(name, sizeof(name), "lookup width%s %s", \
+                    widths[i], passes[pass]);
+                report(out, label, name, cold, &by_width[pass][i]);
+            }
+            free(by_width[pass][i].ns);
+        }
+    }
+}
+
+/**
+ * What minls does for a directory: read its entries, then all their
+ * inodes in one bulk pass. Run on the biggest directory; one listing is
+ * one op.
+ */
+static void bench_list(FILE *out, const char *image_file, \
+    const char *label, const bench_tree_t *tree, int cold) {
+    bench_samples_t s;
+    char name[64];
+
+    if (samples_init(&s, COPY_REPS) != 0) return;
+    for (int rep = 0; rep < COPY_REPS; rep++) {
+        minix_fs_t *fs = open_image_handle(image_file, cold);
+        minix_inode_t dir_inode;
+        minix_dir_entry_t *entries = NULL;
+        uint32_t count = 0;
+
+        if (!fs) break;
+        uint64_t start = now_ns();
+        if (read_inode(fs, tree->biggest_dir, &dir_inode) == 0 && \
+            read_directory(fs, &dir_inode, &entries, &count, NULL) == 0) {
+            uint32_t *nums = malloc((count ? count : 1) * sizeof(uint32_t));
+            minix_inode_t *inodes = malloc((count ? count : 1) * \
+                sizeof(minix_inode_t));
+            uint8_t *ok = malloc(count ? count : 1);
+            if (nums && inodes && ok) {
+                for (uint32_t i = 0; i < count; i++) {
+                    nums[i] = entries[i].inode;
+                }
+                (void)read_inodes_bulk(fs, nums, count, inodes, ok);
+            }
+            free(nums);
+            free(inodes);
+            free(ok);
+        }
+        samples_add(&s, 1, (uint64_t)count * DIR_ENTRY_SIZE, \
+            now_ns() - start);
+        free(entries);
+        cleanup_filesystem(fs);
+    }
+    snprintf(name, sizeof(name), "list %u entries", tree->biggest_dir_entries);
+    report(out, label, name, cold, &s);
+}
+
+/**
+ * copy_file_data of one file into a scratch file, COPY_REPS times.
+ */
+static void bench_copy(FILE *out, const char *image_file, \
+    const char *label, const char *what, uint32_t inode_num, int cold) {
+    char scratch[] = "/tmp/minbench.XXXXXX";
+    bench_samples_t s;
+    char name[64];
+
+    int dest_fd = mkstemp(scratch);
+    if (dest_fd < 0) {
+        perror("minbench: Error creating scratch file");
+        return;
+    }
+    unlink(scratch);
+    if (samples_init(&s, COPY_REPS) != 0) {
+        close(dest_fd);
+        return;
+    }
+
+    for (int rep = 0; rep < COPY_REPS; rep++) {
+        minix_fs_t *fs = open_image_handle(image_file, cold);
+        minix_inode_t inode;
+
+        if (!fs) break;
+        if (read_inode(fs, inode_num, &inode) == 0 && \
+            ftruncate(dest_fd, 0) == 0 && lseek(dest_fd, 0, SEEK_SET) == 0) {
+            uint64_t start = now_ns();
+            (void)copy_file_data(fs, inode_num, &inode, dest_fd);
+            samples_add(&s, 1, inode.size, now_ns() - start);
+        }
+        cleanup_filesystem(fs);
+    }
+    close(dest_fd);
+    snprintf(name, sizeof(name), "copy %s", what);
+    report(out, label, name, cold, &s);
+}
+
+/**
+ * Runs every benchmark on one image, cold then warm.
+ * Returns 0 on success, -1 if the image can't be used.
+ */
+int bench_image(const char *image_file, uint32_t nops, FILE *out) {
+    bench_tree_t tree;
+    const char *label = strrchr(image_file, '/');
+    label = label ? label + 1 : image_file;
+
+    minix_fs_t *fs = init_filesystem(image_file, -1, -1, &bench_options);
+    if (!fs) return -1;
+    int status = walk_image(fs, &tree);
+    cleanup_filesystem(fs);
+    if (status != 0) return -1;
+
+    fprintf(out, "# %s: %u paths, biggest directory %u entries, \
+biggest file %u bytes, sparsest file %lu hole blocks\n", label, \
+        tree.count, tree.biggest_dir_entries, tree.biggest_file_size, \
+        (unsigned long)tree.sparsest_holes);
+
+    for (int cold = 1; cold >= 0; cold--) {
+        if (tree.biggest_file_size > 0) {
+            bench_file_block(out, image_file, label, &tree, nops, cold);
+        }
+        if (tree.count > 1) {
+            bench_lookup(out, image_file, label, &tree, nops, cold);
+        }
+        bench_list(out, image_file, label, &tree, cold);
+        if (tree.biggest_file_size > 0) {
+            bench_copy(out, image_file, label, "largest", \
+                tree.biggest_file, cold);
+        }
+        if (tree.sparsest_holes > 0) {
+            bench_copy(out, image_file, label, "sparsest", \
+                tree.sparsest_file, cold);
+        }
+        fflush(out);
+    }
+
+    free_tree(&tree);
+    return 0;
+}
+
+/**
+ * Main function for minbench
+ */
+int main(int argc, char *argv[]) {
+    uint32_t nops = DEFAULT_OPS;
+    const char *out_file = NULL;
+    FILE *out = stdout;
+    int opt;
+
+    // ~~~ 1) Parse Arguments
+    fs_default_options(&bench_options);
+    bench_options.path_index = "";
+    while ((opt = getopt(argc, argv, "n:o:i:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                nops = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &bench_options.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1 || nops == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (out_file) {
+        out = fopen(out_file, "w");
+        if (!out) {
+            fprintf(stderr, "minbench: Error opening %s: %s\n", out_file, \
+                strerror(errno));
+            return 1;
+        }
+    }
+
+    // ~~~ 2) Benchmark every image
+    int status = 0;
+    fprintf(out, "%-16s %-28s %-4s %9s %12s %9s %10s %10s\n", "image", \
+        "benchmark", "page", "ops", "ops/s", "MB/s", "p50_us", "p99_us");
+    for (; optind < argc; optind++) {
+        if (bench_image(argv[optind], nops, out) != 0) status = -1;
+    }
+
+    if (out_file && fclose(out) != 0) {
+        perror("minbench: Error writing results");
+        status = -1;
+    }
+    return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Buffer for receiving file data from the server
+#define RECV_BUF_SIZE (256 * 1024)
+
+// Function prototypes
+void print_usage(const char *progname);
+int connect_server(const char *socket_path);
+int send_request(int fd, minsrv_op_t op, const char *path, \
+    minsrv_reply_t *reply_out);
+
+
+/**
+ * Prints the usage message for mincli.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s socketpath ls [path]\n", progname);
+    fprintf(stderr, "       %s socketpath get srcpath [dstpath]\n", \
+        progname);
+    fprintf(stderr, "       %s socketpath stat path\n", progname);
+    fprintf(stderr, "Queries a running minsrv. ls and get print what \
+minls and minget would.\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Connects to the server's socket.
+ * Returns the descriptor, or -1 on failure (error printed).
+ */
+int connect_server(const char *socket_path) {
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "mincli: socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("mincli: Error creating socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "mincli: Can't connect to %s: %s\n", \
+            socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends one request and reads the reply header.
+ * Returns 0 on success, -1 on failure (error printed).
+ */
+int send_request(int fd, minsrv_op_t op, const char *path, \
+    minsrv_reply_t *reply_out) {
+    minsrv_request_t req;
+    size_t path_len = strlen(path);
+
+    if (path_len > MINSRV_PATH_MAX) {
+        fprintf(stderr, "mincli: path too long\n");
+        return -1;
+    }
+    req.magic = MINSRV_MAGIC;
+    req.op = (uint8_t)op;
+    req.pad = 0;
+    req.path_len = (uint32_t)path_len;
+
+    if (write_all(fd, &req, sizeof(req)) != 0 || \
+        write_all(fd, path, path_len) != 0 || \
+        read_all(fd, reply_out, sizeof(*reply_out)) != 0) {
+        fprintf(stderr, "mincli: Lost connection to server\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reports a failed request the way minls/minget would.
+ */
+static void report_status(int32_t status, const char *path) {
+    if (status == ENOENT) {
+        fprintf(stderr, "mincli: Can't find %s\n", path);
+    } else if (status == EINVAL) {
+        fprintf(stderr, "mincli: %s is not a regular file.\n", path);
+    } else {
+        fprintf(stderr, "mincli: %s: %s\n", path, strerror(status));
+    }
+}
+
+/**
+ * ls: prints the listing in minls format.
+ * Returns 0 on success, -1 on failure.
+ */
+static int do_ls(int fd, const char *path) {
+    minsrv_reply_t reply;
+    char perm_str[11];
+
+    if (send_request(fd, MINSRV_OP_LS, path, &reply) != 0) return -1;
+    if (reply.status != 0) {
+        report_status(reply.status, path);
+        return -1;
+    }
+
+    uint8_t *buf = malloc(reply.length ? reply.length : 1);
+    if (!buf) {
+        perror("mincli: Error allocating listing");
+        return -1;
+    }
+    if (read_all(fd, buf, reply.length) != 0) {
+        fprintf(stderr, "mincli: Lost connection to server\n");
+        free(buf);
+        return -1;
+    }
+
+    if (reply.flags & MINSRV_REPLY_DIR) {
+        printf("%s:\n", path);
+    }
+
+    size_t at = 0;
+    while (at + sizeof(minsrv_dirent_t) <= reply.length) {
+        minsrv_dirent_t rec;
+        memcpy(&rec, buf + at, sizeof(rec));
+        at += sizeof(rec);
+        if (at + rec.name_len > reply.length) break;
+
+        if (rec.flags & MINSRV_DIRENT_UNREADABLE) {
+            fflush(stdout);
+            fprintf(stderr, "Error: Could not read inode %u for entry \
+%.*s.\n", rec.inode, (int)rec.name_len, (const char *)buf + at);
+            at += rec.name_len;
+            continue;
+        }
+        get_permissions_string(rec.mode, perm_str);
+        printf("%s %9u %.*s\n", perm_str, rec.size, (int)rec.name_len, \
+            (const char *)buf + at);
+        at += rec.name_len;
+    }
+
+    free(buf);
+    return 0;
+}
+
+/**
+ * get: receives the file into dst_path (created or truncated), or
+ * stdout if dst_path is NULL.
+ * Returns 0 on success, -1 on failure.
+ */
+static int do_get(int fd, const char *path, const char *dst_path) {
+    minsrv_reply_t reply;
+
+    if (send_request(fd, MINSRV_OP_GET, path, &reply) != 0) return -1;
+    if (reply.status != 0) {
+        report_status(reply.status, path);
+        return -1;
+    }
+
+    int dest_fd = STDOUT_FILENO;
+    if (dst_path) {
+        dest_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (dest_fd < 0) {
+            fprintf(stderr, "Error opening destination file %s: %s\n", \
+                dst_path, strerror(errno));
+            return -1;
+        }
+    }
+
+    uint8_t *buf = malloc(RECV_BUF_SIZE);
+    int status = buf ? 0 : -1;
+    uint64_t remaining = reply.length;
+    while (status == 0 && remaining > 0) {
+        size_t chunk = remaining < RECV_BUF_SIZE ? \
+            (size_t)remaining : RECV_BUF_SIZE;
+        ssize_t n = read(fd, buf, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "mincli: Lost connection to server\n");
+            status = -1;
+        } else if (write_all(dest_fd, buf, (size_t)n) != 0) {
+            perror("Error writing file data to destination");
+            status = -1;
+        } else {
+            remaining -= (uint64_t)n;
+        }
+    }
+    free(buf);
+
+    if (dst_path && close(dest_fd) != 0 && status == 0) {
+        perror("Error closing destination file");
+        status = -1;
+    }
+    return status;
+}
+
+/**
+ * stat: prints the inode's metadata.
+ * Returns 0 on success, -1 on failure.
+ */
+static int do_stat(int fd, const char *path) {
+    minsrv_reply_t reply;
+    minsrv_stat_t st;
+    char perm_str[11];
+
+    if (send_request(fd, MINSRV_OP_STAT, path, &reply) != 0) return -1;
+    if (reply.status != 0) {
+        report_status(reply.status, path);
+        return -1;
+    }
+    if (reply.length != sizeof(st) || read_all(fd, &st, sizeof(st)) != 0) {
+        fprintf(stderr, "mincli: Bad reply from server\n");
+        return -1;
+    }
+
+    minix_inode_t inode = st.inode;
+    time_t atime = inode.atime, mtime = inode.mtime, ctime_ = inode.ctime;
+    get_permissions_string(inode.mode, perm_str);
+    printf("  File: %s\n", path);
+    printf(" Inode: %u  Mode: 0%o (%s)  Links: %u\n", \
+        (unsigned)st.inode_num, inode.mode, perm_str, inode.links);
+    printf("   Uid: %u  Gid: %u  Size: %u\n", inode.uid, inode.gid, \
+        inode.size);
+    printf("Access: %s", ctime(&atime));
+    printf("Modify: %s", ctime(&mtime));
+    printf("Change: %s", ctime(&ctime_));
+    return 0;
+}
+
+/**
+ * Main function for mincli
+ */
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h")) != -1) {
+        print_usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+
+    if (argc - optind < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char *socket_path = argv[optind++];
+    const char *command = argv[optind++];
+    const char *src_path = (argc - optind >= 1) ? argv[optind++] : NULL;
+    const char *dst_path = (argc - optind >= 1) ? argv[optind++] : NULL;
+
+    if (strcmp(command, "ls") != 0 && !src_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // The server canonicalizes too, but the listing header uses this
+    char *canonical_path = canonicalize_path(src_path ? src_path : "/");
+    if (!canonical_path) {
+        fprintf(stderr, "Error: Failed to canonicalize path\n");
+        return 1;
+    }
+
+    int fd = connect_server(socket_path);
+    if (fd < 0) {
+        free(canonical_path);
+        return 1;
+    }
+
+    int status;
+    if (strcmp(command, "ls") == 0) {
+        status = do_ls(fd, canonical_path);
+    } else if (strcmp(command, "get") == 0) {
+        status = do_get(fd, canonical_path, dst_path);
+    } else if (strcmp(command, "stat") == 0) {
+        status = do_stat(fd, canonical_path);
+    } else {
+        fprintf(stderr, "mincli: unknown command %s\n", command);
+        print_usage(argv[0]);
+        status = -1;
+    }
+
+    close(fd);
+    free(canonical_path);
+    if (fflush(stdout) != 0) status = -1;
+    return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,640 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+
+
+// Upper bound for -j
+#define MAX_WORKERS 256
+
+// One directory of the walk. Its totals cover the whole subtree: they
+// start with what the directory itself holds and each subdirectory adds
+// its own once it is complete.
+typedef struct du_node {
+    struct du_node *parent;
+    char *path;
+    uint32_t inode_num;
+    minix_inode_t inode;
+    uint32_t pending;           // this listing + unfinished subdirectories
+    uint64_t size;              // sum of size fields
+    uint64_t zones;             // zones allocated, indirect ones included
+    uint64_t files;             // non-directories
+    uint64_t dirs;              // directories, this one included
+} du_node_t;
+
+// A worker's directories still to list. The owner pushes and pops at
+// the tail (depth first, so its working set stays small); idle workers
+// steal from the head, taking the oldest and so usually largest
+// subtrees.
+typedef struct {
+    pthread_mutex_t lock;
+    du_node_t **items;
+    size_t head;
+    size_t tail;
+    size_t cap;
+} du_deque_t;
+
+struct du_walk;
+
+typedef struct {
+    struct du_walk *walk;
+    pthread_t thread;
+    int id;
+    du_deque_t deque;
+    du_node_t **nodes;          // every directory this worker listed
+    size_t nnodes;
+    size_t nodes_cap;
+    uint64_t steals;
+    int failed;                 // out of memory
+    uint64_t read_errors;       // directory blocks and inodes unreadable
+} du_worker_t;
+
+typedef struct du_walk {
+    minix_fs_t *fs;
+    du_worker_t *workers;
+    int nworkers;
+    uint64_t *seen;             // directories and multi-link files counted
+    uint64_t outstanding;       // directories pushed but not yet listed
+} du_walk_t;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+int walk_tree(minix_fs_t *fs, du_node_t *root, int nworkers, int verbose, \
+    du_node_t ***nodes_out, size_t *count_out);
+
+
+/**
+ * Prints the usage message for mindu.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-j jobs] [-n top] [-i io] [-c KiB] \
+[-p part [-s subpart]] imagefile [path]\n", progname);
+    fprintf(stderr, "Prints, for each directory under path, the total \
+size, allocated bytes,\n");
+    fprintf(stderr, "file and directory counts of its subtree, largest \
+first.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -c <KiB>   block cache size, \
+    0 to disable (default: 4096)\n");
+    fprintf(stderr, "  -j <n>     walk with n threads \
+(default: one per CPU)\n");
+    fprintf(stderr, "  -n <num>   print only the num largest directories \
+(default: all)\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock and \
+walk statistics to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Sets bit n of the seen map. Returns 1 if it was already set.
+ */
+static int test_and_set_seen(du_walk_t *walk, uint32_t n) {
+    uint64_t mask = (uint64_t)1 << (n % 64);
+    return (__atomic_fetch_or(&walk->seen[n / 64], mask, \
+        __ATOMIC_RELAXED) & mask) != 0;
+}
+
+/**
+ * walk_inode_zones callback: counts every zone.
+ */
+static int count_zone(void *arg, uint32_t zone, zone_kind_t kind, \
+    uint32_t logical_zone) {
+    (void)zone;
+    (void)kind;
+    (void)logical_zone;
+    (*(uint64_t *)arg)++;
+    return 0;
+}
+
+/**
+ * Returns the number of zones allocated to inode, counting indirect
+ * zones. Devices, fifos and sockets have none.
+ */
+static uint64_t inode_zones(minix_fs_t *fs, const minix_inode_t *inode) {
+    uint16_t type = inode->mode & 0170000;
+    uint64_t count = 0;
+
+    if (type != 0100000 && type != 0040000 && type != 0120000) return 0;
+    walk_inode_zones(fs, inode, count_zone, &count);
+    return count;
+}
+
+/**
+ * Adds a directory to the tail of the worker's deque.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int deque_push(du_deque_t *dq, du_node_t *node) {
+    int status = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap && dq->head > 0) {
+        // Reuse the room left at the front by steals
+        memmove(dq->items, dq->items + dq->head, \
+            (dq->tail - dq->head) * sizeof(du_node_t *));
+        dq->tail -= dq->head;
+        dq->head = 0;
+    }
+    if (dq->tail == dq->cap) {
+        size_t new_cap = dq->cap ? dq->cap * 2 : 64;
+        du_node_t **grown = realloc(dq->items, new_cap * sizeof(du_node_t *));
+        if (grown) {
+            dq->items = grown;
+            dq->cap = new_cap;
+        }
+    }
+    if (dq->tail < dq->cap) {
+        dq->items[dq->tail++] = node;
+    } else {
+        status = -1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return status;
+}
+
+/**
+ * Takes a directory from the tail (owner) or the head (thief) of a
+ * deque. Returns NULL if it is empty.
+ */
+static du_node_t *deque_take(du_deque_t *dq, int from_head) {
+    du_node_t *node = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        node = from_head ? dq->items[dq->head++] : dq->items[--dq->tail];
+        if (dq->head == dq->tail) {
+            dq->head = 0;
+            dq->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+/**
+ * Drops one pending count from node. The last drop means its subtree
+ * is complete: its totals are added to its parent and the parent's
+ * count is dropped in turn.
+ */
+static void finish_node(du_node_t *node) {
+    while (node && __atomic_sub_fetch(&node->pending, 1, \
+        __ATOMIC_ACQ_REL) == 0) {
+        du_node_t *parent = node->parent;
+        if (!parent) break;
+        __atomic_fetch_add(&parent->size, node->size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&parent->zones, node->zones, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&parent->files, node->files, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&parent->dirs, node->dirs, __ATOMIC_RELAXED);
+        node = parent;
+    }
+}
+
+/**
+ * Makes the node for subdirectory name of parent.
+ * Returns NULL on allocation failure.
+ */
+static du_node_t *new_node(du_node_t *parent, uint32_t inode_num, \
+    const minix_inode_t *inode, const char *name) {
+    du_node_t *node = calloc(1, sizeof(du_node_t));
+    if (!node) return NULL;
+
+    size_t parent_len = strlen(parent->path);
+    size_t name_len = strlen(name);
+    node->path = malloc(parent_len + 1 + name_len + 1);
+    if (!node->path) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->path, parent->path, parent_len);
+    if (parent_len == 0 || parent->path[parent_len - 1] != '/') {
+        node->path[parent_len++] = '/';
+    }
+    memcpy(node->path + parent_len, name, name_len + 1);
+
+    node->parent = parent;
+    node->inode_num = inode_num;
+    node->inode = *inode;
+    node->pending = 1;
+    return node;
+}
+
+/**
+ * Lists one directory: adds its files to its totals and pushes its
+ * subdirectories onto the worker's deque.
+ */
+static void list_node(du_worker_t *w, du_node_t *node) {
+    du_walk_t *walk = w->walk;
+    minix_fs_t *fs = walk->fs;
+    minix_dir_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint64_t size = node->inode.size;
+    uint64_t zones = inode_zones(fs, &node->inode);
+    uint64_t files = 0;
+
+    // Record it for the report
+    if (w->nnodes == w->nodes_cap) {
+        size_t new_cap = w->nodes_cap ? w->nodes_cap * 2 : 256;
+        du_node_t **grown = realloc(w->nodes, new_cap * sizeof(du_node_t *));
+        if (!grown) {
+            w->failed = 1;
+            finish_node(node);
+            return;
+        }
+        w->nodes = grown;
+        w->nodes_cap = new_cap;
+    }
+    w->nodes[w->nnodes++] = node;
+
+    uint32_t bad_blocks = 0;
+    if (read_directory(fs, &node->inode, &entries, &count, \
+        &bad_blocks) != 0) {
+        w->failed = 1;
+        count = 0;
+    }
+    if (bad_blocks > 0) {
+        fprintf(stderr, "Error: Could not read %u block(s) of directory \
+%s.\n", bad_blocks, node->path);
+        w->read_errors += bad_blocks;
+    }
+
+    // Keep the real entries, then read all their inodes at once
+    uint32_t *nums = malloc((count ? count : 1) * sizeof(uint32_t));
+    minix_inode_t *inodes = malloc((count ? count : 1) * \
+        sizeof(minix_inode_t));
+    uint8_t *ok = malloc(count ? count : 1);
+    uint32_t n = 0;
+    if (!nums || !inodes || !ok) {
+        w->failed = 1;
+        count = 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const char *name = (const char *)entries[i].name;
+        if (strncmp(name, ".", 60) == 0 || strncmp(name, "..", 60) == 0) {
+            continue;
+        }
+        entries[n] = entries[i];
+        nums[n++] = entries[i].inode;
+    }
+    if (n > 0 && read_inodes_bulk(fs, nums, n, inodes, ok) != 0) {
+        w->failed = 1;
+        n = 0;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (!ok[i]) {
+            char name[61];
+            memcpy(name, entries[i].name, 60);
+            name[60] = '\0';
+            fprintf(stderr, "Error: Could not read inode %u for entry %s \
+in %s.\n", nums[i], name, node->path);
+            w->read_errors++;
+            continue;
+        }
+        const minix_inode_t *inode = &inodes[i];
+
+        if ((inode->mode & 0170000) == 0040000) {
+            // A directory reached twice (a corrupt image) is walked once
+            if (test_and_set_seen(walk, nums[i])) continue;
+
+            char name[61];
+            memcpy(name, entries[i].name, 60);
+            name[60] = '\0';
+            du_node_t *child = new_node(node, nums[i], inode, name);
+            if (!child) {
+                w->failed = 1;
+                continue;
+            }
+            __atomic_fetch_add(&node->pending, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&walk->outstanding, 1, __ATOMIC_RELAXED);
+            if (deque_push(&w->deque, child) != 0) {
+                // No room to queue it: list it right here instead
+                __atomic_fetch_sub(&walk->outstanding, 1, __ATOMIC_RELAXED);
+                list_node(w, child);
+            }
+            continue;
+        }
+
+        // Like du, a file with several links is counted once
+        if (inode->links > 1 && test_and_set_seen(walk, nums[i])) continue;
+        files++;
+        size += inode->size;
+        zones += inode_zones(fs, inode);
+    }
+
+    free(entries);
+    free(nums);
+    free(inodes);
+    free(ok);
+
+    __atomic_fetch_add(&node->size, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->zones, zones, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->files, files, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->dirs, 1, __ATOMIC_RELAXED);
+    finish_node(node);
+}
+
+/**
+ * Worker thread: lists directories from its own deque, steals from the
+ * others when it runs dry, and stops once no directory is left
+ * anywhere.
+ */
+static void *du_worker(void *arg) {
+    du_worker_t *w = arg;
+    du_walk_t *walk = w->walk;
+
+    for (;;) {
+        du_node_t *node = deque_take(&w->deque, 0);
+        for (int i = 1; !node && i < walk->nworkers; i++) {
+            int victim = (w->id + i) % walk->nworkers;
+            node = deque_take(&walk->workers[victim].deque, 1);
+            if (node) w->steals++;
+        }
+
+        if (node) {
+            list_node(w, node);
+            __atomic_fetch_sub(&walk->outstanding, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (__atomic_load_n(&walk->outstanding, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+/**
+ * Walks the tree under root on nworkers threads. On return every node
+ * holds its subtree's totals; *nodes_out lists all of them (root
+ * included) and is malloc'd, as are the nodes and their paths.
+ * Returns 0 on success, -1 on failure.
+ */
+int walk_tree(minix_fs_t *fs, du_node_t *root, int nworkers, int verbose, \
+    du_node_t ***nodes_out, size_t *count_out) {
+    du_walk_t walk;
+    int status = 0;
+
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+    memset(&walk, 0, sizeof(walk));
+    walk.fs = fs;
+    walk.nworkers = nworkers;
+    walk.seen = calloc(((uint64_t)fs->sb.ninodes + 64) / 64, \
+        sizeof(uint64_t));
+    walk.workers = calloc((size_t)nworkers, sizeof(du_worker_t));
+    if (!walk.seen || !walk.workers) {
+        perror("calloc");
+        free(walk.seen);
+        free(walk.workers);
+        return -1;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        walk.workers[i].walk = &walk;
+        walk.workers[i].id = i;
+        pthread_mutex_init(&walk.workers[i].deque.lock, NULL);
+    }
+
+    // Seed worker 0 with the root and start the others; they steal
+    test_and_set_seen(&walk, root->inode_num);
+    walk.outstanding = 1;
+    if (deque_push(&walk.workers[0].deque, root) != 0) {
+        perror("malloc");
+        status = -1;
+        walk.outstanding = 0;
+    }
+    int started = 1;
+    for (int i = 1; i < nworkers && status == 0; i++) {
+        if (pthread_create(&walk.workers[i].thread, NULL, du_worker, \
+            &walk.workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    du_worker(&walk.workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(walk.workers[i].thread, NULL);
+    }
+
+    // Gather the nodes of all workers
+    size_t total = 0;
+    uint64_t steals = 0;
+    uint64_t read_errors = 0;
+    int out_of_memory = (status != 0);
+    for (int i = 0; i < nworkers; i++) {
+        total += walk.workers[i].nnodes;
+        steals += walk.workers[i].steals;
+        read_errors += walk.workers[i].read_errors;
+        if (walk.workers[i].failed) out_of_memory = 1;
+    }
+    du_node_t **nodes = malloc((total ? total : 1) * sizeof(du_node_t *));
+    if (!nodes) out_of_memory = 1;
+    size_t n = 0;
+    for (int i = 0; i < nworkers; i++) {
+        if (nodes) {
+            memcpy(nodes + n, walk.workers[i].nodes, \
+                walk.workers[i].nnodes * sizeof(du_node_t *));
+            n += walk.workers[i].nnodes;
+        }
+        free(walk.workers[i].nodes);
+        free(walk.workers[i].deque.items);
+        pthread_mutex_destroy(&walk.workers[i].deque.lock);
+    }
+    if (out_of_memory) {
+        fprintf(stderr, "Error: Out of memory; totals are incomplete.\n");
+        status = -1;
+    }
+    if (read_errors > 0) {
+        fprintf(stderr, "Error: Totals are incomplete; %llu directory \
+block(s) or inode(s) could not be read.\n", \
+            (unsigned long long)read_errors);
+        status = -1;
+    }
+    if (verbose) {
+        fprintf(stderr, "mindu: %zu directories, %d threads, %llu steals\n", \
+            total, started, (unsigned long long)steals);
+    }
+
+    free(walk.seen);
+    free(walk.workers);
+    *nodes_out = nodes;
+    *count_out = nodes ? n : 0;
+    return status;
+}
+
+/**
+ * Orders nodes by subtree size, largest first, then by path.
+ */
+static int compare_nodes(const void *a, const void *b) {
+    const du_node_t *na = *(du_node_t * const *)a;
+    const du_node_t *nb = *(du_node_t * const *)b;
+    if (na->size != nb->size) return na->size > nb->size ? -1 : 1;
+    return strcmp(na->path, nb->path);
+}
+
+/**
+ * Prints one line: size, allocated bytes, files, directories, path.
+ */
+static void print_line(const minix_fs_t *fs, uint64_t size, uint64_t zones, \
+    uint64_t files, uint64_t dirs, const char *path) {
+    printf("%14llu %14llu %10llu %8llu %s\n", (unsigned long long)size, \
+        (unsigned long long)(zones * fs->zone_size), \
+        (unsigned long long)files, (unsigned long long)dirs, path);
+}
+
+/**
+ * Main function for mindu
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
+    char *image_file = NULL;
+    char *path = "/";
+    int nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long top = 0;
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:j:n:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                nworkers = atoi(optarg);
+                break;
+            case 'n':
+                top = atol(optarg);
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    image_file = argv[optind];
+    if (argc - optind > 1) {
+        path = argv[optind + 1];
+    }
+
+    // 2) Open the filesystem and find the starting point
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
+        return 1;
+    }
+
+    char *canonical_path = canonicalize_path(path);
+    if (!canonical_path) {
+        perror("malloc");
+        cleanup_filesystem(fs);
+        return 1;
+    }
+    uint32_t inode_num = get_inode_by_path(fs, canonical_path);
+    minix_inode_t inode;
+    if (inode_num == 0 || read_inode(fs, inode_num, &inode) != 0) {
+        fprintf(stderr, "Error: Path not found: %s\n", path);
+        free(canonical_path);
+        cleanup_filesystem(fs);
+        return 1;
+    }
+
+    // A lone file is its own total
+    if ((inode.mode & 0170000) != 0040000) {
+        print_line(fs, inode.size, inode_zones(fs, &inode), 1, 0, \
+            canonical_path);
+        free(canonical_path);
+        cleanup_filesystem(fs);
+        return (fflush(stdout) == 0) ? 0 : 1;
+    }
+
+    // 3) Walk the tree
+    du_node_t *root = calloc(1, sizeof(du_node_t));
+    if (!root) {
+        perror("calloc");
+        free(canonical_path);
+        cleanup_filesystem(fs);
+        return 1;
+    }
+    root->path = canonical_path;
+    root->inode_num = inode_num;
+    root->inode = inode;
+    root->pending = 1;
+
+    du_node_t **nodes = NULL;
+    size_t count = 0;
+    int status = walk_tree(fs, root, nworkers, opts.verbose, &nodes, &count);
+
+    // 4) Print the largest subtrees first
+    qsort(nodes, count, sizeof(du_node_t *), compare_nodes);
+    size_t shown = count;
+    if (top > 0 && (size_t)top < shown) shown = (size_t)top;
+    for (size_t i = 0; i < shown; i++) {
+        print_line(fs, nodes[i]->size, nodes[i]->zones, nodes[i]->files, \
+            nodes[i]->dirs, nodes[i]->path);
+    }
+    if (fflush(stdout) != 0) {
+        perror("write stdout");
+        status = -1;
+    }
+
+    // 5) Cleanup (the root is one of the nodes)
+    for (size_t i = 0; i < count; i++) {
+        free(nodes[i]->path);
+        free(nodes[i]);
+    }
+    free(nodes);
+    cleanup_filesystem(fs);
+
+    return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,710 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+
+// Inodes a worker takes (and reads from the inode table) at a time
+#define INODE_CHUNK 4096
+
+// Upper bound for -j
+#define MAX_WORKERS 256
+
+// Kinds of problem found per inode, in the order they are printed
+typedef enum {
+    PROB_TABLE_READ = 0,        // a = last inode of the unreadable run
+    PROB_ROOT,
+    PROB_BAD_TYPE,              // a = mode
+    PROB_BAD_ZONES,             // a = count, b = first zone
+    PROB_DUP_ZONES,             // a = count, b = first zone
+    PROB_PTR_READ,
+    PROB_DIR_SIZE,              // a = size
+    PROB_DIR_READ,
+    PROB_DOT,                   // a = inode "." points to (0: none)
+    PROB_DOTDOT,                // a = inode ".." points to (0: none)
+    PROB_ENTRY_NAME,            // a = inode, name
+    PROB_ENTRY_RANGE,           // a = inode, name
+    PROB_ENTRY_FREE,            // a = inode, name
+    PROB_LINKS                  // a = link count, b = entries found
+} problem_kind_t;
+
+typedef struct {
+    uint32_t inode;
+    uint32_t kind;              // problem_kind_t
+    uint64_t a;
+    uint64_t b;
+    char name[61];              // entry name for PROB_ENTRY_*
+} problem_t;
+
+// State shared by all workers of one check
+typedef struct {
+    minix_fs_t *fs;
+    const uint8_t *imap;        // on-disk bitmaps (see read_bitmaps)
+    const uint8_t *zmap;
+    uint64_t *claimed;          // zone map rebuilt from the inodes
+    uint64_t *dups;             // zones claimed more than once
+    uint32_t *refs;             // directory entries naming each inode
+    uint16_t *links;            // link count of each allocated inode
+    uint32_t ninodes;
+    uint64_t nzones;            // data zones (bits 1..nzones of the maps)
+    off_t table_offset;         // inode table, from the FS start
+    int pass;                   // 1: claim zones, 2: blame duplicates
+    uint32_t next_chunk;        // next INODE_CHUNK to hand out
+} check_t;
+
+// One worker thread and what it found
+typedef struct {
+    check_t *ck;
+    pthread_t thread;
+    uint8_t *table_buf;
+    problem_t *problems;
+    size_t nproblems;
+    size_t cap;
+    int failed;                 // out of memory
+    uint64_t files;
+    uint64_t dirs;
+    uint64_t others;
+    uint64_t bad_zones;         // ...of the inode being walked
+    uint64_t first_bad;
+    uint64_t dup_zones;
+    uint64_t first_dup;
+} worker_t;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+int check_filesystem(minix_fs_t *fs, const char *image_file, int nworkers);
+
+
+/**
+ * Prints the usage message for minfsck.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-j jobs] [-i io] [-c KiB] \
+[-p part [-s subpart]] imagefile\n", progname);
+    fprintf(stderr, "Checks the bitmaps, zone pointers, link counts and \
+directories of an image.\n");
+    fprintf(stderr, "Exits 0 if it is consistent, 1 if problems were \
+found, 2 if it couldn't be checked.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -c <KiB>   block cache size, \
+    0 to disable (default: 4096)\n");
+    fprintf(stderr, "  -j <n>     check with n threads \
+(default: one per CPU)\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock \
+to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Returns bit n of a map laid out as read_bitmaps describes.
+ */
+static int map_bit(const uint8_t *map, uint64_t n) {
+    return (map[n / 8] >> (n % 8)) & 1;
+}
+
+/**
+ * Records a problem. name may be NULL.
+ */
+static void add_problem(worker_t *w, uint32_t inode, problem_kind_t kind, \
+    uint64_t a, uint64_t b, const char *name) {
+    if (w->nproblems == w->cap) {
+        size_t new_cap = w->cap ? w->cap * 2 : 64;
+        problem_t *grown = realloc(w->problems, new_cap * sizeof(problem_t));
+        if (!grown) {
+            w->failed = 1;
+            return;
+        }
+        w->problems = grown;
+        w->cap = new_cap;
+    }
+
+    problem_t *p = &w->problems[w->nproblems++];
+    memset(p, 0, sizeof(*p));
+    p->inode = inode;
+    p->kind = kind;
+    p->a = a;
+    p->b = b;
+    if (name) strncpy(p->name, name, sizeof(p->name) - 1);
+}
+
+/**
+ * walk_inode_zones callback. Pass 1 sets the zone's bit in the rebuilt
+ * map with an atomic OR; a claimant that finds the bit already set
+ * marks the zone in dups. Pass 2 counts the inode's zones that ended
+ * up in dups. Pointer zones are walked by every claimant in both
+ * passes (the tree is only two levels deep), so which zones get claimed
+ * never depends on which thread got there first. Zones outside the
+ * data area are counted as bad and never read.
+ */
+static int claim_zone(void *arg, uint32_t zone, zone_kind_t kind, \
+    uint32_t logical_zone) {
+    worker_t *w = arg;
+    check_t *ck = w->ck;
+    (void)kind;
+    (void)logical_zone;
+
+    if (zone < ck->fs->sb.firstdata || zone >= ck->fs->sb.zones) {
+        if (w->bad_zones++ == 0) w->first_bad = zone;
+        return 1;
+    }
+
+    uint64_t bit = (uint64_t)zone - ck->fs->sb.firstdata + 1;
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    if (ck->pass == 1) {
+        uint64_t old = __atomic_fetch_or(&ck->claimed[bit / 64], mask, \
+            __ATOMIC_RELAXED);
+        if (old & mask) {
+            __atomic_fetch_or(&ck->dups[bit / 64], mask, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+
+    if (ck->dups[bit / 64] & mask) {
+        if (w->dup_zones++ == 0) w->first_dup = zone;
+    }
+    return 0;
+}
+
+/**
+ * Checks the entries of directory dir_num: each must name an allocated
+ * inode with a name that has no '/', "." must be the directory itself
+ * and ".." must be there (the root's own ".." is the root). Counts the
+ * references each entry makes.
+ */
+static void check_directory(worker_t *w, uint32_t dir_num, \
+    const minix_inode_t *dir) {
+    check_t *ck = w->ck;
+    minix_dir_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint32_t dot = 0, dotdot = 0;
+
+    if (read_directory(ck->fs, dir, &entries, &count, NULL) != 0) {
+        add_problem(w, dir_num, PROB_DIR_READ, 0, 0, NULL);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        char name[61];
+        uint32_t ino = entries[i].inode;
+        memcpy(name, entries[i].name, 60);
+        name[60] = '\0';
+
+        if (strcmp(name, ".") == 0) {
+            if (!dot) dot = ino;
+        } else if (strcmp(name, "..") == 0) {
+            if (!dotdot) dotdot = ino;
+        } else if (name[0] == '\0' || strchr(name, '/')) {
+            add_problem(w, dir_num, PROB_ENTRY_NAME, ino, 0, name);
+        }
+
+        if (ino > ck->ninodes) {
+            add_problem(w, dir_num, PROB_ENTRY_RANGE, ino, 0, name);
+            continue;
+        }
+        if (!map_bit(ck->imap, ino)) {
+            add_problem(w, dir_num, PROB_ENTRY_FREE, ino, 0, name);
+        }
+        __atomic_fetch_add(&ck->refs[ino], 1, __ATOMIC_RELAXED);
+    }
+
+    if (dot != dir_num) {
+        add_problem(w, dir_num, PROB_DOT, dot, 0, NULL);
+    }
+    if (dotdot == 0 || (dir_num == 1 && dotdot != 1)) {
+        add_problem(w, dir_num, PROB_DOTDOT, dotdot, 0, NULL);
+    }
+    free(entries);
+}
+
+/**
+ * Checks one allocated inode (pass 1) or looks for its shared zones
+ * (pass 2).
+ */
+static void check_inode(worker_t *w, uint32_t ino, \
+    const minix_inode_t *inode) {
+    check_t *ck = w->ck;
+    uint16_t type = inode->mode & 0170000;
+    int has_zones = (type == 0100000 || type == 0040000 || \
+        type == 0120000);
+
+    if (ck->pass == 2) {
+        if (!has_zones) return;
+        w->dup_zones = 0;
+        w->bad_zones = 0;
+        walk_inode_zones(ck->fs, inode, claim_zone, w);
+        if (w->dup_zones) {
+            add_problem(w, ino, PROB_DUP_ZONES, w->dup_zones, \
+                w->first_dup, NULL);
+        }
+        return;
+    }
+
+    ck->links[ino] = inode->links;
+    if (ino == 1 && type != 0040000) {
+        add_problem(w, ino, PROB_ROOT, 0, 0, NULL);
+    }
+    if (type == 0040000) {
+        w->dirs++;
+    } else if (type == 0100000) {
+        w->files++;
+    } else if (type == 0120000 || type == 0020000 || type == 0060000 || \
+        type == 0010000 || type == 0140000) {
+        w->others++;
+    } else {
+        add_problem(w, ino, PROB_BAD_TYPE, inode->mode, 0, NULL);
+        return;
+    }
+    if (!has_zones) return;
+
+    w->bad_zones = 0;
+    if (walk_inode_zones(ck->fs, inode, claim_zone, w) != 0) {
+        add_problem(w, ino, PROB_PTR_READ, 0, 0, NULL);
+    }
+    if (w->bad_zones) {
+        add_problem(w, ino, PROB_BAD_ZONES, w->bad_zones, w->first_bad, NULL);
+    }
+
+    if (type == 0040000) {
+        if (inode->size % DIR_ENTRY_SIZE != 0) {
+            add_problem(w, ino, PROB_DIR_SIZE, inode->size, 0, NULL);
+        }
+        // Entries read through bad zone pointers would only be noise
+        if (!w->bad_zones) check_directory(w, ino, inode);
+    }
+}
+
+/**
+ * Worker thread: takes INODE_CHUNK inodes at a time until the table is
+ * done, reads them with one read and checks the allocated ones.
+ */
+static void *check_worker(void *arg) {
+    worker_t *w = arg;
+    check_t *ck = w->ck;
+
+    for (;;) {
+        uint32_t chunk = __atomic_fetch_add(&ck->next_chunk, 1, \
+            __ATOMIC_RELAXED);
+        uint64_t first = (uint64_t)chunk * INODE_CHUNK + 1;
+        if (first > ck->ninodes) break;
+        uint32_t count = INODE_CHUNK;
+        if (first + count - 1 > ck->ninodes) {
+            count = (uint32_t)(ck->ninodes - first + 1);
+        }
+
+        if (read_fs_bytes(ck->fs, ck->table_offset + \
+            (off_t)(first - 1) * INODE_SIZE, w->table_buf, \
+            (size_t)count * INODE_SIZE) != 0) {
+            if (ck->pass == 1) {
+                add_problem(w, (uint32_t)first, PROB_TABLE_READ, \
+                    first + count - 1, 0, NULL);
+            }
+            continue;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t ino = (uint32_t)first + i;
+            if (!map_bit(ck->imap, ino)) continue;
+
+            minix_inode_t inode;
+            memcpy(&inode, w->table_buf + (size_t)i * INODE_SIZE, \
+                sizeof(inode));
+            check_inode(w, ino, &inode);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs one pass over the inode table on nworkers threads (the calling
+ * thread is workers[0]).
+ */
+static void run_pass(check_t *ck, worker_t *workers, int nworkers, int pass) {
+    int started = 1;
+
+    ck->pass = pass;
+    ck->next_chunk = 0;
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, check_worker, \
+            &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    check_worker(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+/**
+ * Orders problems by inode, then kind, then value.
+ */
+static int compare_problems(const void *a, const void *b) {
+    const problem_t *pa = a;
+    const problem_t *pb = b;
+    if (pa->inode != pb->inode) return pa->inode < pb->inode ? -1 : 1;
+    if (pa->kind != pb->kind) return pa->kind < pb->kind ? -1 : 1;
+    if (pa->a != pb->a) return pa->a < pb->a ? -1 : 1;
+    return strcmp(pa->name, pb->name);
+}
+
+/**
+ * Prints one problem.
+ */
+static void print_problem(const problem_t *p) {
+    unsigned long long a = (unsigned long long)p->a;
+    unsigned long long b = (unsigned long long)p->b;
+
+    printf("inode %u: ", p->inode);
+    switch ((problem_kind_t)p->kind) {
+        case PROB_TABLE_READ:
+            printf("could not read the inode table up to inode %llu\n", a);
+            break;
+        case PROB_ROOT:
+            printf("root is not an allocated directory\n");
+            break;
+        case PROB_BAD_TYPE:
+            printf("allocated, but mode %06llo is no file type\n", a);
+            break;
+        case PROB_BAD_ZONES:
+            printf("%llu zone pointer%s out of range (first: %llu)\n", \
+                a, a == 1 ? "" : "s", b);
+            break;
+        case PROB_DUP_ZONES:
+            printf("%llu zone%s also claimed by another inode \
+(first: %llu)\n", a, a == 1 ? "" : "s", b);
+            break;
+        case PROB_PTR_READ:
+            printf("could not read an indirect zone\n");
+            break;
+        case PROB_DIR_SIZE:
+            printf("directory size %llu is not a multiple of %d\n", \
+                a, DIR_ENTRY_SIZE);
+            break;
+        case PROB_DIR_READ:
+            printf("could not read the directory\n");
+            break;
+        case PROB_DOT:
+            if (a) printf("\".\" points to inode %llu\n", a);
+            else printf("\".\" is missing\n");
+            break;
+        case PROB_DOTDOT:
+            if (a) printf("\"..\" points to inode %llu\n", a);
+            else printf("\"..\" is missing\n");
+            break;
+        case PROB_ENTRY_NAME:
+            printf("entry for inode %llu has a bad name \"%s\"\n", \
+                a, p->name);
+            break;
+        case PROB_ENTRY_RANGE:
+            printf("entry \"%s\" points to inode %llu, past the last \
+inode\n", p->name, a);
+            break;
+        case PROB_ENTRY_FREE:
+            printf("entry \"%s\" points to free inode %llu\n", p->name, a);
+            break;
+        case PROB_LINKS:
+            printf("link count is %llu but %llu entries name it\n", a, b);
+            break;
+    }
+}
+
+/**
+ * Prints each run of zones whose bit is set in diff, one of the word
+ * combinations of the on-disk and rebuilt maps chosen by which:
+ *   0  in use but free on disk, 1  marked used but not in use,
+ *   2  claimed more than once.
+ * Returns the number of zones printed.
+ */
+static uint64_t print_zone_runs(const check_t *ck, int which) {
+    static const char *what[] = {
+        "in use but marked free",
+        "marked used but not in use",
+        "claimed by more than one inode"
+    };
+    uint64_t nwords = (ck->nzones + 1 + 63) / 64;
+    uint64_t total = 0;
+    uint64_t run_start = 0, run_len = 0;
+
+    for (uint64_t i = 0; i <= nwords; i++) {
+        uint64_t diff = 0;
+        if (i < nwords) {
+            uint64_t disk;
+            memcpy(&disk, ck->zmap + i * 8, sizeof(disk));
+            if (which == 0) diff = ck->claimed[i] & ~disk;
+            else if (which == 1) diff = disk & ~ck->claimed[i];
+            else diff = ck->dups[i];
+
+            // Only bits 1..nzones are zones
+            if (i == 0) diff &= ~(uint64_t)1;
+            if (i == nwords - 1 && (ck->nzones + 1) % 64 != 0) {
+                diff &= ((uint64_t)1 << ((ck->nzones + 1) % 64)) - 1;
+            }
+        }
+        if (diff == 0 && run_len == 0) continue;
+
+        for (int b = 0; b < 64; b++) {
+            uint64_t bit = i * 64 + (uint64_t)b;
+            if ((diff >> b) & 1) {
+                if (run_len == 0) run_start = bit;
+                run_len++;
+                continue;
+            }
+            if (run_len == 0) continue;
+
+            uint64_t zone = run_start + ck->fs->sb.firstdata - 1;
+            if (run_len == 1) {
+                printf("zone %llu: %s\n", (unsigned long long)zone, \
+                    what[which]);
+            } else {
+                printf("zones %llu-%llu: %s\n", (unsigned long long)zone, \
+                    (unsigned long long)(zone + run_len - 1), what[which]);
+            }
+            total += run_len;
+            run_len = 0;
+            if (diff >> b == 0) break;
+        }
+    }
+    return total;
+}
+
+/**
+ * Checks fs with nworkers threads and prints what it finds, then a
+ * summary line. Returns 0 if consistent, 1 if problems were found, 2
+ * if the check couldn't be done.
+ */
+int check_filesystem(minix_fs_t *fs, const char *image_file, int nworkers) {
+    check_t ck;
+    worker_t *workers = NULL;
+    uint8_t *maps = NULL;
+    int status = 2;
+
+    memset(&ck, 0, sizeof(ck));
+    ck.fs = fs;
+    ck.ninodes = fs->sb.ninodes;
+    ck.nzones = fs->sb.zones > fs->sb.firstdata ? \
+        fs->sb.zones - fs->sb.firstdata : 0;
+    ck.table_offset = (off_t)(2 + fs->sb.i_blocks + fs->sb.z_blocks) * \
+        fs->sb.blocksize;
+
+    maps = read_bitmaps(fs);
+    if (!maps) return 2;
+    ck.imap = maps;
+    ck.zmap = maps + (size_t)fs->sb.i_blocks * fs->sb.blocksize;
+    if ((uint64_t)ck.ninodes + 1 > (uint64_t)fs->sb.i_blocks * \
+        fs->sb.blocksize * 8 || ck.nzones + 1 > (uint64_t)fs->sb.z_blocks * \
+        fs->sb.blocksize * 8) {
+        fprintf(stderr, "Error: The bitmaps are too small for the inode \
+and zone counts in the superblock.\n");
+        free(maps);
+        return 2;
+    }
+
+    uint64_t nwords = (ck.nzones + 1 + 63) / 64;
+    ck.claimed = calloc(nwords, sizeof(uint64_t));
+    ck.dups = calloc(nwords, sizeof(uint64_t));
+    ck.refs = calloc((size_t)ck.ninodes + 1, sizeof(uint32_t));
+    ck.links = calloc((size_t)ck.ninodes + 1, sizeof(uint16_t));
+    // No more workers than chunks of the inode table
+    uint64_t nchunks = ((uint64_t)ck.ninodes + INODE_CHUNK - 1) / INODE_CHUNK;
+    if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+    if ((uint64_t)nworkers > nchunks) nworkers = (int)nchunks;
+    if (nworkers < 1) nworkers = 1;
+    workers = calloc((size_t)nworkers, sizeof(worker_t));
+    if (!ck.claimed || !ck.dups || !ck.refs || !ck.links || !workers) {
+        perror("calloc");
+        goto out;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].ck = &ck;
+        workers[i].table_buf = malloc((size_t)INODE_CHUNK * INODE_SIZE);
+        if (!workers[i].table_buf) {
+            perror("malloc");
+            goto out;
+        }
+    }
+
+    // 1) Claim every zone reachable from an allocated inode and check
+    // the directories on the way
+    run_pass(&ck, workers, nworkers, 1);
+
+    // 2) Only if zones were claimed twice: walk again to name all the
+    // inodes involved, not just the ones that lost the race
+    if (count_bits((const uint8_t *)ck.dups, 0, nwords * 64) > 0) {
+        run_pass(&ck, workers, nworkers, 2);
+    }
+
+    // 3) Compare link counts with the entries found
+    if (!map_bit(ck.imap, 1)) {
+        add_problem(&workers[0], 1, PROB_ROOT, 0, 0, NULL);
+    }
+    for (uint32_t ino = 1; ino <= ck.ninodes; ino++) {
+        if (map_bit(ck.imap, ino) && ck.links[ino] != ck.refs[ino]) {
+            add_problem(&workers[0], ino, PROB_LINKS, ck.links[ino], \
+                ck.refs[ino], NULL);
+        }
+    }
+
+    // 4) Report, inode problems in inode order, then zone map mismatches
+    size_t nproblems = 0;
+    uint64_t files = 0, dirs = 0, others = 0;
+    for (int i = 0; i < nworkers; i++) {
+        if (workers[i].failed) {
+            fprintf(stderr, "Error: Out of memory recording problems.\n");
+            goto out;
+        }
+        nproblems += workers[i].nproblems;
+        files += workers[i].files;
+        dirs += workers[i].dirs;
+        others += workers[i].others;
+    }
+    problem_t *all = malloc((nproblems ? nproblems : 1) * sizeof(problem_t));
+    if (!all) {
+        perror("malloc");
+        goto out;
+    }
+    size_t n = 0;
+    for (int i = 0; i < nworkers; i++) {
+        memcpy(all + n, workers[i].problems, \
+            workers[i].nproblems * sizeof(problem_t));
+        n += workers[i].nproblems;
+    }
+    qsort(all, nproblems, sizeof(problem_t), compare_problems);
+    for (size_t i = 0; i < nproblems; i++) {
+        print_problem(&all[i]);
+    }
+    free(all);
+
+    uint64_t bad_zones = 0;
+    for (int which = 0; which < 3; which++) {
+        bad_zones += print_zone_runs(&ck, which);
+    }
+
+    uint64_t used = count_bits((const uint8_t *)ck.claimed, 0, nwords * 64);
+    printf("%s: %llu files, %llu directories, %llu other; \
+%llu of %llu zones in use: ", image_file, (unsigned long long)files, \
+        (unsigned long long)dirs, (unsigned long long)others, \
+        (unsigned long long)used, (unsigned long long)ck.nzones);
+    if (nproblems == 0 && bad_zones == 0) {
+        printf("clean\n");
+        status = 0;
+    } else {
+        printf("%zu inode problems, %llu zones mismatched\n", nproblems, \
+            (unsigned long long)bad_zones);
+        status = 1;
+    }
+
+out:
+    if (workers) {
+        for (int i = 0; i < nworkers; i++) {
+            free(workers[i].table_buf);
+            free(workers[i].problems);
+        }
+    }
+    free(workers);
+    free(ck.claimed);
+    free(ck.dups);
+    free(ck.refs);
+    free(ck.links);
+    free(maps);
+    return status;
+}
+
+/**
+ * Main function for minfsck
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
+    char *image_file = NULL;
+    int nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:j:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                nworkers = atoi(optarg);
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 2;
+    }
+    image_file = argv[optind];
+
+    // 2) Open the filesystem; the path index isn't needed and may be
+    // as broken as the image
+    opts.path_index = "";
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
+        return 2;
+    }
+
+    // 3) Check it
+    int status = check_filesystem(fs, image_file, nworkers);
+
+    // 4) Cleanup
+    cleanup_filesystem(fs);
+    if (fflush(stdout) != 0) {
+        perror("write stdout");
+        return 2;
+    }
+    return status;
+}
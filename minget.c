@@ -6,133 +6,631 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <ctype.h>
+
+// Upper bound for -j
+#define MAX_WORKERS 256
+
+// Upper bound for -a (the pipeline's deepest ring)
+#define MAX_READ_AHEAD 256
+
+// One regular file queued for the recursive extraction worker pool
+typedef struct {
+    uint32_t inode_num;
+    minix_inode_t inode;
+    char *dst_path;
+} copy_job_t;
+
+// Work plan for a recursive extraction, shared by the workers
+typedef struct {
+    minix_fs_t *fs;
+    copy_job_t *jobs;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t next;              // next job to hand out (under lock)
+    uint32_t failed;            // jobs that failed (under lock)
+    uint32_t dirs;              // directories recreated
+    uint8_t *visited;           // bitmap of directory inodes walked
+    pthread_mutex_t lock;
+} copy_plan_t;
+
+// One (srcpath, dstpath) pair from a batch manifest
+typedef struct {
+    char *src;
+    char *dst;
+} batch_pair_t;
+
+// Pairs read from the manifest, shared by the batch workers
+typedef struct {
+    minix_fs_t *fs;
+    batch_pair_t *pairs;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t next;              // next pair to hand out (under lock)
+    uint32_t failed;            // pairs that failed (under lock)
+    pthread_mutex_t lock;
+} batch_plan_t;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
 
 // Function prototypes
 void print_usage(const char *progname);
-int copy_file_data(const minix_inode_t *inode, FILE *dest_fp);
+int copy_to_path(minix_fs_t *fs, uint32_t inode_num, \
+    const minix_inode_t *inode, const char *dst_path);
+int extract_file(minix_fs_t *fs, const char *src_path, const char *dst_path);
+int extract_batch(minix_fs_t *fs, const char *manifest_path, int nworkers);
+int extract_tree(minix_fs_t *fs, const char *src_path, const char *dst_path, \
+    int nworkers);
 
 
 /**
  * Prints the usage message for minget.
  */
 void print_usage(const char *progname) {
-    fprintf(stderr, "usage: %s [-v] [-p part [-s subpart]] \
-    imagefile srcpath [dstpath]\n", progname);
+    fprintf(stderr, "usage: %s [-v] [-i io] [-c KiB] \
+[-p part [-s subpart]] imagefile srcpath [dstpath]\n", progname);
+    fprintf(stderr, \
+        "       %s [options] -b manifest [-j n] imagefile\n", progname);
+    fprintf(stderr, \
+        "       %s [options] -r [-j n] imagefile srcpath dstpath\n", progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -p <num>   select primary partition \
     for filesystem (default: none)\n");
     fprintf(stderr, "  -s <num>   select subpartition for \
     filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -c <KiB>   block cache size, \
+    0 to disable (default: 4096)\n");
     fprintf(stderr, "  -v         verbose. Print partition \
     table(s), superblock, and source inode to stderr.\n");
+    fprintf(stderr, "  -b <file>  batch: extract each \"srcpath dstpath\" \
+line of file ('-' for stdin)\n");
+    fprintf(stderr, "  -r         recursive: extract a directory tree \
+under dstpath\n");
+    fprintf(stderr, "  -j <n>     worker threads for -r and -b, at most %d \
+(default: number of CPUs)\n", MAX_WORKERS);
+    fprintf(stderr, "  -a <n>     read-ahead: keep up to n reads in flight \
+while writing, at most %d (default: 0, off)\n", MAX_READ_AHEAD);
+    fprintf(stderr, "  -T         read ahead with threads instead of \
+io_uring\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
     fprintf(stderr, "  -h         print usage information and exit\n");
 }
 
 /**
- * Copies the contents of the file described by the inode to the 
- * destination file pointer. Handles block translation, file size, 
- * and potential holes (zone 0).
+ * Copies the file described by the inode to dst_path (created if it
+ * doesn't exist, truncated if it does), or to stdout if dst_path is NULL.
+ * Returns 0 on success, -1 on failure.
+ */
+int copy_to_path(minix_fs_t *fs, uint32_t inode_num, \
+    const minix_inode_t *inode, const char *dst_path) {
+    int dest_fd = STDOUT_FILENO; // Default to stdout
+
+    if (dst_path) {
+// Open file for writing, create if it doesn't exist, truncate if it does.
+        dest_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (dest_fd < 0) {
+            fprintf(stderr, "Error opening destination file %s: %s\n", \
+                dst_path, strerror(errno));
+            return -1;
+        }
+    }
+    
+    int copy_status = copy_file_data(fs, inode_num, inode, dest_fd);
+
+    if (dst_path && close(dest_fd) != 0 && copy_status == 0) {
+        perror("Error closing destination file");
+        copy_status = -1;
+    }
+    return copy_status;
+}
+
+/**
+ * Extracts one regular file from the initialized filesystem to dst_path
+ * (stdout if dst_path is NULL). Errors are reported to stderr.
  * Returns 0 on success, -1 on failure.
  */
-int copy_file_data(const minix_inode_t *inode, FILE *dest_fp) {
-    // The total file size determines how many bytes we need to copy
-    uint32_t remaining_size = inode->size;
-    uint32_t curr_logical_block = 0;
+int extract_file(minix_fs_t *fs, const char *src_path, const char *dst_path) {
+    // 1) Canonicalize Path and Find Inode
+    char *canonical_src_path = canonicalize_path(src_path);
+    if (!canonical_src_path) {
+        fprintf(stderr, "Error: Failed to canonicalize path: %s\n",src_path);
+        return -1;
+    }
     
-    // Allocate a buffer the size of a block for efficient I/O
-    uint8_t *block_buf = (uint8_t *)malloc(curr_sb.blocksize);
-    if (!block_buf) {
-        perror("Error allocating buffer");
+    uint16_t src_mode;
+    uint32_t src_size;
+    uint32_t src_inode_num = stat_path(fs, canonical_src_path, &src_mode, \
+        &src_size);
+    if (src_inode_num == 0) {
+        fprintf(stderr, "minget: Can't find %s\n", canonical_src_path);
+        free(canonical_src_path);
+        return -1;
+    }
+
+    // 2) Check File Type (from the path index when there is one), then
+    // read the inode for the copy
+
+    // Check if it's a regular file (0100000 mask)
+    if ((src_mode & 0170000) != 0100000) {
+        fprintf(stderr, \
+        "minget: %s is not a regular file.\n", canonical_src_path);
+        free(canonical_src_path);
         return -1;
     }
 
-    if (verbose) {
-        fprintf(stderr,
-            "Starting copy. File size: %u bytes. Block size: %u.\n", 
-            remaining_size, curr_sb.blocksize);
+    minix_inode_t src_inode;
+    if (read_inode(fs, src_inode_num, &src_inode) != 0) {
+        fprintf(stderr, "minget: Failed to read inode %u.\n", src_inode_num);
+        free(canonical_src_path);
+        return -1;
+    }
+
+    if (fs->verbose) {
+        print_verbose_inode(src_inode_num, &src_inode);
     }
     
-    // Loop until all bytes are copied
-    while (remaining_size > 0) {
-        // 1) Get the disk block number for the current logical block
-        uint32_t disk_block_num = \
-        get_file_block(inode, curr_logical_block);
-
-        // Calculate how many bytes to read/write in this iteration
-        uint32_t bytes_to_copy = curr_sb.blocksize;
-        if (bytes_to_copy > remaining_size) {
-            bytes_to_copy = remaining_size;
-        }
-
-        if (disk_block_num == 0) {
-            // Zone 0 indicates a file hole: skip reading, write zeros.
-            if (verbose) {
-                fprintf(stderr, 
-                    "  [LBlock %u] Hole found. Writing %u zeros.\n",
-                    curr_logical_block, bytes_to_copy);
-            }
-            
-            // Set the buffer to zeros for the hole's content
-            memset(block_buf, 0, bytes_to_copy);
-            
-            // Write the zeroed data to the destination
-            if (fwrite(block_buf,1, bytes_to_copy, dest_fp) != bytes_to_copy){
-                perror("Error writing zero data for file hole");
-                free(block_buf);
-                return -1;
+    // 3) Copy Data to the destination
+    int copy_status = copy_to_path(fs, src_inode_num, &src_inode, dst_path);
+
+    free(canonical_src_path);
+    return copy_status;
+}
+
+/**
+ * Runs worker(arg) on nworkers threads, the calling thread being one of
+ * them, and waits for all of them. If threads can't be created the
+ * remaining work is done by the threads that did start.
+ * Returns the number of threads that ran the worker.
+ */
+static int run_workers(void *(*worker)(void *), void *arg, int nworkers) {
+    int started = 1;
+    int i;
+
+    if (nworkers < 1) nworkers = 1;
+    pthread_t *threads = malloc((size_t)nworkers * sizeof(pthread_t));
+    if (threads) {
+        for (i = 1; i < nworkers; i++) {
+            if (pthread_create(&threads[i], NULL, worker, arg) != 0) {
+                break;
             }
-        } else {
-            // Normal data block: read from disk and write to destination.
-            
-            // Calculate the disk offset (relative to FS start)
-            off_t disk_offset = (off_t)disk_block_num * curr_sb.blocksize;
-            
-            if (verbose) {
-                fprintf(stderr, \
-            "  [LBlock %u] Disk Block %u (Offset %ld). Copying %u bytes.\n",
-                    curr_logical_block, disk_block_num,
-                    fs_offset + disk_offset, bytes_to_copy);
+            started++;
+        }
+    }
+    worker(arg);
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return started;
+}
+
+/**
+ * Queues one manifest pair, copying both paths.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int add_batch_pair(batch_plan_t *plan, const char *src, \
+    const char *dst) {
+    if (plan->count == plan->cap) {
+        uint32_t new_cap = plan->cap ? plan->cap * 2 : 64;
+        batch_pair_t *grown = \
+            realloc(plan->pairs, new_cap * sizeof(batch_pair_t));
+        if (!grown) return -1;
+        plan->pairs = grown;
+        plan->cap = new_cap;
+    }
+    char *src_copy = strdup(src);
+    char *dst_copy = strdup(dst);
+    if (!src_copy || !dst_copy) {
+        free(src_copy);
+        free(dst_copy);
+        return -1;
+    }
+    plan->pairs[plan->count].src = src_copy;
+    plan->pairs[plan->count].dst = dst_copy;
+    plan->count++;
+    return 0;
+}
+
+/**
+ * Batch worker thread: extracts queued pairs until there are none left.
+ */
+static void *batch_worker(void *arg) {
+    batch_plan_t *plan = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&plan->lock);
+        uint32_t i = plan->next++;
+        pthread_mutex_unlock(&plan->lock);
+        if (i >= plan->count) break;
+
+        if (extract_file(plan->fs, plan->pairs[i].src, \
+            plan->pairs[i].dst) != 0) {
+            pthread_mutex_lock(&plan->lock);
+            plan->failed++;
+            pthread_mutex_unlock(&plan->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Extracts every (srcpath, dstpath) pair listed in the manifest, one
+ * pair per line, against the already initialized filesystem so all
+ * caches are shared. The two paths are separated by a tab, or by spaces
+ * if the line has no tab. Blank lines and lines starting with '#' are
+ * skipped. The manifest is read first, then the pairs are extracted on
+ * nworkers threads (so two lines naming the same dstpath race). A
+ * failed pair is reported and the batch carries on.
+ * Returns 0 if every pair was extracted, -1 otherwise.
+ */
+int extract_batch(minix_fs_t *fs, const char *manifest_path, int nworkers) {
+    FILE *manifest = stdin;
+    batch_plan_t plan;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    unsigned long line_num = 0;
+    unsigned long bad_lines = 0;
+    uint32_t i;
+
+    if (strcmp(manifest_path, "-") != 0) {
+        manifest = fopen(manifest_path, "r");
+        if (!manifest) {
+            perror("Error opening manifest");
+            return -1;
+        }
+    }
+
+    memset(&plan, 0, sizeof(plan));
+    plan.fs = fs;
+    pthread_mutex_init(&plan.lock, NULL);
+
+    // 1) Read every pair
+    while ((line_len = getline(&line, &line_cap, manifest)) != -1) {
+        line_num++;
+
+        // Strip the line ending
+        while (line_len > 0 && (line[line_len - 1] == '\n' || \
+            line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
+        }
+        char *src = line + strspn(line, " \t");
+        if (*src == '\0' || *src == '#') continue;
+
+        // Split into srcpath and dstpath
+        const char *seps = strchr(src, '\t') ? "\t" : " ";
+        char *dst = src + strcspn(src, seps);
+        if (*dst != '\0') {
+            *dst++ = '\0';
+            dst += strspn(dst, seps);
+        }
+        if (*dst == '\0') {
+            fprintf(stderr, \
+                "minget: manifest line %lu: missing dstpath\n", line_num);
+            bad_lines++;
+            continue;
+        }
+
+        if (add_batch_pair(&plan, src, dst) != 0) {
+            perror("minget: Error allocating manifest entry");
+            bad_lines++;
+            break;
+        }
+    }
+
+    if (ferror(manifest)) {
+        perror("Error reading manifest");
+        bad_lines++;
+    }
+    if (manifest != stdin) {
+        fclose(manifest);
+    }
+    free(line);
+
+    // 2) Extract them on the worker pool
+    if ((uint32_t)nworkers > plan.count) {
+        nworkers = plan.count > 0 ? (int)plan.count : 1;
+    }
+    int started = run_workers(batch_worker, &plan, nworkers);
+
+    if (fs->verbose) {
+        fprintf(stderr, "Batch: %lu extracted, %lu failed, %d workers.\n", \
+            (unsigned long)(plan.count - plan.failed), \
+            (unsigned long)plan.failed + bad_lines, started);
+    }
+
+    int status = (plan.failed == 0 && bad_lines == 0) ? 0 : -1;
+    for (i = 0; i < plan.count; i++) {
+        free(plan.pairs[i].src);
+        free(plan.pairs[i].dst);
+    }
+    free(plan.pairs);
+    pthread_mutex_destroy(&plan.lock);
+    return status;
+}
+
+/**
+ * Joins a directory path and an entry name. Returns a newly allocated
+ * string (caller must free), or NULL on allocation failure.
+ */
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + strlen(name) + 2);
+    if (!path) return NULL;
+    strcpy(path, dir);
+    if (dir_len == 0 || dir[dir_len - 1] != '/') {
+        path[dir_len++] = '/';
+    }
+    strcpy(path + dir_len, name);
+    return path;
+}
+
+/**
+ * Queues one regular file for the worker pool. Takes ownership of
+ * dst_path. Returns 0 on success, -1 on allocation failure.
+ */
+static int add_copy_job(copy_plan_t *plan, uint32_t inode_num, \
+    const minix_inode_t *inode, char *dst_path) {
+    if (plan->count == plan->cap) {
+        uint32_t new_cap = plan->cap ? plan->cap * 2 : 256;
+        copy_job_t *grown = realloc(plan->jobs, new_cap * sizeof(copy_job_t));
+        if (!grown) return -1;
+        plan->jobs = grown;
+        plan->cap = new_cap;
+    }
+    plan->jobs[plan->count].inode_num = inode_num;
+    plan->jobs[plan->count].inode = *inode;
+    plan->jobs[plan->count].dst_path = dst_path;
+    plan->count++;
+    return 0;
+}
+
+/**
+ * Recreates the directory at dst_path and walks its entries depth-first:
+ * subdirectories are created and walked in turn, regular files are
+ * queued as copy jobs. Anything else is skipped with a warning.
+ * Returns 0 on success, -1 if anything under this directory failed.
+ */
+static int collect_tree(copy_plan_t *plan, uint32_t dir_inode_num, \
+    const minix_inode_t *dir_inode, const char *dst_path) {
+    minix_dir_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint32_t i;
+    int status = 0;
+
+    // Hard-linked directories must not send us around in circles
+    if (plan->visited[dir_inode_num / 8] & (1 << (dir_inode_num % 8))) {
+        return 0;
+    }
+    plan->visited[dir_inode_num / 8] |= 1 << (dir_inode_num % 8);
+
+    // Keep the directory writable so its contents can be extracted
+    if (mkdir(dst_path, (dir_inode->mode & 0777) | 0700) != 0) {
+        struct stat st;
+        if (errno != EEXIST || stat(dst_path, &st) != 0 || \
+            !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Error creating directory %s: %s\n", \
+                dst_path, strerror(errno));
+            return -1;
+        }
+    }
+    plan->dirs++;
+
+    if (read_directory(plan->fs, dir_inode, &entries, &count, NULL) != 0) {
+        perror("minget: Error reading directory");
+        return -1;
+    }
+
+    // Fetch every entry's inode in one sorted pass
+    uint32_t *inode_nums = malloc((count ? count : 1) * sizeof(uint32_t));
+    minix_inode_t *inodes = malloc((count ? count : 1) * sizeof(minix_inode_t));
+    uint8_t *inode_ok = malloc(count ? count : 1);
+    if (!inode_nums || !inodes || !inode_ok) {
+        perror("minget: Error allocating directory entries");
+        free(inode_nums);
+        free(inodes);
+        free(inode_ok);
+        free(entries);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        inode_nums[i] = entries[i].inode;
+    }
+    if (read_inodes_bulk(plan->fs, inode_nums, count, inodes, inode_ok) != 0) {
+        memset(inode_ok, 0, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        char name[61];
+        strncpy(name, (char *)entries[i].name, 60);
+        name[60] = '\0';
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (name[0] == '\0' || strchr(name, '/') != NULL) {
+            fprintf(stderr, "minget: skipping bad entry name in %s\n", \
+                dst_path);
+            status = -1;
+            continue;
+        }
+        if (!inode_ok[i]) {
+            fprintf(stderr, "Error: Could not read inode %u for entry %s.\n",\
+                entries[i].inode, name);
+            status = -1;
+            continue;
+        }
+
+        char *child_path = join_path(dst_path, name);
+        if (!child_path) {
+            perror("minget: Error allocating path");
+            status = -1;
+            break;
+        }
+
+        uint16_t type = inodes[i].mode & 0170000;
+        if (type == 0040000) {
+            if (collect_tree(plan, entries[i].inode, &inodes[i], \
+                child_path) != 0) {
+                status = -1;
             }
-            
-            // Read the block from the disk image
-            if (read_fs_bytes(disk_offset, block_buf, \
-                curr_sb.blocksize) != 0) {
-                fprintf(stderr, "Error reading data block %u from image.\n", \
-                    disk_block_num);
-                free(block_buf);
-                return -1;
+            free(child_path);
+        } else if (type == 0100000) {
+            if (add_copy_job(plan, entries[i].inode, &inodes[i], \
+                child_path) != 0) {
+                perror("minget: Error allocating copy job");
+                free(child_path);
+                status = -1;
+                break;
             }
+        } else {
+            fprintf(stderr, \
+                "minget: skipping %s (not a regular file or directory)\n", \
+                child_path);
+            free(child_path);
+        }
+    }
 
-            // Write the data to the destination
-            if (fwrite(block_buf, 1, bytes_to_copy, \
-                dest_fp) != bytes_to_copy) {
-                perror("Error writing file data to destination");
-                free(block_buf);
-                return -1;
-            }
+    free(inode_nums);
+    free(inodes);
+    free(inode_ok);
+    free(entries);
+    return status;
+}
+
+/**
+ * Worker thread: takes queued copy jobs until there are none left.
+ */
+static void *copy_worker(void *arg) {
+    copy_plan_t *plan = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&plan->lock);
+        uint32_t i = plan->next++;
+        pthread_mutex_unlock(&plan->lock);
+        if (i >= plan->count) break;
+
+        if (copy_to_path(plan->fs, plan->jobs[i].inode_num, \
+            &plan->jobs[i].inode, plan->jobs[i].dst_path) != 0) {
+            pthread_mutex_lock(&plan->lock);
+            plan->failed++;
+            pthread_mutex_unlock(&plan->lock);
         }
+    }
+    return NULL;
+}
+
+/**
+ * Extracts src_path recursively to dst_path. The directory hierarchy is
+ * recreated first (single-threaded), then the file copies are spread
+ * across nworkers threads.
+ * Returns 0 if everything was extracted, -1 otherwise.
+ */
+int extract_tree(minix_fs_t *fs, const char *src_path, const char *dst_path, \
+    int nworkers) {
+    copy_plan_t plan;
+    int status = 0;
 
-        // Update loop variables
-        remaining_size -= bytes_to_copy;
-        curr_logical_block++;
+    char *canonical_src_path = canonicalize_path(src_path);
+    if (!canonical_src_path) {
+        fprintf(stderr, "Error: Failed to canonicalize path: %s\n",src_path);
+        return -1;
+    }
+    uint16_t src_mode;
+    uint32_t src_size;
+    uint32_t src_inode_num = stat_path(fs, canonical_src_path, &src_mode, \
+        &src_size);
+    if (src_inode_num == 0) {
+        fprintf(stderr, "minget: Can't find %s\n", canonical_src_path);
+        free(canonical_src_path);
+        return -1;
+    }
+    if ((src_mode & 0170000) != 0100000 && (src_mode & 0170000) != 0040000) {
+        fprintf(stderr, "minget: %s is not a regular file or directory.\n", \
+            canonical_src_path);
+        free(canonical_src_path);
+        return -1;
+    }
+    minix_inode_t src_inode;
+    if (read_inode(fs, src_inode_num, &src_inode) != 0) {
+        fprintf(stderr, "minget: Failed to read inode %u.\n", src_inode_num);
+        free(canonical_src_path);
+        return -1;
     }
 
-    free(block_buf);
-    return 0;
+    // A regular file is simply copied, like cp -r does
+    if ((src_mode & 0170000) == 0100000) {
+        free(canonical_src_path);
+        return copy_to_path(fs, src_inode_num, &src_inode, dst_path);
+    }
+    free(canonical_src_path);
+
+    memset(&plan, 0, sizeof(plan));
+    plan.fs = fs;
+    pthread_mutex_init(&plan.lock, NULL);
+    plan.visited = calloc((size_t)fs->sb.ninodes / 8 + 1, 1);
+    if (!plan.visited) {
+        perror("minget: Error allocating directory map");
+        return -1;
+    }
+
+    // 1) Recreate the hierarchy and queue every regular file
+    if (collect_tree(&plan, src_inode_num, &src_inode, dst_path) != 0) {
+        status = -1;
+    }
+
+    // 2) Copy the files on the worker pool (the calling thread is one
+    // of the workers)
+    if ((uint32_t)nworkers > plan.count) {
+        nworkers = plan.count > 0 ? (int)plan.count : 1;
+    }
+    int started = run_workers(copy_worker, &plan, nworkers);
+
+    if (plan.failed > 0) status = -1;
+    if (fs->verbose) {
+        fprintf(stderr, \
+            "Recursive: %u directories, %u files, %u failed, %d workers.\n", \
+            plan.dirs, plan.count, plan.failed, started);
+    }
+
+    for (uint32_t j = 0; j < plan.count; j++) {
+        free(plan.jobs[j].dst_path);
+    }
+    free(plan.jobs);
+    free(plan.visited);
+    pthread_mutex_destroy(&plan.lock);
+    return status;
 }
 
 /**
  * Main function for minget
  */
 int main(int argc, char *argv[]) {
-    int p_num = -1, s_num = -1, verbose_flag = 0;
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
     char *image_file = NULL;
     char *src_path = NULL;
     char *dst_path = NULL;
+    char *manifest_path = NULL;
+    int recursive = 0;
+    int nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long depth;
+    char *end;
     int opt;
 
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+
     // 1) Parse Arguments
-    while ((opt = getopt(argc, argv, "p:s:vh")) != -1) {
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:b:rj:a:Tvh", \
+        long_options, NULL)) != -1) {
         switch (opt) {
             case 'p':
                 p_num = atoi(optarg);
@@ -140,8 +638,56 @@ int main(int argc, char *argv[]) {
             case 's':
                 s_num = atoi(optarg);
                 break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'b':
+                manifest_path = optarg;
+                break;
+            case 'r':
+                recursive = 1;
+                break;
+            case 'j':
+                nworkers = atoi(optarg);
+                if (nworkers < 1) {
+                    fprintf(stderr, "Error: -j needs at least 1 thread.\n");
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+                break;
+            case 'a':
+                depth = strtoul(optarg, &end, 10);
+                if (!isdigit((unsigned char)optarg[0]) || *end != '\0' || \
+                    depth > MAX_READ_AHEAD) {
+                    fprintf(stderr, "Error: -a needs a number from 0 to \
+%d.\n", MAX_READ_AHEAD);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                opts.read_ahead = (uint32_t)depth;
+                break;
+            case 'T':
+                opts.read_ahead_threads = 1;
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
             case 'v':
-                verbose_flag = 1;
+                opts.verbose = 1;
                 break;
             case 'h':
                 print_usage(argv[0]);
@@ -152,98 +698,59 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Check for required arguments: imagefile and srcpath
-    if (argc - optind < 2) {
-        fprintf(stderr, "Error: Missing required arguments \
-            (imagefile, srcpath).\n");
+    if (manifest_path && recursive) {
+        fprintf(stderr, "Error: -b and -r can't be used together.\n");
         print_usage(argv[0]);
         return 1;
     }
 
-    image_file = argv[optind++];
-    src_path = argv[optind++];
-    
-    // Optional argument: dstpath
-    if (argc - optind >= 1) {
-        dst_path = argv[optind];
-    }
-
-    // 2) Filesystem Initialization
-    if (init_filesystem(image_file, p_num, s_num, verbose_flag) != 0) {
-        cleanup_filesystem();
+    // Check for required arguments: imagefile and srcpath (the manifest
+    // takes the place of srcpath in batch mode)
+    if (argc - optind < (manifest_path ? 1 : 2)) {
+        fprintf(stderr, "Error: Missing required arguments \
+            (imagefile, srcpath).\n");
+        print_usage(argv[0]);
         return 1;
     }
 
-    // 3) Canonicalize Path and Find Inode
-    char *canonical_src_path = canonicalize_path(src_path);
-    if (!canonical_src_path) {
-        fprintf(stderr, "Error: Failed to canonicalize path: %s\n",src_path);
-        cleanup_filesystem();
+    image_file = argv[optind++];
+    if (manifest_path && optind < argc) {
+        fprintf(stderr, "Error: -b takes no paths after the imagefile \
+(they come from the manifest).\n");
+        print_usage(argv[0]);
         return 1;
     }
+    if (!manifest_path) {
+        src_path = argv[optind++];
     
-    uint32_t src_inode_num = get_inode_by_path(canonical_src_path);
-    if (src_inode_num == 0) {
-        fprintf(stderr, "minget: Can't find %s\n", canonical_src_path);
-        free(canonical_src_path);
-        cleanup_filesystem();
-        return 1;
+        // Optional argument: dstpath (required for -r)
+        if (argc - optind >= 1) {
+            dst_path = argv[optind];
+        } else if (recursive) {
+            fprintf(stderr, "Error: -r requires a dstpath.\n");
+            print_usage(argv[0]);
+            return 1;
+        }
     }
 
-    // 4) Read Inode and Check File Type
-    minix_inode_t src_inode;
-    if (read_inode(src_inode_num, &src_inode) != 0) {
-        fprintf(stderr, "minget: Failed to read inode %u.\n", src_inode_num);
-        free(canonical_src_path);
-        cleanup_filesystem();
+    // 2) Filesystem Initialization
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
         return 1;
     }
 
-    // Check if it's a regular file (0100000 mask)
-    if ((src_inode.mode & 0170000) != 0100000) {
-        fprintf(stderr, \
-        "minget: %s is not a regular file.\n", canonical_src_path);
-        free(canonical_src_path);
-        cleanup_filesystem();
-        return 1;
+    // 3) Extract the single file, the tree, or every pair in the manifest
+    int status;
+    if (manifest_path) {
+        status = extract_batch(fs, manifest_path, nworkers);
+    } else if (recursive) {
+        status = extract_tree(fs, src_path, dst_path, nworkers);
+    } else {
+        status = extract_file(fs, src_path, dst_path);
     }
 
-    if (verbose_flag) {
-        print_verbose_inode(src_inode_num, &src_inode);
-    }
-    
-    // 5) Open Destination
-    FILE *dest_fp = stdout; // Default to stdout
-    int file_descriptor = -1;
+    // 4) Cleanup
+    cleanup_filesystem(fs);
 
-    if (dst_path) {
-// Open file for writing, create if it doesn't exist, truncate if it does.
-        file_descriptor = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        if (file_descriptor < 0) {
-            perror("Error opening destination file");
-            free(canonical_src_path);
-            cleanup_filesystem();
-            return 1;
-        }
-        dest_fp = fdopen(file_descriptor, "w");
-        if (!dest_fp) {
-            perror("Error associating file descriptor with stream");
-            close(file_descriptor);
-            free(canonical_src_path);
-            cleanup_filesystem();
-            return 1;
-        }
-    }
-    
-    // 6) Copy Data 
-    int copy_status = copy_file_data(&src_inode, dest_fp);
-
-    // 7) Cleanup
-    if (dst_path) {
-        fclose(dest_fp);
-    }
-    free(canonical_src_path);
-    cleanup_filesystem();
-
-    return (copy_status == 0) ? 0 : 1;
-}
\ No newline at end of file
+    return (status == 0) ? 0 : 1;
+}
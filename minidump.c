@@ -0,0 +1,283 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+
+// Output is collected here and written in large chunks
+#define OUT_BUF_SIZE (1024 * 1024)
+
+// Longest NDJSON line: 18 numbers of at most 11 characters plus keys
+#define MAX_JSON_LINE 512
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len = 0;
+static int out_fd = STDOUT_FILENO;
+static int out_failed = 0;      // set if writing the output failed
+
+// Output formats (-f)
+typedef enum {
+    OUT_FORMAT_JSON = 0,        // one JSON object per inode (NDJSON)
+    OUT_FORMAT_BIN              // minidump_record_t records, see fs_util.h
+} out_format_t;
+
+// What dump_batch needs, passed through scan_inode_table
+typedef struct {
+    out_format_t format;
+    uint64_t dumped;
+} dump_state_t;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+
+
+/**
+ * Prints the usage message for minidump.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-f fmt] [-o outfile] [-i io] \
+[-p part [-s subpart]] imagefile\n", progname);
+    fprintf(stderr, "Dumps every allocated inode, straight from the \
+inode table.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -f <fmt>   output format: json (NDJSON) or bin \
+(default: json)\n");
+    fprintf(stderr, "  -o <file>  write to file instead of stdout\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock and the \
+inode count to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Writes out the output buffer.
+ */
+static void out_flush(void) {
+    if (out_failed == 0 && write_all(out_fd, out_buf, out_len) != 0) {
+        perror("minidump: Error writing output");
+        out_failed = 1;
+    }
+    out_len = 0;
+}
+
+/**
+ * Appends the decimal digits of v at p. Returns the end of them.
+ */
+static char *put_u32(char *p, uint32_t v) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) *p++ = digits[--n];
+    return p;
+}
+
+/**
+ * Appends v (which may be negative) at p. Returns the end of it.
+ */
+static char *put_i32(char *p, int32_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return put_u32(p, (uint32_t)0 - (uint32_t)v);
+    }
+    return put_u32(p, (uint32_t)v);
+}
+
+/**
+ * Appends a string literal (no terminator) at p. Returns the end of it.
+ */
+static char *put_str(char *p, const char *s) {
+    size_t len = strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/**
+ * Formats one inode as a JSON line straight into the output buffer
+ * (snprintf would cost more than reading the inode did).
+ */
+static void out_json_inode(uint32_t inode_num, const minix_inode_t *inode) {
+    if (OUT_BUF_SIZE - out_len < MAX_JSON_LINE) out_flush();
+    char *p = out_buf + out_len;
+
+    p = put_str(p, "{\"inode\":");
+    p = put_u32(p, inode_num);
+    p = put_str(p, ",\"mode\":");
+    p = put_u32(p, inode->mode);
+    p = put_str(p, ",\"links\":");
+    p = put_u32(p, inode->links);
+    p = put_str(p, ",\"uid\":");
+    p = put_u32(p, inode->uid);
+    p = put_str(p, ",\"gid\":");
+    p = put_u32(p, inode->gid);
+    p = put_str(p, ",\"size\":");
+    p = put_u32(p, inode->size);
+    p = put_str(p, ",\"atime\":");
+    p = put_i32(p, inode->atime);
+    p = put_str(p, ",\"mtime\":");
+    p = put_i32(p, inode->mtime);
+    p = put_str(p, ",\"ctime\":");
+    p = put_i32(p, inode->ctime);
+    p = put_str(p, ",\"zone\":[");
+    for (int i = 0; i < DIRECT_ZONES; i++) {
+        if (i > 0) *p++ = ',';
+        p = put_u32(p, inode->zone[i]);
+    }
+    p = put_str(p, "],\"indirect\":");
+    p = put_u32(p, inode->indirect);
+    p = put_str(p, ",\"two_indirect\":");
+    p = put_u32(p, inode->two_indirect);
+    p = put_str(p, "}\n");
+
+    out_len = (size_t)(p - out_buf);
+}
+
+/**
+ * scan_inode_table callback: formats one batch of inodes.
+ * Returns 0 to go on, 1 to stop once writing has failed.
+ */
+static int dump_batch(void *arg, const uint32_t *inode_nums, \
+    const minix_inode_t *inodes, uint32_t count) {
+    dump_state_t *st = arg;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (st->format == OUT_FORMAT_JSON) {
+            out_json_inode(inode_nums[i], &inodes[i]);
+            continue;
+        }
+        minidump_record_t rec;
+        if (OUT_BUF_SIZE - out_len < sizeof(rec)) out_flush();
+        rec.inode_num = inode_nums[i];
+        rec.inode = inodes[i];
+        memcpy(out_buf + out_len, &rec, sizeof(rec));
+        out_len += sizeof(rec);
+    }
+    st->dumped += count;
+    return out_failed;
+}
+
+/**
+ * Main function for minidump
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
+    char *image_file = NULL;
+    char *out_file = NULL;
+    dump_state_t st = { OUT_FORMAT_JSON, 0 };
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:f:o:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0) {
+                    st.format = OUT_FORMAT_JSON;
+                } else if (strcmp(optarg, "bin") == 0) {
+                    st.format = OUT_FORMAT_BIN;
+                } else {
+                    fprintf(stderr, "Error: Unknown output format '%s'.\n", \
+                        optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    image_file = argv[optind];
+
+    // 2) Open the filesystem; only the inode table is read, in pieces
+    // larger than the block cache would keep
+    opts.path_index = "";
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
+        return 1;
+    }
+
+    if (out_file) {
+        out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            perror("Error opening output file");
+            cleanup_filesystem(fs);
+            return 1;
+        }
+    }
+
+    // 3) Dump the inodes
+    if (st.format == OUT_FORMAT_BIN) {
+        memcpy(out_buf, MINIDUMP_MAGIC, 8);
+        out_len = 8;
+    }
+    int status = scan_inode_table(fs, dump_batch, &st);
+    out_flush();
+    if (opts.verbose) {
+        fprintf(stderr, "%llu inodes dumped\n", \
+            (unsigned long long)st.dumped);
+    }
+
+    // 4) Cleanup
+    if (out_file && close(out_fd) != 0) {
+        perror("Error closing output file");
+        out_failed = 1;
+    }
+    cleanup_filesystem(fs);
+
+    return (status == 0 && !out_failed) ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+
+
+/**
+ * Prints the usage message for minidx.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-i io] [-c KiB] \
+[-p part [-s subpart]] [-o indexfile] imagefile\n", progname);
+    fprintf(stderr, "Builds the path index minls, minget and minsrv use \
+to skip directory walks.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -c <KiB>   block cache size, \
+    0 to disable (default: 4096)\n");
+    fprintf(stderr, "  -o <file>  index file to write \
+(default: imagefile.midx)\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock and \
+index statistics to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Main function for minidx
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
+    char *image_file = NULL;
+    char *index_file = NULL;
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:o:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                index_file = optarg;
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    image_file = argv[optind];
+
+    // 2) Open the filesystem, ignoring any existing index: the new one
+    // must come from the directories themselves
+    opts.path_index = "";
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
+        return 1;
+    }
+
+    // 3) Walk it and write the index
+    int status = build_path_index(fs, image_file, index_file);
+
+    // 4) Cleanup
+    cleanup_filesystem(fs);
+
+    return (status == 0) ? 0 : 1;
+}
@@ -6,92 +6,372 @@
 #include <getopt.h>
 
 
+// A directory entry collected for listing, in on-disk order
+typedef struct {
+    uint32_t inode_num;
+    char name[61];
+} dir_listing_entry_t;
+
+// Listing output is collected here and written in large chunks
+#define OUT_BUF_SIZE (1024 * 1024)
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len = 0;
+static int out_failed = 0;      // set if writing to stdout failed
+
+// Output formats (-f)
+typedef enum {
+    OUT_FORMAT_TEXT = 0,        // the classic "%s %9u %s" lines
+    OUT_FORMAT_JSON,            // one JSON object per line (NDJSON)
+    OUT_FORMAT_BIN              // minls_record_t records, see fs_util.h
+} out_format_t;
+
+static out_format_t out_format = OUT_FORMAT_TEXT;
+
+// Recursive listing (-R) state
+static int recursive_flag = 0;
+static int prefetch_flag = 0;   // -P: prefetch child directory blocks
+static uint8_t *visited_dirs = NULL; // bitmap of directory inodes listed
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
 // Function prototypes
 void print_usage(const char *progname);
-void list_single_entry(uint32_t entry_inode_num, const char *name);
-int list_directory_contents(uint32_t dir_inode_num, const char *dir_path);
+void print_entry(uint32_t inode_num, const minix_inode_t *entry_inode, \
+    const char *dir, const char *name);
+void print_dir_header(uint32_t inode_num, const minix_inode_t *dir_inode, \
+    const char *dir_path);
+void list_single_entry(minix_fs_t *fs, uint32_t entry_inode_num, \
+    const char *dir, const char *name);
+int list_directory_contents(minix_fs_t *fs, uint32_t dir_inode_num, \
+    const char *dir_path);
 
 
 /**
  * Prints the usage message for minls.
  */
 void print_usage(const char *progname) {
-    fprintf(stderr, \
-    "usage: %s [-v] [-p part [-s subpart]] imagefile [path]\n", progname);
+    fprintf(stderr, "usage: %s [-v] [-R [-P]] [-f fmt] [-i io] [-c KiB] \
+[-p part [-s subpart]] imagefile [path]\n", progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, \
     " -p <num>  select primary partition for filesystem (default: none)\n");
     fprintf(stderr, \
     " -s <num>  select subpartition for filesystem (default: none)\n");
+    fprintf(stderr, \
+    " -i <io>   image I/O backend: pread or mmap (default: pread)\n");
+    fprintf(stderr, \
+    " -c <KiB>  block cache size, 0 to disable (default: 4096)\n");
     fprintf(stderr, " -v     verbose. Print partition table(s), \
     superblock, and source inode to stderr.\n");
+    fprintf(stderr, " -R     list subdirectories recursively\n");
+    fprintf(stderr, \
+    " -P     with -R, prefetch child directory blocks while listing\n");
+    fprintf(stderr, \
+    " -f <fmt>  output format: text, json (NDJSON) or bin (default: text)\n");
+    fprintf(stderr, \
+    " --stats[=fmt]  print I/O and lookup counters at exit (text or json)\n");
     fprintf(stderr, " -h     print usage information and exit\n");
 }
 
+/**
+ * Writes out everything buffered so far.
+ */
+static void out_flush(void) {
+    size_t done = 0;
+    while (done < out_len && !out_failed) {
+        ssize_t n = write(STDOUT_FILENO, out_buf + done, out_len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("minls: Error writing output");
+            out_failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    out_len = 0;
+}
+
+/**
+ * Appends bytes to the output buffer, flushing it when full.
+ */
+static void out_write(const char *data, size_t len) {
+    while (len > 0) {
+        if (out_len == OUT_BUF_SIZE) out_flush();
+        size_t chunk = OUT_BUF_SIZE - out_len;
+        if (chunk > len) chunk = len;
+        memcpy(out_buf + out_len, data, chunk);
+        out_len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void out_str(const char *str) {
+    out_write(str, strlen(str));
+}
+
+/**
+ * Appends a JSON string literal, escaping quotes, backslashes, control
+ * characters and bytes above 0x7f. Names are bytes, not UTF-8, so each
+ * high byte becomes \u00XX: the output is always valid JSON and the
+ * name can be recovered byte for byte.
+ */
+static void out_json_str(const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = str;
+
+    out_write("\"", 1);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') continue;
+
+        out_write(run, (size_t)(str - run));
+        run = str + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            out_write(esc, 2);
+        } else {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            out_write(esc, 6);
+        }
+    }
+    out_write(run, (size_t)(str - run));
+    out_write("\"", 1);
+}
+
+/**
+ * Appends one binary record and its name.
+ */
+static void out_record(uint16_t type, uint32_t inode_num, \
+    const minix_inode_t *inode, const char *name) {
+    minls_record_t rec;
+    size_t name_len = strlen(name);
+
+    rec.type = type;
+    rec.pad = 0;
+    rec.name_len = (uint32_t)name_len;
+    rec.inode = inode_num;
+    rec.mode = inode->mode;
+    rec.links = inode->links;
+    rec.uid = inode->uid;
+    rec.gid = inode->gid;
+    rec.size = inode->size;
+    rec.atime = inode->atime;
+    rec.mtime = inode->mtime;
+    rec.ctime = inode->ctime;
+    out_write((const char *)&rec, sizeof(rec));
+    out_write(name, name_len);
+}
+
+/**
+ * Prints the "path:" line (or record) that starts a directory listing.
+ */
+void print_dir_header(uint32_t inode_num, const minix_inode_t *dir_inode, \
+    const char *dir_path) {
+    if (out_format == OUT_FORMAT_TEXT) {
+        out_str(dir_path);
+        out_write(":\n", 2);
+    } else if (out_format == OUT_FORMAT_BIN) {
+        out_record(MINLS_REC_DIR, inode_num, dir_inode, dir_path);
+    }
+    // NDJSON has no headers: every object carries its directory
+}
+
+/**
+ * Prints one listing line (or record) for an inode that has already been
+ * read. dir is the directory it was listed from; the text format only
+ * shows the name.
+ */
+void print_entry(uint32_t inode_num, const minix_inode_t *entry_inode, \
+    const char *dir, const char *name) {
+    if (out_format == OUT_FORMAT_JSON) {
+        char fields[192];
+        int len = snprintf(fields, sizeof(fields), ",\"inode\":%u,\
+\"mode\":%u,\"links\":%u,\"uid\":%u,\"gid\":%u,\"size\":%u,\"atime\":%d,\
+\"mtime\":%d,\"ctime\":%d}\n", inode_num, entry_inode->mode, \
+            entry_inode->links, entry_inode->uid, entry_inode->gid, \
+            entry_inode->size, entry_inode->atime, entry_inode->mtime, \
+            entry_inode->ctime);
+
+        out_write("{\"dir\":", 7);
+        out_json_str(dir);
+        out_write(",\"name\":", 8);
+        out_json_str(name);
+        out_write(fields, (size_t)len);
+        return;
+    }
+    if (out_format == OUT_FORMAT_BIN) {
+        out_record(MINLS_REC_ENTRY, inode_num, entry_inode, name);
+        return;
+    }
+
+    char line[11 + 1 + 10 + 1];
+    char digits[10];
+    int ndigits = 0;
+    uint32_t size = entry_inode->size;
+
+    // Get the formatted permissions string
+    get_permissions_string(entry_inode->mode, line);
+
+    // Output format: [permissions] [size] [filename]
+    // The size field must be right-justified to 9 bits, 
+    // with a space on either side (same as "%s %9u %s\n").
+    do {
+        digits[ndigits++] = (char)('0' + size % 10);
+        size /= 10;
+    } while (size > 0);
+
+    char *p = line + 10;
+    *p++ = ' ';
+    for (int pad = ndigits; pad < 9; pad++) *p++ = ' ';
+    while (ndigits > 0) *p++ = digits[--ndigits];
+    *p++ = ' ';
+
+    out_write(line, (size_t)(p - line));
+    out_str(name);
+    out_write("\n", 1);
+}
+
 /**
  * Lists the information for a single file or directory entry.
- * This is used for listing the target file itself (if it's not a directory),
- * or for each entry inside a directory.
+ * This is used for listing the target file itself (if it's not a directory).
  */
-void list_single_entry(uint32_t entry_inode_num, const char *name) {
+void list_single_entry(minix_fs_t *fs, uint32_t entry_inode_num, \
+    const char *dir, const char *name) {
     minix_inode_t entry_inode;
-    char perm_str[11];
 
-    if (read_inode(entry_inode_num, &entry_inode) != 0) {
+    if (read_inode(fs, entry_inode_num, &entry_inode) != 0) {
+        out_flush();
         fprintf(stderr, "Error: Could not read inode %u for entry %s.\n", \
             entry_inode_num, name);
         return;
     }
 
-    // Get the formatted permissions string
-    get_permissions_string(entry_inode.mode, perm_str);
+    print_entry(entry_inode_num, &entry_inode, dir, name);
+}
 
-    // Output format: [permissions] [size] [filename]
-    // The size field must be right-justified to 9 bits, 
-    // with a space on either side.
-    printf("%s %9u %s\n", perm_str, entry_inode.size, name);
+/**
+ * Appends an entry to a growable listing array.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int add_listing_entry(dir_listing_entry_t **entries, uint32_t *count, \
+    uint32_t *cap, uint32_t inode_num, const unsigned char *name) {
+    if (*count == *cap) {
+        uint32_t new_cap = *cap ? *cap * 2 : 64;
+        dir_listing_entry_t *grown = \
+            realloc(*entries, new_cap * sizeof(dir_listing_entry_t));
+        if (!grown) return -1;
+        *entries = grown;
+        *cap = new_cap;
+    }
+
+// Directory entry names are 60 bytes, often not null-terminated perfectly
+// Copy the name to ensure it is null-terminated before printing
+    (*entries)[*count].inode_num = inode_num;
+    strncpy((*entries)[*count].name, (const char *)name, 60);
+    (*entries)[*count].name[60] = '\0';
+    (*count)++;
+    return 0;
+}
+
+/**
+ * Returns 1 if a listed entry is a subdirectory to descend into with -R
+ * (a readable directory inode other than "." and "..").
+ */
+static int is_child_dir(const dir_listing_entry_t *entry, \
+    const minix_inode_t *inode, uint8_t inode_ok) {
+    return inode_ok && (inode->mode & 0170000) == 0040000 && \
+        strcmp(entry->name, ".") != 0 && strcmp(entry->name, "..") != 0;
+}
+
+/**
+ * Asks the I/O layer to prefetch the data blocks of every subdirectory
+ * in a listing.
+ */
+static void prefetch_child_dirs(minix_fs_t *fs, \
+    const dir_listing_entry_t *entries, const minix_inode_t *inodes, \
+    const uint8_t *inode_ok, uint32_t count) {
+    uint32_t i;
+    uint32_t k;
+
+    for (i = 0; i < count; i++) {
+        file_extent_t *extents = NULL;
+        uint32_t extent_count = 0;
+
+        if (!is_child_dir(&entries[i], &inodes[i], inode_ok[i]) || \
+            build_extent_map(fs, &inodes[i], &extents, &extent_count) != 0) {
+            continue;
+        }
+        for (k = 0; k < extent_count; k++) {
+            if (extents[k].hole) continue;
+            prefetch_fs_bytes(fs, \
+                (off_t)extents[k].physical * fs->sb.blocksize, \
+                (size_t)extents[k].length * fs->sb.blocksize);
+        }
+        free(extents);
+    }
 }
 
 /**
  * Iterates through the blocks of a directory inode and prints the contents.
+ * With -R, every subdirectory is then listed the same way, separated by
+ * a blank line.
  * Returns 0 on success, -1 on failure.
  */
-int list_directory_contents(uint32_t dir_inode_num, const char *dir_path) {
+int list_directory_contents(minix_fs_t *fs, uint32_t dir_inode_num, \
+    const char *dir_path) {
     minix_inode_t dir_inode;
     uint32_t i;
     uint32_t j;
-    if (read_inode(dir_inode_num, &dir_inode) != 0) {
+    if (read_inode(fs, dir_inode_num, &dir_inode) != 0) {
+        out_flush();
         fprintf(stderr, "minls: Failed to read directory inode %u.\n", \
             dir_inode_num);
         return -1;
     }
 
-    printf("%s:\n", dir_path);
+    if (out_format == OUT_FORMAT_TEXT) {
+        print_dir_header(dir_inode_num, &dir_inode, dir_path);
+    }
     
     // Check if it's actually a directory
     if ((dir_inode.mode & 0170000) != 0040000) { 
+        out_flush();
         fprintf(stderr, "minls: %s is not a directory.\n", dir_path);
         return -1;
     }
+    if (out_format != OUT_FORMAT_TEXT) {
+        print_dir_header(dir_inode_num, &dir_inode, dir_path);
+    }
+
+    // 1) Collect the live entries of every directory block, in order
+    dir_listing_entry_t *entries = NULL;
+    uint32_t count = 0;
+    uint32_t cap = 0;
 
-    // Loop through all blocks of the directory file
-    for (i = 0; i * curr_sb.blocksize < dir_inode.size; i++) {
-        uint32_t disk_block = get_file_block(&dir_inode, i);
+    for (i = 0; i * fs->sb.blocksize < dir_inode.size; i++) {
+        uint32_t disk_block = get_file_block(fs, &dir_inode, i);
         if (disk_block == 0) continue; // Skip file holes
 
-        off_t block_offset = (off_t)disk_block * curr_sb.blocksize;
+        off_t block_offset = (off_t)disk_block * fs->sb.blocksize;
 
         // Read block content into a buffer for directory entries
-        uint8_t dir_block_buf[curr_sb.blocksize];
-        if (read_fs_bytes(block_offset, dir_block_buf, \
-            curr_sb.blocksize) != 0) {
+        uint8_t dir_block_buf[fs->sb.blocksize];
+        if (read_fs_bytes(fs, block_offset, dir_block_buf, \
+            fs->sb.blocksize) != 0) {
+            out_flush();
             fprintf(stderr, \
             "minls: Error reading directory data block %u.\n", disk_block);
             continue;
         }
 
         // Loop through directory entries in the block
-        uint32_t entries_per_block = curr_sb.blocksize / DIR_ENTRY_SIZE;
+        uint32_t entries_per_block = fs->sb.blocksize / DIR_ENTRY_SIZE;
         for (j = 0; j < entries_per_block; j++) {
             // Cast the buffer section to the entry structure
             minix_dir_entry_t *entry = \
@@ -99,31 +379,113 @@ int list_directory_contents(uint32_t dir_inode_num, const char *dir_path) {
 
             if (entry->inode == 0) continue; // Skip deleted/invalid entries
 
-// Directory entry names are 60 bytes, often not null-terminated perfectly
-// Copy the name to ensure it is null-terminated before 
-// passing to list_single_entry
-            char entry_name[61];
-            strncpy(entry_name, (char*)entry->name, 60);
-            entry_name[60] = '\0';
+            if (add_listing_entry(&entries, &count, &cap, \
+                entry->inode, entry->name) != 0) {
+                perror("minls: Error allocating directory listing");
+                free(entries);
+                return -1;
+            }
+        }
+    }
+
+    // 2) Fetch all their inodes in one sorted pass over the inode table
+    uint32_t *inode_nums = malloc((count ? count : 1) * sizeof(uint32_t));
+    minix_inode_t *inodes = malloc((count ? count : 1) * sizeof(minix_inode_t));
+    uint8_t *inode_ok = malloc(count ? count : 1);
+    if (!inode_nums || !inodes || !inode_ok) {
+        perror("minls: Error allocating directory listing");
+        free(inode_nums);
+        free(inodes);
+        free(inode_ok);
+        free(entries);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        inode_nums[i] = entries[i].inode_num;
+    }
+    if (read_inodes_bulk(fs, inode_nums, count, inodes, inode_ok) != 0) {
+        perror("minls: Error reading directory inodes");
+        free(inode_nums);
+        free(inodes);
+        free(inode_ok);
+        free(entries);
+        return -1;
+    }
 
-            list_single_entry(entry->inode, entry_name);
+    // 3) With -P, start reading the child directories' blocks now, so
+    // they are in memory by the time the recursion gets to them
+    if (recursive_flag && prefetch_flag) {
+        prefetch_child_dirs(fs, entries, inodes, inode_ok, count);
+    }
+
+    // 4) Format the output in on-disk entry order
+    for (i = 0; i < count; i++) {
+        if (!inode_ok[i]) {
+            out_flush();
+            fprintf(stderr, "Error: Could not read inode %u for entry %s.\n",\
+                entries[i].inode_num, entries[i].name);
+            continue;
         }
+        print_entry(entries[i].inode_num, &inodes[i], dir_path, \
+            entries[i].name);
     }
 
-    return 0;
+    // 5) With -R, list each subdirectory in turn, in entry order
+    int status = 0;
+    if (recursive_flag) {
+        visited_dirs[dir_inode_num / 8] |= 1 << (dir_inode_num % 8);
+
+        for (i = 0; i < count; i++) {
+            uint32_t child = entries[i].inode_num;
+            if (!is_child_dir(&entries[i], &inodes[i], inode_ok[i]) || \
+                (visited_dirs[child / 8] & (1 << (child % 8)))) {
+                continue;
+            }
+
+            size_t path_len = strlen(dir_path);
+            char *child_path = malloc(path_len + strlen(entries[i].name) + 2);
+            if (!child_path) {
+                out_flush();
+                perror("minls: Error allocating path");
+                status = -1;
+                break;
+            }
+            strcpy(child_path, dir_path);
+            if (path_len == 0 || dir_path[path_len - 1] != '/') {
+                child_path[path_len++] = '/';
+            }
+            strcpy(child_path + path_len, entries[i].name);
+
+            if (out_format == OUT_FORMAT_TEXT) out_write("\n", 1);
+            if (list_directory_contents(fs, child, child_path) != 0) {
+                status = -1;
+            }
+            free(child_path);
+        }
+    }
+
+    free(inode_nums);
+    free(inodes);
+    free(inode_ok);
+    free(entries);
+    return status;
 }
 
 /**
  * Main function for minls.
  */
 int main(int argc, char *argv[]) {
-    int p_num = -1, s_num = -1, verbose_flag = 0;
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
     char *image_file = NULL;
     char *src_path = "/"; // Default path to root directory
     int opt;
 
     // ~~~ 1) Parse Arguments
-    while ((opt = getopt(argc, argv, "p:s:vh")) != -1) {
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:f:RPvh", \
+        long_options, NULL)) != -1) {
         switch (opt) {
             case 'p':
                 p_num = atoi(optarg);
@@ -131,8 +493,47 @@ int main(int argc, char *argv[]) {
             case 's':
                 s_num = atoi(optarg);
                 break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    out_format = OUT_FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    out_format = OUT_FORMAT_JSON;
+                } else if (strcmp(optarg, "bin") == 0) {
+                    out_format = OUT_FORMAT_BIN;
+                } else {
+                    fprintf(stderr, "minls: unknown output format %s\n", \
+                        optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                recursive_flag = 1;
+                break;
+            case 'P':
+                prefetch_flag = 1;
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
             case 'v':
-                verbose_flag = 1;
+                opts.verbose = 1;
                 break;
             case 'h':
                 print_usage(argv[0]);
@@ -158,8 +559,8 @@ int main(int argc, char *argv[]) {
     }
     
     // ~~~ 2) Filesystem Initialization
-    if (init_filesystem(image_file, p_num, s_num, verbose_flag) != 0) {
-        cleanup_filesystem();
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
         return 1;
     }
 
@@ -167,38 +568,58 @@ int main(int argc, char *argv[]) {
     char *canonical_src_path = canonicalize_path(src_path);
     if (!canonical_src_path) {
         fprintf(stderr, "Error: Failed to canonicalize path: %s\n", src_path);
-        cleanup_filesystem();
+        cleanup_filesystem(fs);
         return 1;
     }
     
-    uint32_t src_inode_num = get_inode_by_path(canonical_src_path);
+    // The mode and size come from the path index when there is one;
+    // the full inode is only read when more of it is printed
+    uint16_t src_mode;
+    uint32_t src_size;
+    uint32_t src_inode_num = stat_path(fs, canonical_src_path, &src_mode, \
+        &src_size);
     if (src_inode_num == 0) {
         fprintf(stderr, "minls: Can't find %s\n", canonical_src_path);
         free(canonical_src_path);
-        cleanup_filesystem();
+        cleanup_filesystem(fs);
         return 1;
     }
 
-    // ~~~ 4. Read Inode and Check File Type
-    minix_inode_t src_inode;
-    if (read_inode(src_inode_num, &src_inode) != 0) {
-        fprintf(stderr, "minls: Failed to read inode %u.\n", src_inode_num);
-        free(canonical_src_path);
-        cleanup_filesystem();
-        return 1;
-    }
-
-    if (verbose_flag) {
+    // ~~~ 4. Check File Type
+    if (opts.verbose) {
+        minix_inode_t src_inode;
+        if (read_inode(fs, src_inode_num, &src_inode) != 0) {
+            fprintf(stderr, "minls: Failed to read inode %u.\n", \
+                src_inode_num);
+            free(canonical_src_path);
+            cleanup_filesystem(fs);
+            return 1;
+        }
         print_verbose_inode(src_inode_num, &src_inode);
     }
     
     // ~~~ 5. List Contents or Single File
     int status = 0;
+    if (out_format == OUT_FORMAT_BIN) {
+        out_write(MINLS_BIN_MAGIC, strlen(MINLS_BIN_MAGIC));
+    }
     
     // Check if it's a directory (0040000 mask)
-    if ((src_inode.mode & 0170000) == 0040000) {
-        // List the contents of the directory
-        status = list_directory_contents(src_inode_num, canonical_src_path);
+    if ((src_mode & 0170000) == 0040000) {
+        // List the contents of the directory (and, with -R, of every
+        // directory below it)
+        if (recursive_flag) {
+            visited_dirs = calloc((size_t)fs->sb.ninodes / 8 + 1, 1);
+            if (!visited_dirs) {
+                perror("minls: Error allocating directory map");
+                free(canonical_src_path);
+                cleanup_filesystem(fs);
+                return 1;
+            }
+        }
+        status = list_directory_contents(fs, src_inode_num, canonical_src_path);
+        free(visited_dirs);
+        visited_dirs = NULL;
     } else {
         // List the single file or non-directory item itself
         char *filename = canonical_src_path;
@@ -213,12 +634,30 @@ int main(int argc, char *argv[]) {
         
 // Use a simple version of the list_single_entry logic, passing the full path
         // which matches the reference output (e.g., /Files/0000_Zones).
-        list_single_entry(src_inode_num, filename);
+        // The text format shows nothing but the mode and size
+        if (out_format == OUT_FORMAT_TEXT) {
+            minix_inode_t src_inode;
+            memset(&src_inode, 0, sizeof(src_inode));
+            src_inode.mode = src_mode;
+            src_inode.size = src_size;
+            print_entry(src_inode_num, &src_inode, "", filename);
+        } else if (out_format == OUT_FORMAT_BIN) {
+            list_single_entry(fs, src_inode_num, "", canonical_src_path);
+        } else {
+            // NDJSON splits the path into its directory and name
+            char *slash = strrchr(canonical_src_path, '/');
+            const char *dir = (slash == canonical_src_path) ? "/" : \
+                canonical_src_path;
+            *slash = '\0';
+            list_single_entry(fs, src_inode_num, dir, slash + 1);
+        }
     }
 
     // ~~~ 6. Cleanup
+    out_flush();
+    if (out_failed) status = -1;
     free(canonical_src_path);
-    cleanup_filesystem();
+    cleanup_filesystem(fs);
 
     // converting status (representing all internal success/failure states)
     // to the standard shell convention:
@@ -0,0 +1,528 @@
+#define _GNU_SOURCE // ppoll, SOCK_NONBLOCK
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// One client connection, served by its own thread
+typedef struct conn {
+    minix_fs_t *fs;
+    int fd;
+    struct conn *prev;
+    struct conn *next;
+} conn_t;
+
+// Open connections, so shutdown can wake their threads and wait for them
+static conn_t *conns = NULL;
+static int active_conns = 0;
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conns_done = PTHREAD_COND_INITIALIZER;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+int serve_connection(minix_fs_t *fs, int fd);
+
+
+/**
+ * Prints the usage message for minsrv.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-i io] [-c KiB] \
+[-p part [-s subpart]] imagefile socketpath\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -c <KiB>   block cache size, \
+    0 to disable (default: 4096)\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock and \
+every request to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * Sends a reply header. Returns 0 on success, -1 on failure.
+ */
+static int send_reply(int fd, int32_t status, uint32_t flags, \
+    uint64_t length) {
+    minsrv_reply_t reply;
+    reply.status = status;
+    reply.flags = flags;
+    reply.length = length;
+    return write_all(fd, &reply, sizeof(reply));
+}
+
+/**
+ * Resolves a request path to its inode.
+ * Returns 0 on success, or an errno value for the reply.
+ */
+static int resolve_path(minix_fs_t *fs, const char *path, \
+    uint32_t *inode_num_out, minix_inode_t *inode_out) {
+    char *canonical_path = canonicalize_path(path);
+    if (!canonical_path) return ENOMEM;
+
+    uint32_t inode_num = get_inode_by_path(fs, canonical_path);
+    free(canonical_path);
+    if (inode_num == 0) return ENOENT;
+
+    if (read_inode(fs, inode_num, inode_out) != 0) return EIO;
+    *inode_num_out = inode_num;
+    return 0;
+}
+
+/**
+ * Appends one listing record to a growable reply buffer. inode is NULL
+ * for an entry whose inode couldn't be read.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int add_dirent(uint8_t **buf, size_t *len, size_t *cap, \
+    uint32_t inode_num, const minix_inode_t *inode, const char *name, \
+    size_t name_len) {
+    minsrv_dirent_t rec;
+    size_t need = sizeof(rec) + name_len;
+
+    if (*len + need > *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 4096;
+        while (new_cap < *len + need) new_cap *= 2;
+        uint8_t *grown = realloc(*buf, new_cap);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = new_cap;
+    }
+
+    rec.inode = inode_num;
+    rec.mode = inode ? inode->mode : 0;
+    rec.name_len = (uint16_t)name_len;
+    rec.size = inode ? inode->size : 0;
+    rec.flags = inode ? 0 : MINSRV_DIRENT_UNREADABLE;
+    memcpy(*buf + *len, &rec, sizeof(rec));
+    memcpy(*buf + *len + sizeof(rec), name, name_len);
+    *len += need;
+    return 0;
+}
+
+/**
+ * MINSRV_OP_LS: lists a directory (in on-disk order, inodes fetched in
+ * one bulk pass) or describes a single file. The reply is assembled in
+ * memory so its length is known up front.
+ * Returns 0 if the connection is still usable, -1 otherwise.
+ */
+static int serve_ls(minix_fs_t *fs, int fd, const char *path) {
+    minix_inode_t inode;
+    uint32_t inode_num;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    uint32_t flags = 0;
+    uint32_t i;
+
+    int err = resolve_path(fs, path, &inode_num, &inode);
+    if (err != 0) return send_reply(fd, err, 0, 0);
+
+    if ((inode.mode & 0170000) == 0040000) {
+        minix_dir_entry_t *entries = NULL;
+        uint32_t count = 0;
+
+        flags = MINSRV_REPLY_DIR;
+        if (read_directory(fs, &inode, &entries, &count, NULL) != 0) {
+            return send_reply(fd, ENOMEM, 0, 0);
+        }
+
+        uint32_t *nums = malloc((count ? count : 1) * sizeof(uint32_t));
+        minix_inode_t *inodes = \
+            malloc((count ? count : 1) * sizeof(minix_inode_t));
+        uint8_t *ok = malloc(count ? count : 1);
+        if (!nums || !inodes || !ok) err = ENOMEM;
+
+        for (i = 0; err == 0 && i < count; i++) {
+            nums[i] = entries[i].inode;
+        }
+        if (err == 0 && read_inodes_bulk(fs, nums, count, inodes, ok) != 0) {
+            err = ENOMEM;
+        }
+        for (i = 0; err == 0 && i < count; i++) {
+            // Unreadable inodes are flagged so the client can report
+            // them the way minls does
+            const char *name = (const char *)entries[i].name;
+            if (add_dirent(&buf, &len, &cap, entries[i].inode, \
+                ok[i] ? &inodes[i] : NULL, name, strnlen(name, 60)) != 0) {
+                err = ENOMEM;
+            }
+        }
+
+        free(nums);
+        free(inodes);
+        free(ok);
+        free(entries);
+    } else {
+        // A single file is listed under its path, minus the leading slash
+        const char *name = path + strspn(path, "/");
+        if (add_dirent(&buf, &len, &cap, inode_num, &inode, name, \
+            strlen(name)) != 0) {
+            err = ENOMEM;
+        }
+    }
+
+    if (err != 0) {
+        free(buf);
+        return send_reply(fd, err, 0, 0);
+    }
+
+    int status = send_reply(fd, 0, flags, len);
+    if (status == 0 && len > 0) status = write_all(fd, buf, len);
+    free(buf);
+    return status;
+}
+
+/**
+ * MINSRV_OP_GET: streams a regular file's contents straight from the
+ * image to the socket (sendfile, or a write from the mapping).
+ * Returns 0 if the connection is still usable, -1 otherwise.
+ */
+static int serve_get(minix_fs_t *fs, int fd, const char *path) {
+    minix_inode_t inode;
+    uint32_t inode_num;
+
+    int err = resolve_path(fs, path, &inode_num, &inode);
+    if (err != 0) return send_reply(fd, err, 0, 0);
+
+    if ((inode.mode & 0170000) != 0100000) {
+        return send_reply(fd, EINVAL, 0, 0);
+    }
+
+    if (send_reply(fd, 0, 0, inode.size) != 0) return -1;
+
+    // A failure part way can't be reported in band: the client sees the
+    // connection close before length bytes arrived
+    return copy_file_data(fs, inode_num, &inode, fd);
+}
+
+/**
+ * MINSRV_OP_STAT: returns the inode number and raw inode.
+ * Returns 0 if the connection is still usable, -1 otherwise.
+ */
+static int serve_stat(minix_fs_t *fs, int fd, const char *path) {
+    minsrv_stat_t st;
+    minix_inode_t inode;
+    uint32_t inode_num;
+
+    int err = resolve_path(fs, path, &inode_num, &inode);
+    if (err != 0) return send_reply(fd, err, 0, 0);
+    st.inode_num = inode_num;
+    st.inode = inode;
+
+    if (send_reply(fd, 0, 0, sizeof(st)) != 0) return -1;
+    return write_all(fd, &st, sizeof(st));
+}
+
+/**
+ * Serves requests on one connection until the client closes it or
+ * sends something malformed.
+ * Returns 0 on a clean close, -1 on error.
+ */
+int serve_connection(minix_fs_t *fs, int fd) {
+    char path[MINSRV_PATH_MAX + 1];
+
+    for (;;) {
+        minsrv_request_t req;
+        if (read_all(fd, &req, sizeof(req)) != 0) {
+            // End of file between requests is the normal way out
+            return errno == 0 ? 0 : -1;
+        }
+        if (req.magic != MINSRV_MAGIC || req.path_len > MINSRV_PATH_MAX) {
+            if (fs->verbose) {
+                fprintf(stderr, "minsrv: dropping malformed request\n");
+            }
+            return -1;
+        }
+        if (read_all(fd, path, req.path_len) != 0) return -1;
+        path[req.path_len] = '\0';
+
+        int status;
+        switch (req.op) {
+            case MINSRV_OP_LS:
+                status = serve_ls(fs, fd, path);
+                break;
+            case MINSRV_OP_GET:
+                status = serve_get(fs, fd, path);
+                break;
+            case MINSRV_OP_STAT:
+                status = serve_stat(fs, fd, path);
+                break;
+            default:
+                status = send_reply(fd, EINVAL, 0, 0);
+                break;
+        }
+
+        if (fs->verbose) {
+            fprintf(stderr, "minsrv: op %u %s%s\n", req.op, path, \
+                status == 0 ? "" : " (connection lost)");
+        }
+        if (status != 0) return -1;
+    }
+}
+
+/**
+ * Connection thread: serves the connection, then unregisters it.
+ */
+static void *conn_thread(void *arg) {
+    conn_t *c = arg;
+
+    serve_connection(c->fs, c->fd);
+    close(c->fd);
+
+    pthread_mutex_lock(&conns_lock);
+    if (c->prev) c->prev->next = c->next;
+    else conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    active_conns--;
+    pthread_cond_signal(&conns_done);
+    pthread_mutex_unlock(&conns_lock);
+
+    free(c);
+    return NULL;
+}
+
+/**
+ * Registers a new connection and starts its thread.
+ * Returns 0 on success, -1 on failure (the descriptor is closed).
+ */
+static int start_connection(minix_fs_t *fs, int fd) {
+    conn_t *c = calloc(1, sizeof(conn_t));
+    pthread_t tid;
+
+    if (!c) {
+        close(fd);
+        return -1;
+    }
+    c->fs = fs;
+    c->fd = fd;
+
+    pthread_mutex_lock(&conns_lock);
+    c->next = conns;
+    if (conns) conns->prev = c;
+    conns = c;
+    active_conns++;
+    pthread_mutex_unlock(&conns_lock);
+
+    // The thread inherits the main thread's mask, which blocks the stop
+    // signals, so they are only ever taken in the main thread's ppoll
+    int rc = pthread_create(&tid, NULL, conn_thread, c);
+
+    if (rc != 0) {
+        pthread_mutex_lock(&conns_lock);
+        conns = c->next;
+        if (conns) conns->prev = NULL;
+        active_conns--;
+        pthread_mutex_unlock(&conns_lock);
+        close(fd);
+        free(c);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/**
+ * Wakes every connection thread (their next read sees end of file) and
+ * waits for all of them to finish.
+ */
+static void stop_connections(void) {
+    pthread_mutex_lock(&conns_lock);
+    for (conn_t *c = conns; c; c = c->next) {
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    while (active_conns > 0) {
+        pthread_cond_wait(&conns_done, &conns_lock);
+    }
+    pthread_mutex_unlock(&conns_lock);
+}
+
+/**
+ * Creates the listening socket at socket_path, replacing a stale socket
+ * left there by an earlier run.
+ * Returns the descriptor, or -1 on failure.
+ */
+static int open_listener(const char *socket_path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "minsrv: socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("minsrv: Error creating socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || \
+        listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "minsrv: Error listening on %s: %s\n", \
+            socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Main function for minsrv
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    fs_options_t opts;
+    minix_fs_t *fs;
+    char *image_file = NULL;
+    char *socket_path = NULL;
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:c:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_cache_size(optarg, &opts.block_cache_budget) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        fprintf(stderr, "Error: Missing required arguments \
+(imagefile, socketpath).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    image_file = argv[optind++];
+    socket_path = argv[optind];
+
+    // 2) Open the image once for the life of the server
+    fs = init_filesystem(image_file, p_num, s_num, &opts);
+    if (!fs) {
+        return 1;
+    }
+
+    int listen_fd = open_listener(socket_path);
+    if (listen_fd < 0) {
+        cleanup_filesystem(fs);
+        return 1;
+    }
+
+    // 3) Serve until SIGINT/SIGTERM. Clients going away mid-reply must
+    // not kill the server. The stop signals stay blocked except inside
+    // ppoll, so one that arrives before the wait starts is taken there
+    // instead of being lost while the server sleeps.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    sigset_t stop_set, wait_set;
+    sigemptyset(&stop_set);
+    sigaddset(&stop_set, SIGINT);
+    sigaddset(&stop_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_set, &wait_set);
+    sigdelset(&wait_set, SIGINT);
+    sigdelset(&wait_set, SIGTERM);
+
+    int status = 0;
+    while (!stop_requested) {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (ppoll(&pfd, 1, NULL, &wait_set) < 0) {
+            if (errno == EINTR) continue;
+            perror("minsrv: Error waiting for connections");
+            status = -1;
+            break;
+        }
+
+        // The listener is non-blocking: a client that gave up between
+        // the poll and here must not stall the loop
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || \
+                errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            perror("minsrv: Error accepting connection");
+            status = -1;
+            break;
+        }
+        if (start_connection(fs, fd) != 0) {
+            fprintf(stderr, "minsrv: Error starting connection thread\n");
+        }
+    }
+
+    // 4) Cleanup
+    close(listen_fd);
+    unlink(socket_path);
+    stop_connections();
+    cleanup_filesystem(fs);
+
+    return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+
+// Free extents are binned by length: bucket b holds runs of
+// [2^b, 2^(b+1)) zones. Zone numbers are 32 bits, so 32 buckets do.
+#define EXTENT_BUCKETS 32
+
+// Output formats (-f)
+typedef enum {
+    OUT_FORMAT_TEXT = 0,        // a short report per image
+    OUT_FORMAT_JSON             // one JSON object per image (NDJSON)
+} out_format_t;
+
+// Counts for one image, all taken from its bitmaps
+typedef struct {
+    uint64_t inodes;            // inodes in the filesystem
+    uint64_t inodes_used;
+    uint64_t zones;             // data zones in the filesystem
+    uint64_t zones_used;
+    uint64_t extents;           // runs of free zones
+    uint64_t largest_extent;    // zones in the longest run
+    uint64_t bucket_count[EXTENT_BUCKETS];
+    uint64_t bucket_zones[EXTENT_BUCKETS];
+} image_stats_t;
+
+// Long options; --stats[=fmt] has no short form
+static const struct option long_options[] = {
+    { "stats", optional_argument, NULL, FS_OPT_STATS },
+    { NULL, 0, NULL, 0 }
+};
+
+// Function prototypes
+void print_usage(const char *progname);
+void scan_free_extents(const uint8_t *zmap, uint64_t first_bit, \
+    uint64_t end_bit, image_stats_t *st);
+int stat_image(minix_fs_t *fs, image_stats_t *st);
+void print_text(const char *image_file, const minix_fs_t *fs, \
+    const image_stats_t *st);
+void print_json(const char *image_file, const minix_fs_t *fs, \
+    const image_stats_t *st);
+
+
+/**
+ * Prints the usage message for minstat.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-f fmt] [-i io] \
+[-p part [-s subpart]] imagefile...\n", progname);
+    fprintf(stderr, "Counts used and free inodes and zones and sizes up \
+free space from the bitmaps.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <num>   select primary partition \
+    for filesystem (default: none)\n");
+    fprintf(stderr, "  -s <num>   select subpartition for \
+    filesystem (default: none)\n");
+    fprintf(stderr, "  -i <io>    image I/O backend: \
+    pread or mmap (default: pread)\n");
+    fprintf(stderr, "  -f <fmt>   output format: text or json (NDJSON) \
+(default: text)\n");
+    fprintf(stderr, "  -v         verbose. Print the superblock \
+to stderr.\n");
+    fprintf(stderr, "  --stats[=fmt]  print I/O and lookup counters at exit \
+(text or json)\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+/**
+ * Records one run of len free zones.
+ */
+static void add_extent(image_stats_t *st, uint64_t len) {
+    int b = 63 - __builtin_clzll(len);
+    if (b >= EXTENT_BUCKETS) b = EXTENT_BUCKETS - 1;
+    st->bucket_count[b]++;
+    st->bucket_zones[b] += len;
+    st->extents++;
+    if (len > st->largest_extent) st->largest_extent = len;
+}
+
+/**
+ * Finds the runs of clear bits in [first_bit, end_bit) of the zone map
+ * and adds them to st. Words that are all used or all free are taken
+ * whole; mixed words are walked a run at a time with count-trailing-
+ * zeros rather than a bit at a time.
+ */
+void scan_free_extents(const uint8_t *zmap, uint64_t first_bit, \
+    uint64_t end_bit, image_stats_t *st) {
+    uint64_t run = 0;           // free zones in the run being measured
+    uint64_t bit = first_bit;
+
+    while (bit < end_bit) {
+        if ((bit & 63) != 0 || end_bit - bit < 64) {
+            // Odd bits at either end of the map
+            if ((zmap[bit / 8] >> (bit % 8)) & 1) {
+                if (run) add_extent(st, run);
+                run = 0;
+            } else {
+                run++;
+            }
+            bit++;
+            continue;
+        }
+
+        uint64_t w;
+        memcpy(&w, zmap + bit / 8, sizeof(w));
+        if (w == 0) {
+            run += 64;
+        } else if (w == ~(uint64_t)0) {
+            if (run) add_extent(st, run);
+            run = 0;
+        } else {
+            unsigned pos = 0;
+            while (pos < 64) {
+                uint64_t rest = w >> pos;
+                unsigned n;
+                if (rest & 1) {
+                    // Used zones end the run; skip past them
+                    if (run) add_extent(st, run);
+                    run = 0;
+                    n = (unsigned)__builtin_ctzll(~rest);
+                } else {
+                    n = rest ? (unsigned)__builtin_ctzll(rest) : 64 - pos;
+                    run += n;
+                }
+                if (n > 64 - pos) n = 64 - pos;
+                pos += n;
+            }
+        }
+        bit += 64;
+    }
+    if (run) add_extent(st, run);
+}
+
+/**
+ * Reads both bitmaps of fs and fills in st.
+ * Returns 0 on success, -1 on failure.
+ */
+int stat_image(minix_fs_t *fs, image_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    uint8_t *maps = read_bitmaps(fs);
+    if (!maps) return -1;
+
+    uint64_t map_bytes = (uint64_t)fs->sb.blocksize;
+    uint64_t imap_bits = (uint64_t)fs->sb.i_blocks * map_bytes * 8;
+    uint64_t zmap_bits = (uint64_t)fs->sb.z_blocks * map_bytes * 8;
+    const uint8_t *zmap = maps + (size_t)fs->sb.i_blocks * map_bytes;
+
+    // Bit 0 of each map is reserved; a map too small for the counts in
+    // the superblock is only trusted as far as it goes
+    st->inodes = fs->sb.ninodes;
+    st->zones = fs->sb.zones > fs->sb.firstdata ? \
+        fs->sb.zones - fs->sb.firstdata : 0;
+    if (st->inodes + 1 > imap_bits || st->zones + 1 > zmap_bits) {
+        fprintf(stderr, "Warning: Bitmaps are smaller than the superblock \
+counts; counting what they cover.\n");
+        if (st->inodes + 1 > imap_bits) st->inodes = imap_bits - 1;
+        if (st->zones + 1 > zmap_bits) st->zones = zmap_bits - 1;
+    }
+
+    st->inodes_used = count_bits(maps, 1, st->inodes + 1);
+    st->zones_used = count_bits(zmap, 1, st->zones + 1);
+    scan_free_extents(zmap, 1, st->zones + 1, st);
+
+    free(maps);
+    return 0;
+}
+
+/**
+ * Returns part as a percentage of whole (0 if whole is 0).
+ */
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/**
+ * Prints the report for one image.
+ */
+void print_text(const char *image_file, const minix_fs_t *fs, \
+    const image_stats_t *st) {
+    uint64_t zone_size = fs->zone_size;
+    uint64_t free_zones = st->zones - st->zones_used;
+
+    printf("%s:\n", image_file);
+    printf("  inodes: %10llu used %10llu free %10llu total (%5.1f%% used)\n",
+        (unsigned long long)st->inodes_used,
+        (unsigned long long)(st->inodes - st->inodes_used),
+        (unsigned long long)st->inodes,
+        percent(st->inodes_used, st->inodes));
+    printf("  zones:  %10llu used %10llu free %10llu total (%5.1f%% used)\n",
+        (unsigned long long)st->zones_used,
+        (unsigned long long)free_zones,
+        (unsigned long long)st->zones,
+        percent(st->zones_used, st->zones));
+    printf("  bytes:  %10llu used %10llu free (zone size %llu)\n",
+        (unsigned long long)(st->zones_used * zone_size),
+        (unsigned long long)(free_zones * zone_size),
+        (unsigned long long)zone_size);
+    printf("  free extents: %llu, largest %llu zones\n",
+        (unsigned long long)st->extents,
+        (unsigned long long)st->largest_extent);
+    if (st->extents == 0) return;
+
+    printf("  %23s %10s %10s %6s\n", "extent zones", "extents", "zones",
+        "free%");
+    for (int b = 0; b < EXTENT_BUCKETS; b++) {
+        if (st->bucket_count[b] == 0) continue;
+        char range[24];
+        uint64_t lo = (uint64_t)1 << b;
+        uint64_t hi = ((uint64_t)1 << (b + 1)) - 1;
+        if (lo == hi) {
+            snprintf(range, sizeof(range), "%llu", (unsigned long long)lo);
+        } else {
+            snprintf(range, sizeof(range), "%llu-%llu", \
+                (unsigned long long)lo, (unsigned long long)hi);
+        }
+        printf("  %23s %10llu %10llu %5.1f%%\n", range,
+            (unsigned long long)st->bucket_count[b],
+            (unsigned long long)st->bucket_zones[b],
+            percent(st->bucket_zones[b], free_zones));
+    }
+}
+
+/**
+ * Prints str as a JSON string. Bytes above 0x7f are escaped as \u00XX
+ * like control characters, since an image path need not be UTF-8.
+ */
+static void print_json_str(const char *str) {
+    putchar('"');
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20 || c >= 0x80) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * Prints one image as a JSON object on one line. The histogram lists
+ * the non-empty buckets: "min" and "max" bound the extent lengths in
+ * zones.
+ */
+void print_json(const char *image_file, const minix_fs_t *fs, \
+    const image_stats_t *st) {
+    printf("{\"image\":");
+    print_json_str(image_file);
+    printf(",\"block_size\":%u,\"zone_size\":%u", \
+        fs->sb.blocksize, fs->zone_size);
+    printf(",\"inodes\":{\"total\":%llu,\"used\":%llu,\"free\":%llu}", \
+        (unsigned long long)st->inodes, \
+        (unsigned long long)st->inodes_used, \
+        (unsigned long long)(st->inodes - st->inodes_used));
+    printf(",\"zones\":{\"total\":%llu,\"used\":%llu,\"free\":%llu}", \
+        (unsigned long long)st->zones, \
+        (unsigned long long)st->zones_used, \
+        (unsigned long long)(st->zones - st->zones_used));
+    printf(",\"free_extents\":{\"count\":%llu,\"largest\":%llu,\
+\"histogram\":[", (unsigned long long)st->extents, \
+        (unsigned long long)st->largest_extent);
+    int first = 1;
+    for (int b = 0; b < EXTENT_BUCKETS; b++) {
+        if (st->bucket_count[b] == 0) continue;
+        printf("%s{\"min\":%llu,\"max\":%llu,\"count\":%llu,\"zones\":%llu}",
+            first ? "" : ",",
+            (unsigned long long)((uint64_t)1 << b),
+            (unsigned long long)(((uint64_t)1 << (b + 1)) - 1),
+            (unsigned long long)st->bucket_count[b],
+            (unsigned long long)st->bucket_zones[b]);
+        first = 0;
+    }
+    printf("]}}\n");
+}
+
+/**
+ * Main function for minstat
+ */
+int main(int argc, char *argv[]) {
+    int p_num = -1, s_num = -1;
+    out_format_t out_format = OUT_FORMAT_TEXT;
+    fs_options_t opts;
+    int opt;
+
+    // 1) Parse Arguments
+    fs_default_options(&opts);
+    while ((opt = getopt_long(argc, argv, "p:s:i:f:vh", \
+        long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'i':
+                if (parse_io_backend(optarg, &opts.io_backend) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    out_format = OUT_FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    out_format = OUT_FORMAT_JSON;
+                } else {
+                    fprintf(stderr, "Error: Unknown output format '%s'.\n", \
+                        optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case FS_OPT_STATS:
+                if (parse_stats_format(optarg ? optarg : "text", \
+                    &opts.stats) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // 2) Only the superblock and the bitmaps are read, so skip the path
+    // index and the block cache
+    opts.path_index = "";
+    opts.block_cache_budget = 0;
+
+    // 3) Report each image; a bad one doesn't stop the rest
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        const char *image_file = argv[i];
+        image_stats_t st;
+
+        minix_fs_t *fs = init_filesystem(image_file, p_num, s_num, &opts);
+        if (!fs) {
+            status = 1;
+            continue;
+        }
+        if (stat_image(fs, &st) != 0) {
+            fprintf(stderr, "Error: %s: Could not read the bitmaps.\n", \
+                image_file);
+            status = 1;
+        } else if (out_format == OUT_FORMAT_JSON) {
+            print_json(image_file, fs, &st);
+        } else {
+            print_text(image_file, fs, &st);
+        }
+        cleanup_filesystem(fs);
+    }
+
+    if (fflush(stdout) != 0) {
+        perror("write stdout");
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,804 @@
+#include "fs_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+
+// Where the -p/-s partitions start, in sectors from the disk start
+#define PART_START_SECTOR 2048
+#define SUBPART_START_SECTOR 4096
+
+// Largest run of free zones -F leaves between two allocations
+#define FRAG_MAX_GAP 8
+
+// File data and directory blocks are written in runs of up to this
+// many bytes of consecutive zones
+#define WRITE_RUN_SIZE (1024 * 1024)
+
+// Default shape: 1000 files of 0-16 KiB, 64 entries per directory
+#define DEFAULT_FILES 1000
+#define DEFAULT_FANOUT 64
+#define DEFAULT_SIZE_MAX (16 * 1024)
+
+// xorshift64 state; the sizes and the layout decisions use separate
+// streams so the size of file N doesn't depend on -F or -H
+typedef struct {
+    uint64_t s;
+} rng_t;
+
+// Everything about the image being generated
+typedef struct {
+    // Shape (from the command line)
+    uint32_t nfiles;
+    uint32_t fanout;
+    uint64_t size_min;
+    uint64_t size_max;
+    int size_log;               // log-uniform instead of uniform sizes
+    uint32_t frag_pct;          // chance an allocation skips free zones
+    uint32_t hole_pct;          // chance a file zone is a hole
+    int no_data;                // leave file contents unwritten (zeros)
+    uint64_t seed;
+
+    // Geometry
+    uint32_t blocksize;
+    uint32_t log_zone_size;
+    uint32_t zone_size;
+    uint32_t ptrs_per_block;
+    uint32_t ninodes;
+    uint32_t i_blocks;
+    uint32_t z_blocks;
+    uint32_t itable_blocks;
+    uint32_t firstdata;
+    uint64_t zone_limit;        // no zone at or past this is allocated
+    uint64_t max_file;          // bytes one inode can address
+    off_t fs_offset;
+
+    // Allocation state
+    rng_t size_rng;
+    rng_t layout_rng;
+    uint32_t next_inode;
+    uint64_t next_zone;
+    uint64_t zones_left;        // zones still to allocate, at most
+    uint32_t file_counter;
+    uint32_t dirs;
+    uint64_t data_bytes;
+    uint8_t *imap;
+    uint8_t *zmap;
+    minix_inode_t *inodes;
+    uint32_t *file_zones;       // one file's zone pointers, by logical zone
+    int32_t now;
+
+    // Output
+    int fd;
+    uint8_t *run_buf;           // consecutive zones waiting to be written
+    uint64_t run_first;         // first zone in run_buf
+    uint32_t run_zones;
+    uint32_t run_cap;           // zones run_buf holds
+    int failed;
+} image_builder_t;
+
+// Function prototypes
+void print_usage(const char *progname);
+int parse_size(const char *str, uint64_t *size_out);
+int parse_size_spec(const char *spec, image_builder_t *b);
+uint32_t build_dir(image_builder_t *b, uint32_t parent, uint32_t nfiles);
+
+
+/**
+ * Prints the usage message for mkminix.
+ */
+void print_usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-v] [-n files] [-f fanout] [-S sizes] \
+[-F pct] [-H pct] [-b blocksize] [-z log_zone_size] [-i inodes] \
+[-r seed] [-e] [-p part [-s subpart]] imagefile\n", progname);
+    fprintf(stderr, "Writes a MINIX v3 image of the given shape.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -n <num>   regular files to create (default: %d)\n", \
+        DEFAULT_FILES);
+    fprintf(stderr, "  -f <num>   entries per directory, at least 2; more \
+files make a deeper tree (default: %d)\n", DEFAULT_FANOUT);
+    fprintf(stderr, "  -S <spec>  file sizes: SIZE, MIN-MAX (uniform) \
+or log:MIN-MAX,\n             sizes may end in k, m or g \
+(default: 0-16k)\n");
+    fprintf(stderr, "  -F <pct>   fragmentation: chance each zone \
+allocation skips free zones (default: 0)\n");
+    fprintf(stderr, "  -H <pct>   chance each file zone is a hole \
+(default: 0)\n");
+    fprintf(stderr, "  -b <num>   block size in bytes (default: 4096)\n");
+    fprintf(stderr, "  -z <num>   log2 of blocks per zone (default: 0)\n");
+    fprintf(stderr, "  -i <num>   inodes in the filesystem \
+(default: just enough)\n");
+    fprintf(stderr, "  -r <num>   random seed (default: 1)\n");
+    fprintf(stderr, "  -e         don't write file contents: they read \
+as zeros and the image stays sparse\n");
+    fprintf(stderr, "  -p <num>   put the filesystem in this primary \
+partition\n");
+    fprintf(stderr, "  -s <num>   ...and in this subpartition of it\n");
+    fprintf(stderr, "  -v         verbose. Print the layout to stderr.\n");
+    fprintf(stderr, "  -h         print usage information and exit\n");
+}
+
+static uint64_t rng_next(rng_t *r) {
+    r->s ^= r->s << 13;
+    r->s ^= r->s >> 7;
+    r->s ^= r->s << 17;
+    return r->s;
+}
+
+/**
+ * Returns 1 with the given percent chance.
+ */
+static int rng_chance(rng_t *r, uint32_t pct) {
+    return pct > 0 && rng_next(r) % 100 < pct;
+}
+
+/**
+ * Parses a byte count with an optional k, m or g suffix.
+ * Returns 0 on success, -1 if it isn't one.
+ */
+int parse_size(const char *str, uint64_t *size_out) {
+    char *end;
+    uint64_t size = strtoull(str, &end, 10);
+
+    if (end == str) return -1;
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return -1;
+    *size_out = size;
+    return 0;
+}
+
+/**
+ * Parses a -S spec: SIZE, MIN-MAX or log:MIN-MAX.
+ * Returns 0 on success, -1 (error printed) if it isn't one.
+ */
+int parse_size_spec(const char *spec, image_builder_t *b) {
+    char buf[64];
+    const char *range = spec;
+
+    b->size_log = 0;
+    if (strncmp(range, "log:", 4) == 0) {
+        b->size_log = 1;
+        range += 4;
+    }
+    if (strlen(range) >= sizeof(buf)) {
+        fprintf(stderr, "mkminix: bad size spec %s\n", spec);
+        return -1;
+    }
+    strcpy(buf, range);
+
+    char *dash = strchr(buf, '-');
+    if (dash) *dash = '\0';
+    if (parse_size(buf, &b->size_min) != 0 || \
+        parse_size(dash ? dash + 1 : buf, &b->size_max) != 0 || \
+        b->size_min > b->size_max) {
+        fprintf(stderr, "mkminix: bad size spec %s\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Draws the next file size, clamped to what one inode can hold.
+ */
+static uint64_t next_file_size(image_builder_t *b) {
+    uint64_t span = b->size_max - b->size_min;
+    uint64_t size = b->size_min;
+
+    if (span > 0 && b->size_log) {
+        // Uniform in log(size + 1): most files small, a few large
+        double lo = log2((double)b->size_min + 1);
+        double hi = log2((double)b->size_max + 1);
+        double u = (double)(rng_next(&b->size_rng) >> 11) / (1ULL << 53);
+        size = (uint64_t)exp2(lo + (hi - lo) * u) - 1;
+        if (size < b->size_min) size = b->size_min;
+        if (size > b->size_max) size = b->size_max;
+    } else if (span > 0) {
+        size += rng_next(&b->size_rng) % (span + 1);
+    }
+    return size < b->max_file ? size : b->max_file;
+}
+
+static uint64_t div_up(uint64_t n, uint64_t d) {
+    return (n + d - 1) / d;
+}
+
+/**
+ * Zones a file of nzones data zones needs at most, pointer zones
+ * included.
+ */
+static uint64_t file_zone_bound(const image_builder_t *b, uint64_t nzones) {
+    uint64_t ptrs = b->ptrs_per_block;
+    uint64_t total = nzones;
+
+    if (nzones > DIRECT_ZONES) total++;
+    if (nzones > DIRECT_ZONES + ptrs) {
+        total += 1 + div_up(nzones - DIRECT_ZONES - ptrs, ptrs);
+    }
+    return total;
+}
+
+/**
+ * Number of files each subdirectory of a directory holding nfiles gets:
+ * the smallest power of the fanout that fits them all in fanout
+ * subdirectories.
+ */
+static uint64_t files_per_subdir(const image_builder_t *b, uint64_t nfiles) {
+    uint64_t per = b->fanout;
+    while (per * b->fanout < nfiles) per *= b->fanout;
+    return per;
+}
+
+/**
+ * Dry run of build_dir: counts the directories and the zones they and
+ * their files need, drawing the file sizes in the order build_dir will
+ * (the caller restores the size stream afterwards).
+ */
+static void plan_dir(image_builder_t *b, uint64_t nfiles, uint64_t *dirs, \
+    uint64_t *zones) {
+    uint64_t entries = 2;
+
+    (*dirs)++;
+    if (nfiles <= b->fanout) {
+        for (uint64_t k = 0; k < nfiles; k++) {
+            uint64_t size = next_file_size(b);
+            *zones += file_zone_bound(b, div_up(size, b->zone_size));
+        }
+        entries += nfiles;
+    } else {
+        uint64_t per = files_per_subdir(b, nfiles);
+        for (uint64_t done = 0; done < nfiles; done += per) {
+            uint64_t n = nfiles - done < per ? nfiles - done : per;
+            plan_dir(b, n, dirs, zones);
+            entries++;
+        }
+    }
+    *zones += div_up(entries * DIR_ENTRY_SIZE, b->zone_size);
+}
+
+/**
+ * Writes out the buffered run of zones.
+ */
+static void flush_run(image_builder_t *b) {
+    size_t len = (size_t)b->run_zones * b->zone_size;
+    off_t at = b->fs_offset + (off_t)(b->run_first * b->zone_size);
+    size_t done = 0;
+
+    while (done < len && !b->failed) {
+        ssize_t n = pwrite(b->fd, b->run_buf + done, len - done, \
+            at + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("mkminix: Error writing image");
+            b->failed = 1;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    b->run_zones = 0;
+}
+
+/**
+ * Returns the buffer to fill with the contents of zone (zone_size bytes,
+ * zeroed). Consecutive zones are collected and written in one go.
+ */
+static uint8_t *zone_buf(image_builder_t *b, uint64_t zone) {
+    if (b->run_zones == b->run_cap || \
+        (b->run_zones > 0 && zone != b->run_first + b->run_zones)) {
+        flush_run(b);
+    }
+    if (b->run_zones == 0) b->run_first = zone;
+
+    uint8_t *buf = b->run_buf + (size_t)b->run_zones * b->zone_size;
+    b->run_zones++;
+    memset(buf, 0, b->zone_size);
+    return buf;
+}
+
+/**
+ * Allocates the next free zone, sometimes leaving a gap of free zones
+ * first (-F). Gaps are only left while the zone map still has room for
+ * every zone the plan needs.
+ */
+static uint32_t alloc_zone(image_builder_t *b) {
+    if (rng_chance(&b->layout_rng, b->frag_pct)) {
+        uint64_t gap = 1 + rng_next(&b->layout_rng) % FRAG_MAX_GAP;
+        if (b->next_zone + gap + b->zones_left <= b->zone_limit) {
+            b->next_zone += gap;
+        }
+    }
+
+    uint64_t zone = b->next_zone++;
+    uint64_t bit = zone - b->firstdata + 1;
+    b->zmap[bit / 8] |= (uint8_t)(1 << (bit % 8));
+    if (b->zones_left > 0) b->zones_left--;
+    return (uint32_t)zone;
+}
+
+/**
+ * Takes the next inode number and marks it used.
+ */
+static uint32_t alloc_inode(image_builder_t *b) {
+    uint32_t ino = b->next_inode++;
+    b->imap[ino / 8] |= (uint8_t)(1 << (ino % 8));
+    return ino;
+}
+
+/**
+ * Fills a file data zone with a pattern derived from the inode and
+ * logical zone, zeroing it past the end of the file.
+ */
+static void fill_file_zone(uint8_t *dst, uint32_t zone_size, uint32_t ino, \
+    uint64_t logical_zone, uint64_t valid) {
+    rng_t r = { (((uint64_t)ino << 32) ^ logical_zone) * \
+        0x9E3779B97F4A7C15ULL | 1 };
+    uint32_t i;
+
+    for (i = 0; i + 8 <= zone_size; i += 8) {
+        uint64_t word = rng_next(&r);
+        memcpy(dst + i, &word, 8);
+    }
+    if (valid < zone_size) memset(dst + valid, 0, zone_size - valid);
+}
+
+/**
+ * Allocates and writes a pointer zone holding count pointers, unless
+ * they are all holes.
+ * Returns the zone, or 0 if none was needed.
+ */
+static uint32_t write_ptr_zone(image_builder_t *b, const uint32_t *ptrs, \
+    uint64_t count) {
+    uint64_t i = 0;
+
+    while (i < count && ptrs[i] == 0) i++;
+    if (i == count) return 0;
+
+    uint32_t zone = alloc_zone(b);
+    memcpy(zone_buf(b, zone), ptrs, count * sizeof(uint32_t));
+    return zone;
+}
+
+/**
+ * Points the inode at the zones in b->file_zones: direct zones, then
+ * the single and double indirect zones, written after the data.
+ */
+static void set_file_zones(image_builder_t *b, minix_inode_t *inode, \
+    uint64_t nzones) {
+    uint64_t ptrs = b->ptrs_per_block;
+    uint32_t *zones = b->file_zones;
+    uint64_t i;
+
+    for (i = 0; i < DIRECT_ZONES && i < nzones; i++) {
+        inode->zone[i] = zones[i];
+    }
+    if (nzones <= DIRECT_ZONES) return;
+
+    uint64_t n = nzones - DIRECT_ZONES < ptrs ? nzones - DIRECT_ZONES : ptrs;
+    inode->indirect = write_ptr_zone(b, zones + DIRECT_ZONES, n);
+    if (nzones <= DIRECT_ZONES + ptrs) return;
+
+    // Second-level pointer zones first, then the zone pointing at them
+    uint32_t *top = calloc(ptrs, sizeof(uint32_t));
+    if (!top) {
+        perror("mkminix: Error allocating pointer block");
+        b->failed = 1;
+        return;
+    }
+    uint64_t first = DIRECT_ZONES + ptrs;
+    for (i = 0; first + i * ptrs < nzones; i++) {
+        uint64_t at = first + i * ptrs;
+        n = nzones - at < ptrs ? nzones - at : ptrs;
+        top[i] = write_ptr_zone(b, zones + at, n);
+    }
+    inode->two_indirect = write_ptr_zone(b, top, i);
+    free(top);
+}
+
+/**
+ * Creates one regular file of the next drawn size.
+ * Returns its inode number.
+ */
+static uint32_t make_file(image_builder_t *b) {
+    uint32_t ino = alloc_inode(b);
+    minix_inode_t *inode = &b->inodes[ino - 1];
+    uint64_t size = next_file_size(b);
+    uint64_t nzones = div_up(size, b->zone_size);
+    uint64_t lz;
+
+    for (lz = 0; lz < nzones; lz++) {
+        if (rng_chance(&b->layout_rng, b->hole_pct)) {
+            b->file_zones[lz] = 0;
+            if (b->zones_left > 0) b->zones_left--;
+            continue;
+        }
+        b->file_zones[lz] = alloc_zone(b);
+        if (!b->no_data) {
+            uint64_t valid = size - lz * b->zone_size;
+            fill_file_zone(zone_buf(b, b->file_zones[lz]), b->zone_size, \
+                ino, lz, valid);
+        }
+    }
+
+    inode->mode = 0100644;
+    inode->links = 1;
+    inode->size = (uint32_t)size;
+    inode->atime = inode->mtime = inode->ctime = b->now;
+    set_file_zones(b, inode, nzones);
+    b->data_bytes += size;
+    return ino;
+}
+
+/**
+ * Appends a directory entry to a growing directory.
+ */
+static void add_dir_entry(minix_dir_entry_t *entries, uint32_t *count, \
+    uint32_t ino, const char *name) {
+    memset(&entries[*count], 0, sizeof(minix_dir_entry_t));
+    entries[*count].inode = ino;
+    strncpy((char *)entries[*count].name, name, \
+        sizeof(entries[*count].name));
+    (*count)++;
+}
+
+/**
+ * Creates a directory holding nfiles files: directly if they fit in
+ * the fanout, else spread over subdirectories d0000, d0001, ...
+ * parent is 0 for the root.
+ * Returns its inode number, or 0 on failure.
+ */
+uint32_t build_dir(image_builder_t *b, uint32_t parent, uint32_t nfiles) {
+    uint32_t ino = alloc_inode(b);
+    uint32_t nentries = 2 + (nfiles < b->fanout ? nfiles : b->fanout);
+    uint32_t count = 0;
+    uint32_t subdirs = 0;
+    char name[16];
+
+    minix_dir_entry_t *entries = calloc(nentries, sizeof(minix_dir_entry_t));
+    if (!entries) {
+        perror("mkminix: Error allocating directory");
+        b->failed = 1;
+        return 0;
+    }
+    b->dirs++;
+    add_dir_entry(entries, &count, ino, ".");
+    add_dir_entry(entries, &count, parent ? parent : ino, "..");
+
+    if (nfiles <= b->fanout) {
+        for (uint32_t k = 0; k < nfiles && !b->failed; k++) {
+            snprintf(name, sizeof(name), "f%07u", b->file_counter++);
+            add_dir_entry(entries, &count, make_file(b), name);
+        }
+    } else {
+        uint64_t per = files_per_subdir(b, nfiles);
+        for (uint64_t done = 0; done < nfiles && !b->failed; done += per) {
+            uint32_t n = (uint32_t)(nfiles - done < per ? nfiles - done : per);
+            snprintf(name, sizeof(name), "d%04u", subdirs++);
+            add_dir_entry(entries, &count, build_dir(b, ino, n), name);
+        }
+    }
+
+    // The directory's own blocks come after everything below it
+    minix_inode_t *inode = &b->inodes[ino - 1];
+    uint64_t bytes = (uint64_t)count * DIR_ENTRY_SIZE;
+    uint64_t nzones = div_up(bytes, b->zone_size);
+    for (uint64_t lz = 0; lz < nzones; lz++) {
+        uint64_t at = lz * b->zone_size;
+        uint64_t len = bytes - at < b->zone_size ? bytes - at : b->zone_size;
+        b->file_zones[lz] = alloc_zone(b);
+        memcpy(zone_buf(b, b->file_zones[lz]), (uint8_t *)entries + at, len);
+    }
+    inode->mode = 040755;
+    inode->links = (uint16_t)(2 + subdirs);
+    inode->size = (uint32_t)bytes;
+    inode->atime = inode->mtime = inode->ctime = b->now;
+    set_file_zones(b, inode, nzones);
+
+    free(entries);
+    return ino;
+}
+
+/**
+ * Writes all of buf at an absolute image offset.
+ * Returns 0 on success, -1 on failure (error printed).
+ */
+static int write_at(int fd, off_t offset, const void *buf, size_t len) {
+    const uint8_t *src = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pwrite(fd, src + done, len - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("mkminix: Error writing image");
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Writes a partition table with one MINIX partition in slot part_num
+ * into the sector at table_sector.
+ * Returns 0 on success, -1 on failure.
+ */
+static int write_partition_table(int fd, uint32_t table_sector, \
+    int part_num, uint32_t first_sector, uint32_t nsectors) {
+    uint8_t sector[SECTOR_SIZE];
+    partition_entry_t entry;
+
+    memset(sector, 0, sizeof(sector));
+    memset(&entry, 0, sizeof(entry));
+    entry.type = 0x81;
+    entry.lFirst = first_sector;
+    entry.size = nsectors;
+    memcpy(sector + PARTITION_TABLE_OFFSET + \
+        part_num * sizeof(partition_entry_t), &entry, sizeof(entry));
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    return write_at(fd, (off_t)table_sector * SECTOR_SIZE, sector, \
+        sizeof(sector));
+}
+
+/**
+ * Computes the layout from the shape: inode count, bitmap and inode
+ * table sizes, first data zone and how many zones the plan may use.
+ * Returns 0 on success, -1 (error printed) if it doesn't fit MINIX v3.
+ */
+static int plan_layout(image_builder_t *b) {
+    uint64_t ptrs = b->ptrs_per_block;
+    uint64_t dirs = 0;
+    uint64_t zones = 0;
+    rng_t sizes = b->size_rng;
+
+    b->zone_size = b->blocksize << b->log_zone_size;
+    b->max_file = (DIRECT_ZONES + ptrs + ptrs * ptrs) * b->zone_size;
+    if (b->max_file > UINT32_MAX) b->max_file = UINT32_MAX;
+
+    plan_dir(b, b->nfiles, &dirs, &zones);
+    b->size_rng = sizes;
+
+    uint64_t used_inodes = dirs + b->nfiles;
+    if (b->ninodes == 0) b->ninodes = (uint32_t)used_inodes;
+    if (used_inodes > b->ninodes || used_inodes >= UINT32_MAX) {
+        fprintf(stderr, "mkminix: %lu inodes needed, only %u allowed\n", \
+            (unsigned long)used_inodes, b->ninodes);
+        return -1;
+    }
+
+    // Room for the -F gaps on top of the zones themselves
+    uint64_t bound = zones + zones * b->frag_pct / 100 * FRAG_MAX_GAP / 2 + 1;
+
+    uint64_t bits_per_block = (uint64_t)b->blocksize * 8;
+    b->i_blocks = (uint32_t)div_up((uint64_t)b->ninodes + 1, bits_per_block);
+    b->itable_blocks = (uint32_t)div_up((uint64_t)b->ninodes * INODE_SIZE, \
+        b->blocksize);
+    // The zone map covers the metadata zones too, so iterate once
+    uint64_t firstdata = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        b->z_blocks = (uint32_t)div_up(firstdata + bound + 1, bits_per_block);
+        uint64_t meta_blocks = 2 + (uint64_t)b->i_blocks + b->z_blocks + \
+            b->itable_blocks;
+        firstdata = div_up(meta_blocks, 1ULL << b->log_zone_size);
+    }
+    b->z_blocks = (uint32_t)div_up(firstdata + bound + 1, bits_per_block);
+
+    if (b->i_blocks > INT16_MAX || b->z_blocks > INT16_MAX || \
+        firstdata > UINT16_MAX || firstdata + bound > UINT32_MAX) {
+        fprintf(stderr, "mkminix: too large for MINIX v3 with %u-byte \
+zones; try a larger -b or -z\n", b->zone_size);
+        return -1;
+    }
+    b->firstdata = (uint32_t)firstdata;
+    b->zone_limit = firstdata + bound;
+    b->zones_left = zones;
+    b->next_zone = firstdata;
+    return 0;
+}
+
+/**
+ * Writes the superblock, bitmaps and inode table.
+ * Returns 0 on success, -1 on failure.
+ */
+static int write_metadata(image_builder_t *b) {
+    minix_superblock_t sb;
+    off_t block = b->blocksize;
+
+    memset(&sb, 0, sizeof(sb));
+    sb.ninodes = b->ninodes;
+    sb.i_blocks = (int16_t)b->i_blocks;
+    sb.z_blocks = (int16_t)b->z_blocks;
+    sb.firstdata = (uint16_t)b->firstdata;
+    sb.log_zone_size = (int16_t)b->log_zone_size;
+    sb.max_file = (uint32_t)b->max_file;
+    sb.zones = (uint32_t)b->next_zone;
+    sb.magic = 0x4D5A;
+    sb.blocksize = (uint16_t)b->blocksize;
+
+    // Bit 0 of both maps is reserved and always set
+    b->imap[0] |= 1;
+    b->zmap[0] |= 1;
+
+    if (write_at(b->fd, b->fs_offset + 1024, &sb, sizeof(sb)) != 0 || \
+        write_at(b->fd, b->fs_offset + 2 * block, b->imap, \
+            (size_t)b->i_blocks * b->blocksize) != 0 || \
+        write_at(b->fd, b->fs_offset + (2 + b->i_blocks) * block, b->zmap, \
+            (size_t)b->z_blocks * b->blocksize) != 0 || \
+        write_at(b->fd, b->fs_offset + \
+            (2 + b->i_blocks + b->z_blocks) * block, b->inodes, \
+            (size_t)b->ninodes * INODE_SIZE) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Main function for mkminix
+ */
+int main(int argc, char *argv[]) {
+    image_builder_t b;
+    int p_num = -1, s_num = -1;
+    int verbose = 0;
+    char *image_file = NULL;
+    int opt;
+
+    // ~~~ 1) Parse Arguments
+    memset(&b, 0, sizeof(b));
+    b.nfiles = DEFAULT_FILES;
+    b.fanout = DEFAULT_FANOUT;
+    b.size_max = DEFAULT_SIZE_MAX;
+    b.blocksize = 4096;
+    b.seed = 1;
+    b.fd = -1;
+    while ((opt = getopt(argc, argv, "n:f:S:F:H:b:z:i:r:ep:s:vh")) != -1) {
+        switch (opt) {
+            case 'n':
+                b.nfiles = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                b.fanout = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                if (parse_size_spec(optarg, &b) != 0) return 1;
+                break;
+            case 'F':
+                b.frag_pct = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'H':
+                b.hole_pct = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                b.blocksize = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                b.log_zone_size = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                b.ninodes = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                b.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'e':
+                b.no_data = 1;
+                break;
+            case 'p':
+                p_num = atoi(optarg);
+                break;
+            case 's':
+                s_num = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        fprintf(stderr, "Error: Missing required argument (imagefile).\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    image_file = argv[optind];
+
+    if (b.blocksize < 1024 || b.blocksize > 32768 || \
+        (b.blocksize & (b.blocksize - 1)) != 0 || b.log_zone_size > 8 || \
+        b.fanout < 2 || b.frag_pct > 100 || b.hole_pct > 100 || \
+        p_num < -1 || p_num > 3 || s_num < -1 || s_num > 3 || \
+        (s_num != -1 && p_num == -1)) {
+        fprintf(stderr, "mkminix: invalid option value\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // ~~~ 2) Plan the layout
+    b.ptrs_per_block = b.blocksize / sizeof(uint32_t);
+    b.size_rng.s = b.seed * 0x9E3779B97F4A7C15ULL | 1;
+    b.layout_rng.s = (b.seed ^ 0x5DEECE66DULL) * 0xBF58476D1CE4E5B9ULL | 1;
+    b.next_inode = 1;
+    b.now = (int32_t)time(NULL);
+    if (plan_layout(&b) != 0) return 1;
+
+    if (p_num != -1) {
+        b.fs_offset = (off_t)(s_num != -1 ? SUBPART_START_SECTOR : \
+            PART_START_SECTOR) * SECTOR_SIZE;
+    }
+
+    uint64_t max_file_zones = div_up(b.max_file, b.zone_size);
+    b.run_cap = WRITE_RUN_SIZE / b.zone_size ? \
+        WRITE_RUN_SIZE / b.zone_size : 1;
+    b.imap = calloc(b.i_blocks, b.blocksize);
+    b.zmap = calloc(b.z_blocks, b.blocksize);
+    b.inodes = calloc(b.ninodes, sizeof(minix_inode_t));
+    b.file_zones = malloc(max_file_zones * sizeof(uint32_t));
+    b.run_buf = malloc((size_t)b.run_cap * b.zone_size);
+    if (!b.imap || !b.zmap || !b.inodes || !b.file_zones || !b.run_buf) {
+        perror("mkminix: Error allocating image tables");
+        return 1;
+    }
+
+    b.fd = open(image_file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (b.fd < 0) {
+        fprintf(stderr, "mkminix: Error opening %s: %s\n", image_file, \
+            strerror(errno));
+        return 1;
+    }
+
+    // ~~~ 3) Write the tree, then the metadata describing it
+    build_dir(&b, 0, b.nfiles);
+    flush_run(&b);
+    int status = b.failed ? -1 : write_metadata(&b);
+
+    off_t fs_bytes = (off_t)(b.next_zone * b.zone_size);
+    if (status == 0 && ftruncate(b.fd, b.fs_offset + fs_bytes) != 0) {
+        perror("mkminix: Error sizing image");
+        status = -1;
+    }
+
+    // ~~~ 4) Partition tables, if asked for
+    uint32_t fs_sectors = (uint32_t)div_up((uint64_t)fs_bytes, SECTOR_SIZE);
+    if (status == 0 && p_num != -1) {
+        uint32_t part_sectors = (uint32_t)(b.fs_offset / SECTOR_SIZE) + \
+            fs_sectors - PART_START_SECTOR;
+        status = write_partition_table(b.fd, 0, p_num, PART_START_SECTOR, \
+            part_sectors);
+        if (status == 0 && s_num != -1) {
+            status = write_partition_table(b.fd, PART_START_SECTOR, s_num, \
+                SUBPART_START_SECTOR, fs_sectors);
+        }
+    }
+
+    if (close(b.fd) != 0 && status == 0) {
+        perror("mkminix: Error closing image");
+        status = -1;
+    }
+
+    if (verbose && status == 0) {
+        fprintf(stderr, "%s: %u files, %u directories, %lu bytes of data\n", \
+            image_file, b.nfiles, b.dirs, (unsigned long)b.data_bytes);
+        fprintf(stderr, "  blocksize %u, zone size %u, %u inodes, \
+%lu zones (first data zone %u)\n", b.blocksize, b.zone_size, b.ninodes, \
+            (unsigned long)b.next_zone, b.firstdata);
+        fprintf(stderr, "  filesystem at byte %ld\n", (long)b.fs_offset);
+    }
+
+    free(b.imap);
+    free(b.zmap);
+    free(b.inodes);
+    free(b.file_zones);
+    free(b.run_buf);
+    return (status == 0) ? 0 : 1;
+}